@@ -26,6 +26,7 @@
 
 #include <sndfile.h>
 
+#include "sndindex.h"
 #include "sndstats.h"
 
 #define BUFSIZE (32000)
@@ -41,6 +42,7 @@ char* ProgName;
 static int Verbose = 0;
 static float Amplitude = -1.0;		// If -1, compute automatically
 static float Frequency = 440.0;
+static int UseIndex = 0;		// -I: amplitude from a sidecar index
 
 SNDFILE* InSound;
 SF_INFO  InInfo;
@@ -87,7 +89,7 @@ int main(int argc, char** argv) {
   const char* infn = "-";
   const char* bleepfn = "-";
     
-  while ((c = getopt(argc, argv, "a:f:stvb:i:o:")) != EOF) {
+  while ((c = getopt(argc, argv, "a:f:Istvb:i:o:")) != EOF) {
     switch (c) {
     case 'a':
       Amplitude = my_atof(optarg);
@@ -95,6 +97,9 @@ int main(int argc, char** argv) {
     case 'f':
       Frequency = my_atof(optarg);
       break;
+    case 'I':
+      UseIndex = 1;
+      break;
     case 'v':
       Verbose = 1;
       break;
@@ -162,8 +167,19 @@ int main(int argc, char** argv) {
       fprintf(stderr, "Computing amplitude...");
     }
     jstat stat;
+    jstat* got;
+    sndindex* ix = UseIndex ? sndindex_open(infn, 1) : NULL;
     // Hard wired for 5 minutes in 10 second chunks
-    sndstat_random(InSound, &InInfo, infn, 300.0, 10.0, &stat);
+    if (ix) {
+      got = sndindex_random(ix, InSound, &InInfo, infn, 300.0, 10.0, &stat);
+      sndindex_close(ix);
+    } else {
+      got = sndstat_random(InSound, &InInfo, infn, 300.0, 10.0, &stat);
+    }
+    if (got == NULL) {
+      fprintf(stderr, "%s: seek failed in input file %s\n", ProgName, infn);
+      exit(1);
+    }
     if (sf_seek(InSound, 0, SEEK_SET) == -1) {
       fprintf(stderr, "%s: couldn't rewind input file %s\n", ProgName, infn);
       usage();
@@ -206,7 +222,7 @@ static float my_atof(const char* in) {
 
 
 void usage() {
-  fprintf(stderr, "\nUsage: %s -a amp -f freq -v -i input -o output -b bleepfile\n",
+  fprintf(stderr, "\nUsage: %s -a amp -f freq -I -v -i input -o output -b bleepfile\n",
 	  ProgName);
   fprintf(stderr, "  -v		Verbose\n");
   fprintf(stderr, "  -i input   Input sound file [-]\n");
@@ -214,6 +230,7 @@ void usage() {
   fprintf(stderr, "  -b bleep   Bleep start/end time pairs [-]\n");
   fprintf(stderr, "  -a amp     Amplitude of tone [stddev]\n");
   fprintf(stderr, "  -f freq    Frequency of tome [440]\n");
+  fprintf(stderr, "  -I         Keep an index next to the input to speed up the stddev\n");
   fprintf(stderr, "\n");
   exit(1);
 }
@@ -17,32 +17,105 @@
 // program can estimate the gain required to equalize the volume.
 // The autogain computation is quite primitive. See comments below.
 //
+// Inputs may have any number of channels. By default, the output has
+// as many channels as the first input, inputs with that many channels
+// are mixed channel for channel, and mono inputs are sent to every
+// output channel. Anything else needs a routing matrix (-M). See
+// read_matrix().
+//
+// Instead of a constant scale, an input can be given a gain envelope
+// file (@file in place of the scale), with one "time gain" pair per
+// line. The gain is interpolated linearly between the points and held
+// at the first and last gains outside them. Blocks that fall within
+// a constant stretch of the envelope are mixed with a constant gain,
+// just like plain inputs. See read_envelope().
+//
+// Inputs whose sample rate differs from the output's (the first
+// input's, unless -r is given) are resampled as they are read, so
+// there's no need to convert them to temporary files first. See
+// sndresample.cc.
+//
+// Each input can be placed later in the output (-O) and cut down to
+// part of the file (-T). An input contributes nothing, and costs
+// nothing, until its start; no silence is read or summed for it.
+// Stretches where only one input is active reduce to a scaled copy.
+// See mix_loop().
+//
+// Instead of guessing a gain (-g) that avoids clipping, the mix can be
+// run through a look-ahead peak limiter (-l), which holds the output
+// within the given ceiling in a single pass. See sndlimit.cc.
+//
+// Mixes of hundreds or thousands of inputs can be split into groups
+// (-G) that are summed on separate threads and then added together in
+// a fixed tree, with a cap on the number of input files open at once
+// (-F). See mix_grouped().
+//
+// Live mode (-x) mixes raw PCM from FIFOs and pipes in small blocks
+// on a fixed clock, for monitoring. An input that is late for a block
+// is silent in it rather than holding up the mix. See mix_live().
+//
+// Batch mode (-B) runs many mixes in one process, reading them from a
+// manifest with one job per line and running several at once. A job
+// that fails is reported and the rest carry on. See run_batch().
+//
 // See usage() for command line arguments.
 //
 
 
 //
 // The autogain is computed by normalizing the input signals by their
-// standard deviation. This is computed by taking random samples of
-// size RandomSampleSize seconds until RandomSampleTime seconds have
-// been collected, and computing the stddev over that size. Note that
-// this requires lots of seeks, and will be very inefficient if the
-// stream is compressed or if RandomSampleTime is a large fraction of
-// the file size. You can specify a maximum gain. This helps prevent
-// very quiet channels from being boosted too much. You can also apply
-// a gain setting to the resulting output audio. Using a value less
-// than 1.0 helps prevent "clipping" when the signals are close to
-// saturation.
+// standard deviation. This is computed by taking excerpts of
+// RandomSampleSize seconds adding up to RandomSampleTime seconds, one
+// from each of as many equal stretches of the file, at offsets drawn
+// from RandomSeed (see sndstat_strata()), and computing the stddev over
+// them. The same seed always gives the same gains, and the excerpts are
+// read in file order, so a compressed stream is decoded at most once.
+// You can specify a maximum gain. This helps prevent very quiet
+// channels from being boosted too much. You can also apply a gain
+// setting to the resulting output audio. Using a value less than 1.0
+// helps prevent "clipping" when the signals are close to saturation.
+//
+// The statistics behind the autogain can be kept in a cache file
+// (-c), keyed by each input's path, size and modification time, and
+// by the sampling parameters. A repeated run on the same files then
+// skips the analysis. Inputs that aren't in the cache are analyzed
+// concurrently, each on its own thread (-j).
+//
+// With -k, inputs are equalized by their K-weighted, gated integrated
+// loudness (BS.1770) instead of their standard deviation, so that
+// rumble and long silences don't decide the gain. The loudness is
+// measured from the same reads as the statistics. See sndloud.cc.
+//
+// With -I, the statistics of each excerpt come from a sidecar index of
+// block totals kept next to the input (see sndindex.cc), so only the
+// ends of each excerpt are decoded. The index is built on first use,
+// from the whole file, and rebuilt when the file changes. The gains
+// are the same as without it, up to rounding. It isn't used with -k,
+// since loudness can't be pieced together from block totals.
 // 
 
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 
 #include <sndfile.h>
 
+#include "sndlimit.h"
+#include "sndindex.h"
+#include "sndloud.h"
+#include "sndresample.h"
+#include "sndsimd.h"
 #include "sndstats.h"
+#include "sndthread.h"
 
 //////////////////////////////////////////////////////////////////////
 //
@@ -56,6 +129,11 @@ if (!x) {                                                          \
   exit(1);                                                         \
 }
 
+// The most channels libsndfile will write (SF_MAX_CHANNELS in its
+// sources, which isn't exported).
+
+#define MAX_OUT_CHANNELS 1024
+
 
 //////////////////////////////////////////////////////////////////////
 //
@@ -69,18 +147,177 @@ int Verbose = 0;
 int AutoGain = 0;
 float RandomSampleTime = 300.0;	// 5 minutes
 float RandomSampleSize = 2.0;	// 2 seconds
+unsigned long long RandomSeed = 0;
+
+// If set, autogain equalizes loudness rather than standard deviation.
+int LoudGain = 0;
+
+// File holding cached autogain statistics. NULL for no cache.
+char* CacheFile = NULL;
+
+// If set, autogain statistics come from an index next to each input.
+int UseIndex = 0;
+
+// Number of threads used to analyze inputs for autogain. <= 0 means
+// one per CPU.
+int Threads = 0;
 
 // Maximum gain to apply to any channel. <= 0 implies no max.
 float MaxGain = -1.0;
 
-// Buffer size (to hold one block of audio data while processing)
+// Buffer size, in frames (to hold one block of audio data while
+// processing)
 int BlockSize = 8192;
 
+// Optional file giving the gain from each input channel to each
+// output channel.
+char* MatrixFile = NULL;
+
+// If set, decode each input on its own thread and write the output
+// on another, with the mixing done in between. See mix_pipelined().
+int Pipeline = 0;
+
+// Number of blocks each decoder (and the writer) may queue up ahead
+// of the mixer in pipelined mode.
+int QueueDepth = 4;
+
+// Output sample rate. <= 0 means the rate of the first input. Inputs
+// at other rates are resampled with the given quality (RESAMPLE_*).
+int OutRate = 0;
+int ResampleQuality = RESAMPLE_MEDIUM;
+
+// Comma separated lists with one entry per input (missing or empty
+// entries take the default): the start time of each input in the
+// output in seconds, and the 'start:end' excerpt of each input file
+// to use. See read_offsets().
+char* Offsets = NULL;
+char* Trims = NULL;
+
 // Gain to apply to summed signal (after autogain or individual
 // gains). Use a value less than 1.0 if there's clipping in the
 // resulting file.
 float Gain = 1.0;
 
+// Peak limiter applied to the mix. No limiting if the ceiling is <= 0.
+// The look-ahead and release times are in milliseconds.
+float LimitCeiling = 0.0;
+float LimitLookahead = 5.0;
+float LimitRelease = 50.0;
+
+// Number of inputs per group in grouped mode, and the most input
+// files to have open at once (<= 0 for no limit). Either one selects
+// grouped mode. See mix_grouped().
+int GroupSize = 0;
+int MaxOpen = 0;
+
+// Live mode, if LiveLatency > 0. Inputs are raw 16 bit PCM with
+// LiveChannels channels at the output rate, and no more than
+// LiveLatency milliseconds of any input is kept waiting. See
+// mix_live().
+float LiveLatency = 0.0;
+int LiveChannels = 1;
+
+// Manifest for batch mode, and the number of jobs to run at once
+// (<= 0 means one per CPU). See run_batch().
+char* BatchFile = NULL;
+int Workers = 0;
+
+//////////////////////////////////////////////////////////////////////
+//
+// Types
+//
+
+// A piecewise linear gain envelope. See read_envelope().
+
+struct envelope {
+  int     n;			//  Number of points (at least 1)
+  double* frames;		//  Time of each point, in input frames
+  float*  gains;
+};
+
+// One input audio file and how it contributes to the output.
+
+struct mixinput {
+  char*    fname;
+  SNDFILE* sound;
+  SF_INFO  info;
+  float    scale;		//  From the command line or auto_gain()
+  float*   route;		//  route[c*outchannels + o] is the gain from
+				//  input channel c to output channel o
+  float*   readbuf;		//  Interleaved block (multichannel or resampled
+				//  inputs only)
+  resampler* rs;		//  NULL if the input is at the output rate
+  float*   rawplanes;		//  Planar block at the input's own rate
+  int      eof;			//  Set once rs has been given all the input
+  envelope* env;		//  Gain envelope, or NULL for a constant scale
+  long     readpos;		//  Frames read so far (by read_block())
+  long     start;		//  Output frame at which the input starts
+  long     trimstart;		//  First file frame used (at the input's rate)
+  long     trimlen;		//  File frames used, or -1 for all the rest
+  long     rawpos;		//  File frames read since trimstart
+  int      fd;			//  Live mode: the FIFO or pipe, else -1
+};
+
+// One input channel feeding an output channel, with the product of
+// its scale and route gain.
+
+struct mixterm {
+  int   input;
+  int   channel;
+  float coef;
+};
+
+// One autogain result in the cache file. See read_cache().
+
+struct cache_entry {
+  char*     path;		//  Absolute path of the input
+  long long size;		//  Size in bytes
+  long long mtime;		//  Modification time in nanoseconds
+  float     sampletime;		//  RandomSampleTime used for the analysis
+  float     samplesize;		//  RandomSampleSize used for the analysis
+  unsigned long long seed;	//  RandomSeed used for the analysis
+  jstat     stat;
+  int       hasloud;		//  Set if lufs was measured too
+  double    lufs;		//  Integrated loudness
+};
+
+// The terms feeding each output channel, plus scratch space for
+// mix_block().
+
+struct mixplan {
+  int       nout;
+  int       ninputs;
+  int*      nterms;
+  mixterm** terms;
+  const float** ptrs;
+  long*     lens;
+  float*    coefs;
+  float*    outplanes;
+};
+
+// One mix. The options that can differ between the jobs of a batch
+// start out as copies of the globals, and the rest of the job is
+// filled in by open_job().
+
+struct mixjob {
+  int       line;		//  Manifest line (0 outside batch mode)
+  char*     outfn;
+  int       autogain;
+  float     gain;
+  char*     matrixfile;
+  char*     offsets;
+  char*     trims;
+  int       nargs;		//  Input files, each followed by its scale
+  char**    args;		//  unless autogain is set
+
+  int       nfiles;
+  mixinput* inputs;
+  int       outchannels;
+  int       outrate;
+  int       lazyopen;		//  Inputs are only open while being read
+  char      error[1024];	//  Why the job failed
+};
+
 //////////////////////////////////////////////////////////////////////
 //
 // Prototypes
@@ -88,9 +325,43 @@ float Gain = 1.0;
 
 void usage();
 
-void mix(int nfiles, SNDFILE** sounds, float* scales, SNDFILE* out);
-void auto_gain(int nfiles, SNDFILE** sounds, SF_INFO* sfinfo, float* scales);
-float std_snd(SNDFILE* in, SF_INFO* sfinfo);
+void init_job(mixjob* job);
+int  check_job(mixjob* job);
+int  job_error(mixjob* job, const char* fmt, ...);
+SNDFILE* open_sound(const char* fname, int mode, SF_INFO* info, char* why, int size);
+int  run_job(mixjob* job);
+int  open_job(mixjob* job);
+int  start_input(mixjob* job, mixinput* in);
+int  open_live(mixjob* job, mixinput* in);
+int  mix_job(mixjob* job);
+void close_job(mixjob* job);
+int  run_batch(mixjob* defaults);
+int  read_matrix(mixjob* job);
+int  default_routes(mixjob* job);
+int  read_offsets(mixjob* job);
+mixplan* make_plan(mixjob* job);
+void free_plan(mixplan* plan);
+envelope* read_envelope(mixjob* job, const char* fname);
+void free_envelope(envelope* env);
+int  env_constant(const envelope* env, long pos, long n, float* gain);
+void env_apply(const envelope* env, long pos, long n, float* planes, int channels);
+long read_raw(mixinput* in, float* buf, long n);
+long read_block(mixinput* in, float* planes);
+long read_resampled(mixinput* in, float* planes);
+void mix_block(mixplan* plan, const float* const* planes, const float* gains,
+	       const long* lens, long n, float* out);
+void mix(mixjob* job, mixplan* plan, SNDFILE* out);
+int  mix_pipelined(mixjob* job, mixplan* plan, SNDFILE* out);
+int  plan_groups(mixjob* job, int* size, int* perwave);
+int  mix_grouped(mixjob* job, SNDFILE* out, int size, int perwave);
+void mix_live(mixjob* job, mixplan* plan, SNDFILE* out);
+int  auto_gain(mixjob* job, int nfiles, mixinput* inputs);
+int  level_snd(SNDFILE* in, SF_INFO* sfinfo, jstat* stat, loudness* loud,
+	       sndindex* ix = NULL);
+int cache_key(const char* fname, cache_entry* key);
+int read_cache(const char* fname, cache_entry** entries);
+void write_cache(const char* fname, cache_entry* entries, int nentries);
+cache_entry* find_cache(cache_entry* entries, int nentries, const cache_entry* key);
 float my_atof(char*);
 int   my_atoi(char*);
 
@@ -103,23 +374,62 @@ int   my_atoi(char*);
 void usage() {
   fprintf(stderr, "\nUsage: %s -v -m maxgain -o outfile -g gain in1 sc1 in2 sc2 ...  OR\n",
 	  ProgName);
-  fprintf(stderr, "       %s -a -v -m maxgain -o outfile -g gain in1 in2 ...\n",
+  fprintf(stderr, "       %s -a -v -m maxgain -o outfile -g gain in1 in2 ...  OR\n",
+	  ProgName);
+  fprintf(stderr, "       %s -B manifest -J jobs [other options]\n",
 	  ProgName);
   fprintf(stderr, "where\n");
   fprintf(stderr, " -o outfile  Output file [stdout]\n");
   fprintf(stderr, " -g gain     Gain to apply to output file [1.0]\n");
   fprintf(stderr, " -m maxgain  Maximum gain to apply to any input file [-1.0]\n");
   fprintf(stderr, " -a          Compute gain (scales) automatically\n");
+  fprintf(stderr, " -k          With -a, equalize loudness (BS.1770) instead of stddev\n");
+  fprintf(stderr, " -c cache    Read and update autogain statistics in cache file\n");
+  fprintf(stderr, " -I          Keep an index next to each input to speed up -a\n");
+  fprintf(stderr, " -M matrix   Route input channels to output channels (see below)\n");
+  fprintf(stderr, " -r rate     Output sample rate [rate of in1]\n");
+  fprintf(stderr, " -O t1,t2,.. Start time in seconds of each input in the output [0]\n");
+  fprintf(stderr, " -T s1:e1,.. Only use seconds s to e of each input (either may be empty)\n");
+  fprintf(stderr, " -l ceiling  Limit peaks of the mix to +-ceiling (e.g. 0.98) [off]\n");
+  fprintf(stderr, " -p          Decode each input on its own thread (output is identical)\n");
+  fprintf(stderr, " -G size     Mix in groups of size inputs, each on its own thread\n");
+  fprintf(stderr, " -F max      Keep at most max input files open at once, mixing in groups\n");
+  fprintf(stderr, "             if there are more inputs than that\n");
+  fprintf(stderr, " -x msec     Live mode: mix raw 16 bit PCM from FIFOs or pipes, keeping\n");
+  fprintf(stderr, "             at most msec of each input waiting (needs -r)\n");
+  fprintf(stderr, " -C chans    Number of channels of each live input [%d]\n", LiveChannels);
+  fprintf(stderr, " -B manifest Run the mixes listed in manifest (see below)\n");
+  fprintf(stderr, " -J jobs     Number of mixes to run at once with -B [one per CPU]\n");
   fprintf(stderr, " -v          Verbose\n");
   fprintf(stderr, " inN         Input file\n");
-  fprintf(stderr, " scN         Scale for input file (if -a isn't given)\n");
+  fprintf(stderr, " scN         Scale for input file (if -a isn't given), or @file\n");
+  fprintf(stderr, "             for a gain envelope of 'time gain' lines\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "    If maxgain is less than 0.0, then there is no limit to the gain.\n");
+  fprintf(stderr, "\n    Each line of the matrix file is 'input inchan outchan gain', where\n");
+  fprintf(stderr, "    input is the 0-based position of the input on the command line and\n");
+  fprintf(stderr, "    the channels are 0-based. The output gets as many channels as the\n");
+  fprintf(stderr, "    largest outchan. Routes not listed are silent.\n");
+  fprintf(stderr, "\n    Each line of a batch manifest is one mix, given as\n");
+  fprintf(stderr, "      -o outfile [-a] [-g gain] [-M matrix] [-O ...] [-T ...] in1 [sc1] ...\n");
+  fprintf(stderr, "    Other options on the command line apply to every job, and the\n");
+  fprintf(stderr, "    ones on a line override them for that job. -o can only be given\n");
+  fprintf(stderr, "    on the lines, since each job needs its own output file.\n");
   fprintf(stderr, "\n The following arguments are also allowed, but seldom needed:\n\n");
   fprintf(stderr, " -s size     Time in seconds of a single sample used to compute autogain [%f]\n", RandomSampleSize);
   fprintf(stderr, " -t time     Total amount of time in seconds used to compute autogain [%f]\n", RandomSampleTime);
-  fprintf(stderr, " -b size     Number of samples to read at a time [%d]\n",
+  fprintf(stderr, " -A seed     Seed for where the autogain samples are taken [%llu]\n", RandomSeed);
+  fprintf(stderr, " -j threads  Number of inputs to analyze at once for -a [one per CPU,\n");
+  fprintf(stderr, "             or 1 with -B]\n");
+  fprintf(stderr, " -b size     Number of frames to read at a time [%d, or 10 ms with -x]\n",
 	  BlockSize);
+  fprintf(stderr, " -q depth    Number of blocks queued per input with -p [%d]\n",
+	  QueueDepth);
+  fprintf(stderr, " -L msec     Limiter look-ahead [%g]\n", LimitLookahead);
+  fprintf(stderr, " -R msec     Limiter release time [%g]\n", LimitRelease);
+  fprintf(stderr, " -Q quality  Resampling quality (0=fast 1=medium 2=best) [%d]\n",
+	  ResampleQuality);
+  fprintf(stderr, " -S level    Limit vector instructions (0=none 1=sse 2=avx2 3=avx512)\n");
   fprintf(stderr, "\n");
   exit(1);
 }  // usage()
@@ -134,253 +444,2772 @@ int main(int argc, char** argv) {
   extern char *optarg;
   extern int optind;
 
-  int c, i, nargs, nfiles;
-  char *fname;
-
-  float *scales;		// How much to scale the inputs
-  SNDFILE* *sounds;
-  SF_INFO *sfinfos;		// Information about input audio files
+  int c, nfailed;
+  int threadsset = 0;
+  int blockset = 0;
+  mixjob job;
   char* outfn = NULL;
-  SNDFILE* out;
   
   ProgName = argv[0];
 
-  while ((c = getopt(argc, argv, "ab:g:m:o:s:t:v")) != EOF) {
+  while ((c = getopt(argc, argv, "aA:b:B:c:C:F:g:G:Ij:J:kl:L:m:M:o:O:pq:Q:r:R:s:S:t:T:vx:")) != EOF) {
     switch (c) {
     case 'a':
       AutoGain = 1;
       break;
+    case 'A':
+      RandomSeed = strtoull(optarg, NULL, 0);
+      break;
     case 'b':
       BlockSize = my_atof(optarg);
+      blockset = 1;
+      break;
+    case 'B':
+      BatchFile = strdup(optarg);
+      break;
+    case 'c':
+      CacheFile = strdup(optarg);
+      break;
+    case 'C':
+      LiveChannels = my_atoi(optarg);
+      if (LiveChannels < 1) {
+	usage();
+      }
+      break;
+    case 'F':
+      MaxOpen = my_atoi(optarg);
       break;
     case 'g':
       Gain = my_atof(optarg);
       break;
+    case 'G':
+      GroupSize = my_atoi(optarg);
+      break;
+    case 'I':
+      UseIndex = 1;
+      break;
+    case 'j':
+      Threads = my_atoi(optarg);
+      threadsset = 1;
+      break;
+    case 'J':
+      Workers = my_atoi(optarg);
+      break;
+    case 'k':
+      LoudGain = 1;
+      break;
+    case 'l':
+      LimitCeiling = my_atof(optarg);
+      break;
+    case 'L':
+      LimitLookahead = my_atof(optarg);
+      break;
     case 'm':
       MaxGain = my_atof(optarg);
       break;
+    case 'M':
+      MatrixFile = strdup(optarg);
+      break;
     case 'o':
       outfn = strdup(optarg);
       break;
+    case 'O':
+      Offsets = strdup(optarg);
+      break;
+    case 'p':
+      Pipeline = 1;
+      break;
+    case 'q':
+      QueueDepth = my_atoi(optarg);
+      if (QueueDepth < 1) {
+	usage();
+      }
+      break;
+    case 'Q':
+      ResampleQuality = my_atoi(optarg);
+      if (ResampleQuality < RESAMPLE_FAST || ResampleQuality > RESAMPLE_BEST) {
+	usage();
+      }
+      break;
+    case 'r':
+      OutRate = my_atoi(optarg);
+      break;
+    case 'R':
+      LimitRelease = my_atof(optarg);
+      break;
     case 's':
       RandomSampleSize = my_atof(optarg);
       break;
+    case 'S':
+      simd_set_level(my_atoi(optarg));
+      break;
     case 't':
       RandomSampleTime = my_atof(optarg);
       break;
+    case 'T':
+      Trims = strdup(optarg);
+      break;
     case 'v':
       Verbose = 1;
       break;
+    case 'x':
+      LiveLatency = my_atof(optarg);
+      break;
     }
   }
 
-  if (!outfn) {
-    outfn = strdup("-"); // if not provided, stdout.
-  }
+  // Settle the instruction set before any threads need it.
 
-  nargs = argc - optind;
+  (void) simd_level();
 
-  if (nargs < 1) {
-    usage();
+  // Live mode needs to know the input rate up front, and can't do
+  // anything that needs the whole of an input.
+
+  if (LiveLatency > 0.0) {
+    if (OutRate <= 0 || AutoGain || Offsets || Trims || Pipeline || BatchFile
+	|| GroupSize > 0 || MaxOpen > 0) {
+      usage();
+    }
+    if (!blockset) {
+      BlockSize = OutRate / 100;
+    }
   }
 
-  // If autogain is NOT set, then the arguments must be file1 gain1
-  // file2 gain2 ..., and therefore there must be an even number of
-  // arguments. 
+  init_job(&job);
+  job.outfn = outfn;
 
-  if (AutoGain == 0) {
-    if (nargs % 2 != 0) {
+  if (BatchFile) {
+    if (optind != argc) {
       usage();
     }
+    if (job.outfn) {
+      fprintf(stderr, "%s: -o can't be used with -B, since each job needs its own"
+	      " output file\n", ProgName);
+      exit(1);
+    }
+
+    // The jobs already keep the CPUs busy, so unless asked to, each
+    // one analyzes its own inputs one at a time.
 
-    nfiles = nargs / 2;
-  } else if (AutoGain == 1) {
-    nfiles = nargs;
+    if (!threadsset) {
+      Threads = 1;
+    }
+    nfailed = run_batch(&job);
   } else {
-    fprintf(stderr, "This should never happen!\n");
-    exit(-1);
+    if (!job.outfn) {
+      job.outfn = strdup("-"); // if not provided, stdout.
+    }
+    job.nargs = argc - optind;
+    job.args = argv + optind;
+    if (!check_job(&job)) {
+      usage();
+    }
+    nfailed = 0;
+    if (!run_job(&job)) {
+      fprintf(stderr, "%s: %s\n", ProgName, job.error);
+      nfailed = 1;
+    }
+  }
+
+  free(outfn);
+  free(MatrixFile);
+  free(Offsets);
+  free(Trims);
+  free(CacheFile);
+  free(BatchFile);
+    
+  return (nfailed > 0) ? 1 : 0;
+}  // main()
+
+//////////////////////////////////////////////////////////////////////
+//
+// Running one mix.
+//
+
+void init_job(mixjob* job) {
+  job->line = 0;
+  job->outfn = NULL;
+  job->autogain = AutoGain;
+  job->gain = Gain;
+  job->matrixfile = MatrixFile;
+  job->offsets = Offsets;
+  job->trims = Trims;
+  job->nargs = 0;
+  job->args = NULL;
+  job->nfiles = 0;
+  job->inputs = NULL;
+  job->outchannels = 0;
+  job->outrate = 0;
+  job->lazyopen = 0;
+  job->error[0] = '\0';
+}  // init_job()
+
+//
+// If autogain is NOT set, then the arguments must be file1 gain1
+// file2 gain2 ..., and therefore there must be an even number of
+// arguments. Returns 0 if they don't fit.
+//
+
+int check_job(mixjob* job) {
+  if (job->nargs < 1) {
+    return 0;
+  }
+  if (!job->autogain && job->nargs % 2 != 0) {
+    return 0;
+  }
+  return 1;
+}  // check_job()
+
+//
+// Record why a job failed. Always returns 0, so that callers can
+// return job_error(...).
+//
+
+int job_error(mixjob* job, const char* fmt, ...) {
+  va_list ap;
+
+  va_start(ap, fmt);
+  vsnprintf(job->error, sizeof(job->error), fmt, ap);
+  va_end(ap);
+  return 0;
+}  // job_error()
+
+//
+// sf_open(), for the jobs and analysis threads that may be opening
+// files at the same time. libsndfile leaves the reason an open failed
+// in a global for sf_strerror(NULL), so the open and the copy of the
+// reason into why are done under one lock.
+//
+
+static pthread_mutex_t OpenLock = PTHREAD_MUTEX_INITIALIZER;
+
+SNDFILE* open_sound(const char* fname, int mode, SF_INFO* info, char* why, int size) {
+  SNDFILE* sound;
+
+  pthread_mutex_lock(&OpenLock);
+  if ((sound = sf_open(fname, mode, info)) == NULL) {
+    snprintf(why, size, "%s", sf_strerror(NULL));
   }
+  pthread_mutex_unlock(&OpenLock);
+  return sound;
+}  // open_sound()
+
+//
+// Returns 1 on success. On failure, job->error says why, and the
+// partial output file (if any) is left behind.
+//
+
+int run_job(mixjob* job) {
+  int ok;
+
+  ok = open_job(job) && mix_job(job);
+  close_job(job);
+  return ok;
+}  // run_job()
+
+//
+// Open the inputs and work out everything about how they are mixed.
+//
+
+int open_job(mixjob* job) {
+  int i, nfiles;
+  mixinput* inputs;
+  char* sc;
+  char why[256];
 
-  sounds = new SNDFILE*[nfiles];
-  scales = new float[nfiles];
-  sfinfos = new SF_INFO[nfiles];
+  nfiles = job->nfiles = job->autogain ? job->nargs : job->nargs / 2;
+  inputs = job->inputs = new mixinput[nfiles];
+  job->lazyopen = (MaxOpen > 0 && nfiles > MaxOpen);
   
   for (i = 0; i < nfiles; i++) {
-    if (AutoGain == 0) {
-      fname = argv[optind + 2*i];
+    if (job->autogain == 0) {
+      inputs[i].fname = job->args[2*i];
     } else {
-      fname = argv[optind+i];
+      inputs[i].fname = job->args[i];
     }
-    
-    sounds[i] = sf_open(fname, SFM_READ, &(sfinfos[i]));
-    if (sounds[i] == NULL) {
-      fprintf(stderr, "%s: couldn't open '%s' as input sound file: %s\n",
-	      ProgName, fname, sf_strerror(NULL));
-      usage();
+    inputs[i].sound = NULL;
+    inputs[i].route = NULL;
+    inputs[i].readbuf = NULL;
+    inputs[i].rs = NULL;
+    inputs[i].rawplanes = NULL;
+    inputs[i].eof = 0;
+    inputs[i].env = NULL;
+    inputs[i].readpos = 0;
+    inputs[i].start = 0;
+    inputs[i].trimstart = 0;
+    inputs[i].trimlen = -1;
+    inputs[i].rawpos = 0;
+    inputs[i].fd = -1;
+  }
+
+  for (i = 0; i < nfiles; i++) {
+    if (LiveLatency > 0.0) {
+      if (!open_live(job, &inputs[i])) return 0;
+      continue;
+    }
+    inputs[i].sound = open_sound(inputs[i].fname, SFM_READ, &(inputs[i].info),
+				 why, sizeof(why));
+    if (inputs[i].sound == NULL) {
+      return job_error(job, "couldn't open '%s' as input sound file: %s",
+		       inputs[i].fname, why);
+    }
+    if (inputs[i].info.channels > 1) {
+      inputs[i].readbuf = new float[(long) BlockSize * inputs[i].info.channels];
     }
 
-    if (sfinfos[i].channels != 1) {
-      fprintf(stderr, "%s: Currently only one channel per file is supported.\n",
-	      ProgName);
-      exit(1);
+    // Under -F, only the header is needed for now. The file is opened
+    // again when its group is mixed (see start_input()).
+    if (job->lazyopen) {
+      sf_close(inputs[i].sound);
+      inputs[i].sound = NULL;
+    }
+  }
+
+  // Set up resampling for any input that isn't at the output rate
+
+  job->outrate = (OutRate > 0) ? OutRate : inputs[0].info.samplerate;
+  for (i = 0; i < nfiles; i++) {
+    if (inputs[i].info.samplerate == job->outrate) {
+      continue;
+    }
+    inputs[i].rs = new resampler(inputs[i].info.samplerate, job->outrate,
+				 inputs[i].info.channels, ResampleQuality);
+    if (!inputs[i].rs->ok()) {
+      return job_error(job, "can't resample '%s' from %d Hz to %d Hz",
+		       inputs[i].fname, inputs[i].info.samplerate, job->outrate);
     }
+    if (!inputs[i].readbuf) {
+      inputs[i].readbuf = new float[BlockSize];
+    }
+    inputs[i].rawplanes = new float[(long) BlockSize * inputs[i].info.channels];
+    if (Verbose) {
+      fprintf(stderr, "Resampling '%s' from %d Hz to %d Hz\n",
+	      inputs[i].fname, inputs[i].info.samplerate, job->outrate);
+    }
+  }
+
+  // Decide which input channels go to which output channels
+
+  if (job->matrixfile) {
+    if (!read_matrix(job)) return 0;
+  } else {
+    if (!default_routes(job)) return 0;
+  }
+
+  // Work out where each input starts and which part of it to use
+
+  if (!read_offsets(job)) {
+    return 0;
   }
 
   // Now either compute or extract the scale factors
 
-  if (AutoGain == 0) {
+  if (job->autogain == 0) {
     for (i = 0; i < nfiles; i++) {
-      scales[i] = my_atof(argv[optind + 2*i+1]);
+      sc = job->args[2*i+1];
+      if (sc[0] == '@' && LiveLatency > 0.0) {
+	return job_error(job, "gain envelopes can't be used in live mode");
+      } else if (sc[0] == '@') {
+	if ((inputs[i].env = read_envelope(job, sc + 1)) == NULL) {
+	  return 0;
+	}
+	inputs[i].scale = 1.0;
+      } else if (sscanf(sc, "%f", &inputs[i].scale) != 1) {
+	return job_error(job, "bad scale '%s' for '%s'", sc, inputs[i].fname);
+      }
+    }
+  } else if (!auto_gain(job, nfiles, inputs)) {
+    return 0;
+  }
+
+  for (i = 0; i < nfiles; i++) {
+    if (inputs[i].sound && inputs[i].trimstart > 0
+	&& sf_seek(inputs[i].sound, inputs[i].trimstart, SEEK_SET) < 0) {
+      return job_error(job, "couldn't seek to frame %ld of '%s'",
+		       inputs[i].trimstart, inputs[i].fname);
     }
-  } else if (AutoGain == 1) {
-    auto_gain(nfiles, sounds, sfinfos, scales);
   }
+  return 1;
+}  // open_job()
+
+//
+// Open an input that open_job() left closed, and seek to the start of
+// its excerpt. Does nothing if the input is already open.
+//
+
+int start_input(mixjob* job, mixinput* in) {
+  char why[256];
+
+  if (in->sound) {
+    return 1;
+  }
+  in->sound = open_sound(in->fname, SFM_READ, &(in->info), why, sizeof(why));
+  if (in->sound == NULL) {
+    return job_error(job, "couldn't open '%s' as input sound file: %s",
+		     in->fname, why);
+  }
+  if (in->trimstart > 0 && sf_seek(in->sound, in->trimstart, SEEK_SET) < 0) {
+    return job_error(job, "couldn't seek to frame %ld of '%s'",
+		     in->trimstart, in->fname);
+  }
+  return 1;
+}  // start_input()
 
-  // Use sfinfos[0] so that the output will be the same format as the
-  // FIRST input.
+//
+// Live inputs are read directly, without blocking, rather than through
+// libsndfile. "-" is stdin. A FIFO is opened non-blocking, so that the
+// open doesn't wait for a writer. stdin is left as it is, since its
+// flags are shared with the shell and anything else using it, and is
+// only read once poll() says there's something there. See live_read().
+//
+
+int open_live(mixjob* job, mixinput* in) {
+  if (!strcmp(in->fname, "-")) {
+    in->fd = 0;
+  } else {
+    in->fd = open(in->fname, O_RDONLY | O_NONBLOCK);
+  }
+  if (in->fd < 0) {
+    return job_error(job, "couldn't open '%s' for live input: %s",
+		     in->fname, strerror(errno));
+  }
+  memset(&in->info, 0, sizeof(in->info));
+  in->info.channels = LiveChannels;
+  in->info.samplerate = OutRate;
+  in->info.format = SF_FORMAT_RAW | SF_FORMAT_PCM_16;
+  return 1;
+}  // open_live()
+
+int mix_job(mixjob* job) {
+  int i, ok, size, perwave;
+  int grouped = (GroupSize > 0 || job->lazyopen);
+  mixinput* inputs = job->inputs;
+  mixplan* plan;
+  SF_INFO outinfo;
+  SNDFILE* out;
+  char why[256];
 
-  out = sf_open(outfn, SFM_WRITE, &(sfinfos[0]));
+  // Settle the groups first, so that a mix that can't be done within
+  // -F leaves no output file behind.
+
+  if (grouped && !plan_groups(job, &size, &perwave)) {
+    return 0;
+  }
+
+  // Use the first input's info so that the output will be the same
+  // format as the FIRST input.
+
+  outinfo = inputs[0].info;
+  outinfo.channels = job->outchannels;
+  outinfo.samplerate = job->outrate;
+  out = open_sound(job->outfn, SFM_WRITE, &outinfo, why, sizeof(why));
   
   if (!out) {
-    fprintf(stderr, "%s: Couldn't open output file %s: %s\n",
-	    ProgName, outfn, sf_strerror(NULL));
-    exit(1);
+    return job_error(job, "Couldn't open output file %s: %s", job->outfn, why);
   }
   
-  for (i = 0; i < nfiles; i++) {
+  for (i = 0; i < job->nfiles; i++) {
 
     // If MaxGain is set, clip the gains to MaxGain
-    if (MaxGain > 0.0 && scales[i] > MaxGain) {
-      scales[i] = MaxGain;
+    if (MaxGain > 0.0 && inputs[i].scale > MaxGain) {
+      inputs[i].scale = MaxGain;
     }
 
     // Apply output gain (applying it here is the same as applying it
     // to the output file)
-    scales[i] *= Gain;
+    inputs[i].scale *= job->gain;
 
     if (Verbose) {
-      fprintf(stderr, "scale[%d] = %f\n", i, scales[i]);
+      fprintf(stderr, "scale[%d] = %f\n", i, inputs[i].scale);
     }
   }
 
   // Do the work
 
-  mix(nfiles, sounds, scales, out);
-
-  // Clean up and exit
+  if (grouped) {
+    ok = mix_grouped(job, out, size, perwave);
+    sf_close(out);
+    return ok;
+  }
 
-  for (i = 0; i < nfiles; i++) {
-    sf_close(sounds[i]);
+  plan = make_plan(job);
+  ok = 1;
+  if (LiveLatency > 0.0) {
+    mix_live(job, plan, out);
+  } else if (Pipeline) {
+    ok = mix_pipelined(job, plan, out);
+  } else {
+    mix(job, plan, out);
   }
+
   sf_close(out);
-  delete [] sounds;
-  delete [] scales;
-  delete [] sfinfos;
-  free(outfn);
-    
-  return 0;
-}  // main()
+  free_plan(plan);
+  return ok;
+}  // mix_job()
+
+void close_job(mixjob* job) {
+  mixinput* inputs = job->inputs;
+
+  for (int i = 0; i < job->nfiles; i++) {
+    if (inputs[i].sound) {
+      sf_close(inputs[i].sound);
+    }
+    if (inputs[i].fd > 0) {
+      close(inputs[i].fd);
+    }
+    delete [] inputs[i].route;
+    delete [] inputs[i].readbuf;
+    delete [] inputs[i].rawplanes;
+    delete inputs[i].rs;
+    free_envelope(inputs[i].env);
+  }
+  delete [] inputs;
+  job->inputs = NULL;
+  job->nfiles = 0;
+}  // close_job()
 
 //////////////////////////////////////////////////////////////////////
 //
-// Do the work.
+// Batch mode.
+//
+// Each line of the manifest is one job: its own iamix options (only
+// -o, -a, -g, -M, -O and -T) followed by its inputs and scales, just
+// as on the command line. Options given on the command line are the
+// defaults for every job. Blank lines and lines starting with # are
+// ignored. Words are separated by white space.
 //
-// If the files do not have the same sizes, they will be left
-// justified, and the output will be the size of the longest input.
+// The whole manifest is parsed before any job starts. The jobs are
+// then run Workers at a time, and a status line is printed on stdout
+// as each one finishes. A job that fails doesn't stop the others. At
+// the end, the failures are listed again on stderr. Returns the
+// number of failed jobs.
 //
 
-void mix(int nfiles, SNDFILE** sounds, float* scales, SNDFILE* out) {
-  int i, j;
-  long nread;
-  long max_nread;		//  Biggest block read in any input
-  float* buf;
-  float* outbuf;
-  int done = 0;
-  int gotone;			// True if you got ANY data from an input
+struct batch_arg {
+  mixjob* jobs;
+  int*    ok;
+  int     njobs;
+  int     ndone;
+  pthread_mutex_t lock;		//  Serializes the status lines
+};
 
-  buf = new float[BlockSize];
-  outbuf = new float[BlockSize];
-  
-  if (Verbose) {
-    fprintf(stderr, "Starting mix...\n");
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}  // now()
+
+static void batch_job(void* p, int k) {
+  batch_arg* arg = (batch_arg*) p;
+  mixjob* job = &arg->jobs[k];
+  double start = now();
+
+  // Jobs that didn't parse already carry their error.
+  arg->ok[k] = (job->error[0] == '\0') && run_job(job);
+
+  pthread_mutex_lock(&arg->lock);
+  arg->ndone++;
+  if (arg->ok[k]) {
+    printf("[%d/%d] ok     line %d: %s (%.2f s)\n", arg->ndone, arg->njobs,
+	   job->line, job->outfn, now() - start);
+  } else {
+    printf("[%d/%d] FAILED line %d: %s: %s\n", arg->ndone, arg->njobs,
+	   job->line, job->outfn ? job->outfn : "(no output)", job->error);
   }
+  fflush(stdout);
+  pthread_mutex_unlock(&arg->lock);
+}  // batch_job()
 
-  while (!done) {
-    for (j = 0; j < BlockSize; j++) {
-      outbuf[j] = 0.0;
-    }
-    gotone = 0;
-    max_nread = 0;
-    for (i = 0; i < nfiles; i++) {
-      nread = sf_read_float(sounds[i], buf, BlockSize);
-      if (nread > 0) {
-	gotone = 1;
-	for (j = 0; j < nread; j++) {
-	  outbuf[j] += buf[j] * scales[i];
-	}
-	if (nread > max_nread) max_nread = nread;
+//
+// Split line into words in place and fill in the job from them.
+// Returns 0 (with job->error set) if the line doesn't make sense.
+//
+
+static int parse_job(mixjob* job, char* line) {
+  char** words;
+  char** grown;
+  char* p;
+  int nwords = 0, maxwords = 16, i;
+  char opt;
+
+  words = (char**) malloc(maxwords * sizeof(char*));
+  if (words == NULL) {
+    return job_error(job, "out of memory");
+  }
+  for (p = strtok(line, " \t\r\n"); p; p = strtok(NULL, " \t\r\n")) {
+    if (nwords == maxwords) {
+      maxwords *= 2;
+      grown = (char**) realloc(words, maxwords * sizeof(char*));
+      if (grown == NULL) {
+	free(words);
+	return job_error(job, "out of memory");
       }
+      words = grown;
     }
-    if (gotone) {
-      sf_write_float(out, outbuf, max_nread);
-    } else {
-      done = 1;
+    words[nwords++] = p;
+  }
+
+  // Options come first. The first word that isn't one is an input.
+
+  for (i = 0; i < nwords && words[i][0] == '-' && words[i][1] != '\0'
+	 && words[i][2] == '\0'; i++) {
+    opt = words[i][1];
+    if (opt == 'a') {
+      job->autogain = 1;
+      continue;
+    }
+    if (strchr("ogMOT", opt) == NULL) {
+      free(words);
+      return job_error(job, "option -%c can't be used in a manifest", opt);
+    }
+    if (++i == nwords) {
+      free(words);
+      return job_error(job, "option -%c needs a value", opt);
+    }
+    switch (opt) {
+    case 'o':
+      job->outfn = words[i];
+      break;
+    case 'g':
+      if (sscanf(words[i], "%f", &job->gain) != 1) {
+	job_error(job, "bad gain '%s'", words[i]);
+	free(words);
+	return 0;
+      }
+      break;
+    case 'M':
+      job->matrixfile = words[i];
+      break;
+    case 'O':
+      job->offsets = words[i];
+      break;
+    case 'T':
+      job->trims = words[i];
+      break;
     }
   }
-  delete [] buf;
-  delete [] outbuf;
-  
-  if (Verbose) {
-    fprintf(stderr, "Done.\n");
+
+  // The words stay in the manifest's buffer, so only the array of
+  // pointers to them is the job's own.
+
+  job->args = words;
+  job->nargs = nwords - i;
+  memmove(words, words + i, job->nargs * sizeof(char*));
+
+  if (job->outfn == NULL || !strcmp(job->outfn, "-")) {
+    return job_error(job, "each job needs its own output file (-o)");
   }
-}  // mix()
+  if (!check_job(job)) {
+    return job_error(job, job->autogain ? "no inputs"
+		     : "expected pairs of input file and scale");
+  }
+  return 1;
+}  // parse_job()
 
-//////////////////////////////////////////////////////////////////////
-//
-// Given the set of sound files, compute all the scaling factors so
-// that the loudest sound doesn't change, and all the others are
-// equalized.
-//
-// Note: The sounds are all rewound to the start as a side effect.
-//
+int run_batch(mixjob* defaults) {
+  FILE* fp;
+  char line[65536];
+  char** lines = NULL;
+  char* q;
+  int nlines = 0, maxlines = 0, lineno = 0;
+  int i, nfailed;
+  batch_arg arg;
 
-void auto_gain(int nfiles, SNDFILE** sounds, SF_INFO* sfinfos, float* scales) {
-  int i;
-  float minscale;
+  if (!strcmp(BatchFile, "-")) {
+    fp = stdin;
+  } else if ((fp = fopen(BatchFile, "r")) == NULL) {
+    fprintf(stderr, "%s: couldn't open manifest '%s'\n", ProgName, BatchFile);
+    exit(1);
+  }
+
+  arg.jobs = NULL;
+  while (fgets(line, sizeof(line), fp)) {
+    lineno++;
+    for (q = line; *q == ' ' || *q == '\t'; q++)
+      ;
+    if (*q == '#' || *q == '\n' || *q == '\r' || *q == '\0') {
+      continue;
+    }
+    if (nlines == maxlines) {
+      maxlines = maxlines ? 2 * maxlines : 64;
+      lines = (char**) realloc(lines, maxlines * sizeof(char*));
+      arg.jobs = (mixjob*) realloc(arg.jobs, maxlines * sizeof(mixjob));
+      MEMCHECK(lines);
+      MEMCHECK(arg.jobs);
+    }
+    lines[nlines] = strdup(q);
+    MEMCHECK(lines[nlines]);
+    mixjob* job = &arg.jobs[nlines];
+    *job = *defaults;
+    job->line = lineno;
+    (void) parse_job(job, lines[nlines]);
+    nlines++;
+  }
+  if (fp != stdin) {
+    fclose(fp);
+  }
 
   if (Verbose) {
-    fprintf(stderr, "Computing auto-gain...\n");
+    fprintf(stderr, "Running %d jobs from '%s'...\n", nlines, BatchFile);
   }
 
-  scales[0] = 1.0 / std_snd(sounds[0], &(sfinfos[0]));
-  minscale = scales[0];
+  arg.njobs = nlines;
+  arg.ndone = 0;
+  arg.ok = new int[nlines];
+  pthread_mutex_init(&arg.lock, NULL);
+  run_jobs(nlines, Workers, batch_job, &arg);
+  pthread_mutex_destroy(&arg.lock);
 
-  for (i = 1; i < nfiles; i++) {
-    scales[i] = 1.0 / std_snd(sounds[i], &(sfinfos[i]));
-    if (minscale > scales[i]) minscale = scales[i];
+  nfailed = 0;
+  for (i = 0; i < nlines; i++) {
+    if (!arg.ok[i]) nfailed++;
   }
-  for (i = 0; i < nfiles; i++) {
-    scales[i] /= minscale;
-    sf_seek(sounds[i], 0, SEEK_SET);
+  if (nfailed > 0) {
+    fprintf(stderr, "%s: %d of %d jobs failed:\n", ProgName, nfailed, nlines);
+    for (i = 0; i < nlines; i++) {
+      if (!arg.ok[i]) {
+	fprintf(stderr, "  line %d: %s\n", arg.jobs[i].line, arg.jobs[i].error);
+      }
+    }
   }
-}  // auto_gain()
+
+  for (i = 0; i < nlines; i++) {
+    free(arg.jobs[i].args);
+    free(lines[i]);
+  }
+  free(lines);
+  free(arg.jobs);
+  delete [] arg.ok;
+  return nfailed;
+}  // run_batch()
 
 //////////////////////////////////////////////////////////////////////
 //
-// Compute the standard deviation of the given sound.
+// Read a routing matrix. Each line is "input inchan outchan gain",
+// where input is the 0-based position of the input file on the
+// command line. Blank lines and lines starting with # are ignored.
+// Sets the job's outchannels to one more than the largest outchan.
 //
 
-float std_snd(SNDFILE* in, SF_INFO* sfinfo) {
-  jstat stat;  
-  
+struct matrix_entry {
+  int input;
+  int inchan;
+  int outchan;
+  float gain;
+};
+
+int read_matrix(mixjob* job) {
+  const char* fname = job->matrixfile;
+  int nfiles = job->nfiles;
+  mixinput* inputs = job->inputs;
+  int nout;
+  FILE* fp;
+  char line[1024];
+  char* p;
+  int i, n, lineno;
+  int nentries = 0;
+  int maxentries = 64;
+  matrix_entry* entries;
+  matrix_entry* grown;
+  matrix_entry e;
+
+  if ((fp = fopen(fname, "r")) == NULL) {
+    return job_error(job, "couldn't open matrix file '%s'", fname);
+  }
+
+  entries = (matrix_entry*) malloc(maxentries * sizeof(matrix_entry));
+  if (entries == NULL) {
+    fclose(fp);
+    return job_error(job, "out of memory reading matrix file '%s'", fname);
+  }
+  nout = 0;
+  lineno = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    lineno++;
+    for (p = line; *p == ' ' || *p == '\t'; p++)
+      ;
+    if (*p == '#' || *p == '\n' || *p == '\0') {
+      continue;
+    }
+    if (sscanf(p, "%d %d %d %f", &e.input, &e.inchan, &e.outchan, &e.gain) != 4) {
+      fclose(fp);
+      free(entries);
+      return job_error(job, "%s line %d: expected 'input inchan outchan gain'",
+		       fname, lineno);
+    }
+    if (e.input < 0 || e.input >= nfiles
+	|| e.inchan < 0 || e.inchan >= inputs[e.input].info.channels
+	|| e.outchan < 0) {
+      fclose(fp);
+      free(entries);
+      return job_error(job, "%s line %d: no such input or channel", fname, lineno);
+    }
+    if (e.outchan >= MAX_OUT_CHANNELS) {
+      fclose(fp);
+      free(entries);
+      return job_error(job, "%s line %d: output channel %d is too high (at most %d)",
+		       fname, lineno, e.outchan, MAX_OUT_CHANNELS - 1);
+    }
+    if (nentries == maxentries) {
+      maxentries *= 2;
+      grown = (matrix_entry*) realloc(entries, maxentries * sizeof(matrix_entry));
+      if (grown == NULL) {
+	fclose(fp);
+	free(entries);
+	return job_error(job, "out of memory reading matrix file '%s'", fname);
+      }
+      entries = grown;
+    }
+    entries[nentries++] = e;
+    if (e.outchan >= nout) nout = e.outchan + 1;
+  }
+  fclose(fp);
+
+  if (nout == 0) {
+    free(entries);
+    return job_error(job, "matrix file '%s' has no routes", fname);
+  }
+
+  job->outchannels = nout;
+  for (i = 0; i < nfiles; i++) {
+    n = inputs[i].info.channels * nout;
+    inputs[i].route = new float[n];
+    memset(inputs[i].route, 0, n * sizeof(float));
+  }
+  for (i = 0; i < nentries; i++) {
+    e = entries[i];
+    inputs[e.input].route[e.inchan * nout + e.outchan] = e.gain;
+  }
+  free(entries);
+  return 1;
+}  // read_matrix()
+
+//
+// Without a matrix, the output looks like the first input. Inputs
+// with the same number of channels map straight across, and mono
+// inputs go to every output channel.
+//
+
+int default_routes(mixjob* job) {
+  mixinput* inputs = job->inputs;
+  int i, c, o, nchan, nout;
+
+  nout = job->outchannels = inputs[0].info.channels;
+  for (i = 0; i < job->nfiles; i++) {
+    nchan = inputs[i].info.channels;
+    if (nchan != 1 && nchan != nout) {
+      return job_error(job, "'%s' has %d channels but the output has %d. Use -M to route them.",
+		       inputs[i].fname, nchan, nout);
+    }
+    inputs[i].route = new float[nchan * nout];
+    for (c = 0; c < nchan; c++) {
+      for (o = 0; o < nout; o++) {
+	inputs[i].route[c * nout + o] = (nchan == 1 || c == o) ? 1.0 : 0.0;
+      }
+    }
+  }
+  return 1;
+}  // default_routes()
+
+//
+// Parse -O and -T. Offsets are converted to output frames, and trims
+// to frames of the input file.
+//
+
+static const char* next_field(const char* p, char* field, int size) {
+  int n = 0;
+
+  while (*p && *p != ',') {
+    if (n < size - 1) field[n++] = *p;
+    p++;
+  }
+  field[n] = '\0';
+  return (*p == ',') ? p + 1 : NULL;
+}  // next_field()
+
+int read_offsets(mixjob* job) {
+  int nfiles = job->nfiles;
+  mixinput* inputs = job->inputs;
+  const char* p;
+  char field[256];
+  char* colon;
+  double t, end;
+  int i, rate;
+
+  p = job->offsets;
+  for (i = 0; p && i < nfiles; i++) {
+    p = next_field(p, field, sizeof(field));
+    if (field[0] == '\0') {
+      continue;
+    }
+    if (sscanf(field, "%lf", &t) != 1 || t < 0.0) {
+      return job_error(job, "bad offset '%s' for input %d", field, i);
+    }
+    inputs[i].start = lround(t * job->outrate);
+  }
+  if (p) {
+    return job_error(job, "more offsets than inputs");
+  }
+
+  p = job->trims;
+  for (i = 0; p && i < nfiles; i++) {
+    p = next_field(p, field, sizeof(field));
+    if (field[0] == '\0') {
+      continue;
+    }
+    rate = inputs[i].info.samplerate;
+    t = 0.0;
+    end = -1.0;
+    colon = strchr(field, ':');
+    if (colon == NULL
+	|| (colon != field && sscanf(field, "%lf", &t) != 1)
+	|| (colon[1] != '\0' && sscanf(colon + 1, "%lf", &end) != 1)
+	|| t < 0.0 || (colon[1] != '\0' && end < t)) {
+      return job_error(job, "bad trim '%s' for input %d (expected start:end)", field, i);
+    }
+    inputs[i].trimstart = lround(t * rate);
+    if (end >= 0.0) {
+      inputs[i].trimlen = lround(end * rate) - inputs[i].trimstart;
+    }
+  }
+  if (p) {
+    return job_error(job, "more trims than inputs");
+  }
+
+  if (Verbose) {
+    for (i = 0; i < nfiles; i++) {
+      if (inputs[i].start > 0 || inputs[i].trimstart > 0 || inputs[i].trimlen >= 0) {
+	fprintf(stderr, "input %d: starts at output frame %ld, file frames %ld to ",
+		i, inputs[i].start, inputs[i].trimstart);
+	if (inputs[i].trimlen < 0) {
+	  fprintf(stderr, "end\n");
+	} else {
+	  fprintf(stderr, "%ld\n", inputs[i].trimstart + inputs[i].trimlen);
+	}
+      }
+    }
+  }
+  return 1;
+}  // read_offsets()
+
+//
+// Collect the non-zero routes into a list of terms per output
+// channel. Terms stay in input order, so a mono mix sums exactly as
+// it always has.
+//
+
+mixplan* make_plan(mixjob* job) {
+  mixplan* plan = new mixplan;
+  int nfiles = job->nfiles;
+  mixinput* inputs = job->inputs;
+  int nout = job->outchannels;
+  int i, c, o, maxterms = 0;
+  float gain;
+
+  plan->nout = nout;
+  plan->ninputs = nfiles;
+  plan->nterms = new int[nout];
+  plan->terms = new mixterm*[nout];
+  for (i = 0; i < nfiles; i++) {
+    maxterms += inputs[i].info.channels;
+  }
+  for (o = 0; o < nout; o++) {
+    plan->nterms[o] = 0;
+    plan->terms[o] = new mixterm[maxterms];
+    for (i = 0; i < nfiles; i++) {
+      for (c = 0; c < inputs[i].info.channels; c++) {
+	gain = inputs[i].route[c * nout + o];
+	if (gain != 0.0) {
+	  mixterm& t = plan->terms[o][plan->nterms[o]++];
+	  t.input = i;
+	  t.channel = c;
+	  t.coef = inputs[i].scale * gain;
+	  if (Verbose && (inputs[i].info.channels > 1 || nout > 1)) {
+	    fprintf(stderr, "input %d channel %d -> output channel %d * %f\n",
+		    i, c, o, t.coef);
+	  }
+	}
+      }
+    }
+  }
+  plan->ptrs = new const float*[maxterms];
+  plan->lens = new long[maxterms];
+  plan->coefs = new float[maxterms];
+  plan->outplanes = (nout > 1) ? new float[(long) nout * BlockSize] : NULL;
+  return plan;
+}  // make_plan()
+
+void free_plan(mixplan* plan) {
+  for (int o = 0; o < plan->nout; o++) {
+    delete [] plan->terms[o];
+  }
+  delete [] plan->nterms;
+  delete [] plan->terms;
+  delete [] plan->ptrs;
+  delete [] plan->lens;
+  delete [] plan->coefs;
+  delete [] plan->outplanes;
+  delete plan;
+}  // free_plan()
+
+//////////////////////////////////////////////////////////////////////
+//
+// Gain envelopes.
+//
+// The envelope file has one "time gain" pair per line, with times in
+// seconds and in increasing order. Blank lines and lines starting
+// with # are ignored.
+//
+
+envelope* read_envelope(mixjob* job, const char* fname) {
+  FILE* fp;
+  char line[1024];
+  char* p;
+  int max = 64, lineno = 0;
+  double t;
+  float g;
+  envelope* env;
+  double* frames;
+  float* gains;
+
+  if ((fp = fopen(fname, "r")) == NULL) {
+    job_error(job, "couldn't open envelope file '%s'", fname);
+    return NULL;
+  }
+  env = new envelope;
+  env->n = 0;
+  env->frames = (double*) malloc(max * sizeof(double));
+  env->gains = (float*) malloc(max * sizeof(float));
+  if (env->frames == NULL || env->gains == NULL) {
+    job_error(job, "out of memory reading envelope file '%s'", fname);
+  }
+
+  while (job->error[0] == '\0' && fgets(line, sizeof(line), fp)) {
+    lineno++;
+    for (p = line; *p == ' ' || *p == '\t'; p++)
+      ;
+    if (*p == '#' || *p == '\n' || *p == '\0') {
+      continue;
+    }
+    if (sscanf(p, "%lf %f", &t, &g) != 2) {
+      job_error(job, "%s line %d: expected 'time gain'", fname, lineno);
+      break;
+    }
+    t *= job->outrate;
+    if (env->n > 0 && t < env->frames[env->n - 1]) {
+      job_error(job, "%s line %d: times must be increasing", fname, lineno);
+      break;
+    }
+    if (env->n == max) {
+      max *= 2;
+      if ((frames = (double*) realloc(env->frames, max * sizeof(double))) != NULL) {
+	env->frames = frames;
+      }
+      if ((gains = (float*) realloc(env->gains, max * sizeof(float))) != NULL) {
+	env->gains = gains;
+      }
+      if (frames == NULL || gains == NULL) {
+	job_error(job, "out of memory reading envelope file '%s'", fname);
+	break;
+      }
+    }
+    env->frames[env->n] = t;
+    env->gains[env->n++] = g;
+  }
+  fclose(fp);
+
+  if (job->error[0] == '\0' && env->n == 0) {
+    job_error(job, "envelope file '%s' is empty", fname);
+  }
+  if (job->error[0] != '\0') {
+    free_envelope(env);
+    return NULL;
+  }
+  return env;
+}  // read_envelope()
+
+void free_envelope(envelope* env) {
+  if (env) {
+    free(env->frames);
+    free(env->gains);
+    delete env;
+  }
+}  // free_envelope()
+
+//
+// Index of the last point at or before frame pos, or -1 if pos is
+// before the first point.
+//
+
+static int env_segment(const envelope* env, double pos) {
+  int lo = 0, hi = env->n - 1, mid;
+
+  if (pos < env->frames[0]) {
+    return -1;
+  }
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if (env->frames[mid] <= pos) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return lo;
+}  // env_segment()
+
+//
+// If the gain is the same for every frame in [pos, pos+n), set *gain
+// and return 1. Otherwise return 0.
+//
+
+int env_constant(const envelope* env, long pos, long n, float* gain) {
+  int first = env_segment(env, pos);
+  int last = env_segment(env, pos + n - 1);
+  int k;
+
+  // Every point from the start of the segment holding the first frame
+  // to the end of the segment holding the last frame must carry the
+  // same gain.
+
+  k = (first < 0) ? 0 : first;
+  *gain = env->gains[k];
+  for (; k <= last + 1 && k < env->n; k++) {
+    if (env->gains[k] != *gain) {
+      return 0;
+    }
+  }
+  return 1;
+}  // env_constant()
+
+//
+// Multiply n frames of planar data (BlockSize stride) starting at
+// frame pos by the envelope.
+//
+
+void env_apply(const envelope* env, long pos, long n, float* planes, int channels) {
+  float* g = new float[n];
+  long j;
+  int k = env_segment(env, pos);
+  double f;
+  int c;
+
+  for (j = 0; j < n; j++) {
+    f = pos + j;
+    while (k + 1 < env->n && env->frames[k + 1] <= f) {
+      k++;
+    }
+    if (k < 0) {
+      g[j] = env->gains[0];
+    } else if (k == env->n - 1) {
+      g[j] = env->gains[k];
+    } else {
+      g[j] = env->gains[k] + (env->gains[k+1] - env->gains[k])
+	* (f - env->frames[k]) / (env->frames[k+1] - env->frames[k]);
+    }
+  }
+  for (c = 0; c < channels; c++) {
+    float* plane = planes + (long) c * BlockSize;
+    for (j = 0; j < n; j++) {
+      plane[j] *= g[j];
+    }
+  }
+  delete [] g;
+}  // env_apply()
+
+//////////////////////////////////////////////////////////////////////
+//
+// Read up to n interleaved frames from the input file, stopping at
+// the end of its -T excerpt.
+//
+
+long read_raw(mixinput* in, float* buf, long n) {
+  long nread;
+
+  if (in->trimlen >= 0 && n > in->trimlen - in->rawpos) {
+    n = in->trimlen - in->rawpos;
+  }
+  if (n <= 0) {
+    return 0;
+  }
+  nread = sf_readf_float(in->sound, buf, n);
+  if (nread > 0) {
+    in->rawpos += nread;
+  }
+  return nread;
+}  // read_raw()
+
+//
+// Read the next block from an input into planar buffers, one
+// BlockSize plane per input channel, followed by one more float
+// holding the gain the mixer should apply to the block (see
+// BLOCK_GAIN). Returns the number of frames read, counted at the
+// output rate.
+//
+// If the input has an envelope that changes within the block, the
+// envelope is applied here (on the decoder thread in pipelined mode)
+// and the block gain is 1. Otherwise the constant envelope gain
+// travels with the block, and mix_block() folds it into the input's
+// scale.
+//
+
+#define BLOCK_GAIN(planes, channels) ((planes)[(long) BlockSize * (channels)])
+
+long read_block(mixinput* in, float* planes) {
+  long nread;
+  float gain = 1.0;
+
+  if (in->rs) {
+    nread = read_resampled(in, planes);
+  } else if (in->info.channels == 1) {
+    nread = read_raw(in, planes, BlockSize);
+  } else {
+    nread = read_raw(in, in->readbuf, BlockSize);
+    if (nread > 0) {
+      deinterleave(in->readbuf, nread, in->info.channels, planes, BlockSize);
+    }
+  }
+  if (nread > 0) {
+    if (in->env && !env_constant(in->env, in->readpos, nread, &gain)) {
+      env_apply(in->env, in->readpos, nread, planes, in->info.channels);
+      gain = 1.0;
+    }
+    in->readpos += nread;
+  }
+  BLOCK_GAIN(planes, in->info.channels) = gain;
+  return nread;
+}  // read_block()
+
+//
+// Fill planes with up to BlockSize resampled frames, reading from the
+// file as often as the resampler needs. Returns fewer than BlockSize
+// frames only at the end of the input.
+//
+
+long read_resampled(mixinput* in, float* planes) {
+  long got = 0, nread;
+
+  for (;;) {
+    got += in->rs->read(planes + got, BlockSize, BlockSize - got);
+    if (got == BlockSize || in->eof) {
+      break;
+    }
+    nread = read_raw(in, in->readbuf, BlockSize);
+    if (nread > 0) {
+      deinterleave(in->readbuf, nread, in->info.channels, in->rawplanes, BlockSize);
+      in->rs->write(in->rawplanes, BlockSize, nread);
+    } else {
+      in->rs->finish();
+      in->eof = 1;
+    }
+  }
+  return got;
+}  // read_resampled()
+
+//
+// Mix n frames. planes[i] is the planar data of input i (channel c
+// at planes[i] + c*BlockSize), gains[i] its block gain, and lens[i]
+// is n if the input is active and 0 if not. out receives n
+// interleaved output frames.
+//
+
+void mix_block(mixplan* plan, const float* const* planes, const float* gains,
+	       const long* lens, long n, float* out) {
+  int o, k, nk;
+  float* dest;
+
+  for (o = 0; o < plan->nout; o++) {
+    nk = 0;
+    for (k = 0; k < plan->nterms[o]; k++) {
+      const mixterm& t = plan->terms[o][k];
+      if (lens[t.input] > 0) {
+	plan->ptrs[nk] = planes[t.input] + (long) t.channel * BlockSize;
+	plan->lens[nk] = lens[t.input];
+	plan->coefs[nk++] = t.coef * gains[t.input];
+      }
+    }
+    dest = (plan->nout == 1) ? out : plan->outplanes + (long) o * BlockSize;
+    mix_accumulate(dest, n, nk, plan->ptrs, plan->lens, plan->coefs);
+  }
+  if (plan->nout > 1) {
+    interleave(plan->outplanes, BlockSize, n, plan->nout, out);
+  }
+}  // mix_block()
+
+//////////////////////////////////////////////////////////////////////
+//
+// Do the work.
+//
+// Each input delivers a stream of blocks, either read on the spot
+// (mix()) or taken from its decoder thread's queue (mix_pipelined()).
+// The output is built from segments during which the set of active
+// inputs doesn't change: a segment ends wherever an input's current
+// block runs out or a waiting input reaches its start. Inputs that
+// haven't started or have ended simply aren't part of the sum, and a
+// segment with no active input at all is silence. Segments are
+// gathered into whole output blocks before being written.
+//
+// Since every output frame is summed in the same order whatever the
+// segment boundaries, both modes produce identical output.
+//
+// The output is as long as the input that ends last.
+//
+
+enum {
+  CURSOR_WAITING,		//  Before the input's start
+  CURSOR_ACTIVE,
+  CURSOR_ENDED
+};
+
+struct mixcursor {
+  float* block;			//  Current block of the input, or NULL
+  long   len;			//  Frames in it
+  long   used;			//  Frames of it already mixed
+  int    state;
+};
+
+// Where blocks come from and where the output goes. queues and
+// outqueue are NULL in serial mode.
+
+struct mixfeed {
+  mixinput* inputs;
+  float**   bufs;		//  Serial mode: one block per input
+  sndqueue** queues;		//  Pipelined mode: one queue per input
+  SNDFILE*  out;
+  float*    outbuf;		//  Serial mode: the output block
+  sndqueue* outqueue;		//  Pipelined mode: output to the writer
+  float*    cur;		//  Block from the last feed_claim()
+  limiter*  limit;		//  NULL if not limiting
+  int       nout;
+};
+
+static float* feed_fetch(mixfeed* feed, int i, long* len) {
+  if (feed->queues) {
+    return feed->queues[i]->front(len);
+  }
+  *len = read_block(&feed->inputs[i], feed->bufs[i]);
+  return feed->bufs[i];
+}  // feed_fetch()
+
+static void feed_release(mixfeed* feed, int i) {
+  if (feed->queues) {
+    feed->queues[i]->pop();
+  }
+}  // feed_release()
+
+// Claiming again without an emit in between returns the same block.
+
+static float* feed_claim(mixfeed* feed) {
+  feed->cur = feed->outqueue ? feed->outqueue->claim() : feed->outbuf;
+  return feed->cur;
+}  // feed_claim()
+
+static void feed_put(mixfeed* feed, long n) {
+  if (feed->outqueue) {
+    feed->outqueue->push(n * feed->nout);
+  } else {
+    sf_writef_float(feed->out, feed->outbuf, n);
+  }
+}  // feed_put()
+
+// Write n frames from the block returned by feed_claim(), through
+// the limiter if there is one. The limiter may hold them back, in
+// which case the block is simply reused.
+
+static void feed_emit(mixfeed* feed, long n) {
+  if (feed->limit) {
+    n = feed->limit->process(feed->cur, n);
+  }
+  if (n > 0) {
+    feed_put(feed, n);
+  }
+}  // feed_emit()
+
+// Drain the limiter and mark the end of the output.
+
+static void feed_finish(mixfeed* feed) {
+  long n;
+
+  feed_claim(feed);
+  if (feed->limit) {
+    while ((n = feed->limit->flush(feed->cur, BlockSize)) > 0) {
+      feed_put(feed, n);
+      feed_claim(feed);
+    }
+    if (Verbose && feed->limit->reduced() > 0) {
+      fprintf(stderr, "Limiter reduced the gain of %lld frames, by as much as %.1f dB\n",
+	      feed->limit->reduced(), -20.0 * log10(feed->limit->mingain()));
+    } else if (Verbose) {
+      fprintf(stderr, "Limiter never reduced the gain\n");
+    }
+  }
+  if (feed->outqueue) {
+    feed->outqueue->push(0);
+  }
+}  // feed_finish()
+
+static limiter* make_limiter(mixjob* job) {
+  if (LimitCeiling <= 0.0) {
+    return NULL;
+  }
+  return new limiter(job->outchannels, lround(LimitLookahead * job->outrate / 1000.0),
+		     LimitCeiling, LimitRelease * job->outrate / 1000.0);
+}  // make_limiter()
+
+static void mix_loop(int nfiles, mixplan* plan, mixfeed* feed) {
+  mixinput* inputs = feed->inputs;
+  mixcursor* cur;
+  const float** planes;		//  Current segment of each input
+  float* gains;
+  long* lens;			//  Frames in it (0 if the input isn't active)
+  float* outbuf;
+  long outpos = 0;		//  Output frames so far
+  long filled = 0;		//  Frames in outbuf
+  long n;
+  int i, live;
+
+  cur = new mixcursor[nfiles];
+  planes = new const float*[nfiles];
+  gains = new float[nfiles];
+  lens = new long[nfiles];
+  for (i = 0; i < nfiles; i++) {
+    cur[i].block = NULL;
+    cur[i].len = 0;
+    cur[i].used = 0;
+    cur[i].state = (inputs[i].start > 0) ? CURSOR_WAITING : CURSOR_ACTIVE;
+  }
+
+  outbuf = feed_claim(feed);
+  for (;;) {
+
+    // Find the length of the next segment, fetching new blocks where
+    // the old ones have been used up.
+
+    live = 0;
+    n = BlockSize - filled;
+    for (i = 0; i < nfiles; i++) {
+      mixcursor* c = &cur[i];
+      if (c->state == CURSOR_WAITING && inputs[i].start <= outpos) {
+	c->state = CURSOR_ACTIVE;
+      }
+      if (c->state == CURSOR_ACTIVE && c->used == c->len) {
+	if (c->block) {
+	  feed_release(feed, i);
+	}
+	c->block = feed_fetch(feed, i, &c->len);
+	c->used = 0;
+	if (c->len <= 0) {
+	  feed_release(feed, i);
+	  c->block = NULL;
+	  c->state = CURSOR_ENDED;
+	}
+      }
+      if (c->state == CURSOR_ACTIVE) {
+	live = 1;
+	if (c->len - c->used < n) n = c->len - c->used;
+      } else if (c->state == CURSOR_WAITING) {
+	live = 1;
+	if (inputs[i].start - outpos < n) n = inputs[i].start - outpos;
+      }
+    }
+    if (!live) {
+      break;
+    }
+
+    for (i = 0; i < nfiles; i++) {
+      if (cur[i].state == CURSOR_ACTIVE) {
+	planes[i] = cur[i].block + cur[i].used;
+	gains[i] = BLOCK_GAIN(cur[i].block, inputs[i].info.channels);
+	lens[i] = n;
+	cur[i].used += n;
+      } else {
+	lens[i] = 0;
+      }
+    }
+    mix_block(plan, planes, gains, lens, n, outbuf + filled * plan->nout);
+    outpos += n;
+    filled += n;
+    if (filled == BlockSize) {
+      feed_emit(feed, filled);
+      outbuf = feed_claim(feed);
+      filled = 0;
+    }
+  }
+  if (filled > 0) {
+    feed_emit(feed, filled);
+  }
+  feed_finish(feed);
+
+  delete [] cur;
+  delete [] planes;
+  delete [] gains;
+  delete [] lens;
+}  // mix_loop()
+
+void mix(mixjob* job, mixplan* plan, SNDFILE* out) {
+  int nfiles = job->nfiles;
+  mixinput* inputs = job->inputs;
+  mixfeed feed;
+  int i;
+
+  feed.inputs = inputs;
+  feed.bufs = new float*[nfiles];
+  feed.queues = NULL;
+  feed.out = out;
+  feed.outbuf = new float[(long) BlockSize * plan->nout];
+  feed.outqueue = NULL;
+  feed.limit = make_limiter(job);
+  feed.nout = plan->nout;
+  for (i = 0; i < nfiles; i++) {
+    feed.bufs[i] = new float[(long) BlockSize * inputs[i].info.channels + 1];
+  }
+  
+  if (Verbose) {
+    fprintf(stderr, "Starting mix (%s)...\n", simd_name(simd_level()));
+  }
+
+  mix_loop(nfiles, plan, &feed);
+
+  for (i = 0; i < nfiles; i++) {
+    delete [] feed.bufs[i];
+  }
+  delete [] feed.bufs;
+  delete [] feed.outbuf;
+  delete feed.limit;
+  
+  if (Verbose) {
+    fprintf(stderr, "Done.\n");
+  }
+}  // mix()
+
+//////////////////////////////////////////////////////////////////////
+//
+// Same as mix(), but with each input decoded by its own thread into a
+// sndqueue, and a separate thread owning the output file. The main
+// thread only sums blocks, with the same mix_loop() as mix(), so the
+// output is bit-identical.
+//
+
+struct decode_arg {
+  mixinput* input;
+  sndqueue* queue;
+};
+
+static void* decode_thread(void* p) {
+  decode_arg* arg = (decode_arg*) p;
+  float* buf;
+  long nread;
+
+  do {
+    buf = arg->queue->claim();
+    nread = read_block(arg->input, buf);
+    arg->queue->push(nread);
+  } while (nread > 0);
+  return 0;
+}  // decode_thread()
+
+struct write_arg {
+  SNDFILE* out;
+  sndqueue* queue;
+  int channels;
+};
+
+static void* write_thread(void* p) {
+  write_arg* arg = (write_arg*) p;
+  float* buf;
+  long n;
+
+  for (;;) {
+    buf = arg->queue->front(&n);
+    if (n <= 0) {
+      break;
+    }
+    sf_writef_float(arg->out, buf, n / arg->channels);
+    arg->queue->pop();
+  }
+  arg->queue->pop();
+  return 0;
+}  // write_thread()
+
+//
+// Let the first n threads feeding queues (decoders here, or the group
+// threads of run_wave()) run to the end, throwing their blocks away,
+// and wait for them. For when the mix can't go ahead after all.
+//
+
+static void stop_threads(int n, sndqueue** queues, pthread_t* threads) {
+  int i;
+  long count;
+
+  for (i = 0; i < n; i++) {
+    do {
+      queues[i]->front(&count);
+      queues[i]->pop();
+    } while (count > 0);
+    pthread_join(threads[i], NULL);
+  }
+}  // stop_threads()
+
+//
+// Returns 0 (with job->error set) if the threads can't be started.
+//
+
+int mix_pipelined(mixjob* job, mixplan* plan, SNDFILE* out) {
+  int nfiles = job->nfiles;
+  mixinput* inputs = job->inputs;
+  int i;
+  mixfeed feed;
+  decode_arg* dargs;
+  pthread_t* decoders;
+  write_arg warg;
+  pthread_t writer;
+  int nstarted = 0, ok = 1;
+
+  feed.inputs = inputs;
+  feed.bufs = NULL;
+  feed.queues = new sndqueue*[nfiles];
+  feed.out = out;
+  feed.outbuf = NULL;
+  feed.limit = make_limiter(job);
+  feed.nout = plan->nout;
+  dargs = new decode_arg[nfiles];
+  decoders = new pthread_t[nfiles];
+
+  if (Verbose) {
+    fprintf(stderr, "Starting pipelined mix with %d decoder threads (%s)...\n",
+	    nfiles, simd_name(simd_level()));
+  }
+
+  // One extra float per slot for the block gain
+
+  for (i = 0; i < nfiles; i++) {
+    feed.queues[i] = new sndqueue(QueueDepth, (long) BlockSize * inputs[i].info.channels + 1);
+    dargs[i].input = &inputs[i];
+    dargs[i].queue = feed.queues[i];
+    if (pthread_create(&decoders[i], NULL, decode_thread, &dargs[i]) != 0) {
+      delete feed.queues[i];
+      stop_threads(nstarted, feed.queues, decoders);
+      ok = job_error(job, "couldn't start decoder thread %d", i);
+      break;
+    }
+    nstarted++;
+  }
+
+  feed.outqueue = NULL;
+  if (ok) {
+    feed.outqueue = new sndqueue(QueueDepth, (long) BlockSize * plan->nout);
+    warg.out = out;
+    warg.queue = feed.outqueue;
+    warg.channels = plan->nout;
+    if (pthread_create(&writer, NULL, write_thread, &warg) != 0) {
+      stop_threads(nfiles, feed.queues, decoders);
+      ok = job_error(job, "couldn't start writer thread");
+    }
+  }
+
+  if (ok) {
+    mix_loop(nfiles, plan, &feed);
+    for (i = 0; i < nfiles; i++) {
+      pthread_join(decoders[i], NULL);
+    }
+    pthread_join(writer, NULL);
+  }
+
+  for (i = 0; i < nstarted; i++) {
+    delete feed.queues[i];
+  }
+  delete feed.outqueue;
+  delete feed.limit;
+  delete [] feed.queues;
+  delete [] dargs;
+  delete [] decoders;
+
+  if (Verbose && ok) {
+    fprintf(stderr, "Done.\n");
+  }
+  return ok;
+}  // mix_pipelined()
+
+//////////////////////////////////////////////////////////////////////
+//
+// Grouped mixing, for mixes with very many inputs.
+//
+// The inputs are split into groups of GroupSize, in order. Each group
+// is mixed by its own thread, with the same mix_loop() as mix(), into
+// a queue of output blocks. The main thread adds the groups' blocks
+// together as a binary tree (see reduce_blocks()) and writes the sum.
+// Only a block per input and a few blocks per group are held at once.
+//
+// The order of every addition depends only on the inputs and the
+// group size, never on thread timing, so the output is reproducible.
+// It isn't bit-identical to a flat mix, which sums left to right.
+//
+// With more inputs than MaxOpen, the groups are run in waves of a
+// power of two groups, and each input file is only open while its
+// group runs. A wave then covers exactly one subtree of the reduction.
+// Its sum is written to a temporary file, and the waves' sums are
+// reduced in turn, giving the same output as a single wave would.
+// The temporary files stay open until the end, so they count against
+// MaxOpen along with the wave's inputs and the output file.
+//
+
+#define DEFAULT_GROUP_SIZE 32
+
+struct group_arg {
+  mixjob    sub;		//  The group's inputs, as a job of their own
+  mixplan*  plan;
+  sndqueue* queue;		//  Blocks of the group's sum
+  int       ok;
+};
+
+static void* group_thread(void* p) {
+  group_arg* arg = (group_arg*) p;
+  mixjob* sub = &arg->sub;
+  mixinput* inputs = sub->inputs;
+  int i;
+  mixfeed feed;
+
+  arg->ok = 1;
+  for (i = 0; i < sub->nfiles && arg->ok; i++) {
+    arg->ok = start_input(sub, &inputs[i]);
+  }
+
+  if (arg->ok) {
+    feed.inputs = inputs;
+    feed.bufs = new float*[sub->nfiles];
+    feed.queues = NULL;
+    feed.out = NULL;
+    feed.outbuf = NULL;
+    feed.outqueue = arg->queue;
+    feed.limit = NULL;
+    feed.nout = sub->outchannels;
+    for (i = 0; i < sub->nfiles; i++) {
+      feed.bufs[i] = new float[(long) BlockSize * inputs[i].info.channels + 1];
+    }
+    mix_loop(sub->nfiles, arg->plan, &feed);
+    for (i = 0; i < sub->nfiles; i++) {
+      delete [] feed.bufs[i];
+    }
+    delete [] feed.bufs;
+  } else {
+    arg->queue->claim();
+    arg->queue->push(0);
+  }
+
+  if (sub->lazyopen) {
+    for (i = 0; i < sub->nfiles; i++) {
+      if (inputs[i].sound) {
+	sf_close(inputs[i].sound);
+	inputs[i].sound = NULL;
+      }
+    }
+  }
+  return 0;
+}  // group_thread()
+
+//
+// Sum n blocks of interleaved frames into blocks[0], pairwise: at
+// each level, block k takes in block k+step for every k that is a
+// multiple of 2*step. Where one block of a pair is longer, the sum
+// takes the rest of it as is. Every block must have room for
+// BlockSize frames. Returns the number of frames in the sum.
+//
+
+static long reduce_blocks(float** blocks, long* lens, int n, int nout) {
+  int step, k;
+  long j, m, len;
+  float* a;
+  const float* b;
+
+  for (step = 1; step < n; step *= 2) {
+    for (k = 0; k + step < n; k += 2 * step) {
+      a = blocks[k];
+      b = blocks[k + step];
+      len = lens[k + step];
+      m = ((lens[k] < len) ? lens[k] : len) * nout;
+      for (j = 0; j < m; j++) {
+	a[j] += b[j];
+      }
+      if (len > lens[k]) {
+	memcpy(a + m, b + m, (len * nout - m) * sizeof(float));
+	lens[k] = len;
+      }
+    }
+  }
+  return (n > 0) ? lens[0] : 0;
+}  // reduce_blocks()
+
+//
+// Add up n streams of blocks, taken from group queues or read back
+// from the files of earlier waves, until all of them have ended. The
+// sum goes to stem if it isn't NULL, and out through feed otherwise.
+//
+
+struct reduce_src {
+  int        n;
+  int        nout;
+  sndqueue** queues;		//  Group sums, or
+  FILE**     stems;		//  sums of earlier waves
+  float**    bufs;		//  Stem blocks, and stand-ins for ended streams
+  int*       done;
+};
+
+static void reduce_loop(reduce_src* src, FILE* stem, mixfeed* feed) {
+  int n = src->n, nout = src->nout;
+  float** blocks = new float*[n];
+  long* lens = new long[n];
+  int* held = new int[n];
+  long len;
+  int k, live;
+
+  for (;;) {
+    live = 0;
+    for (k = 0; k < n; k++) {
+      held[k] = 0;
+      lens[k] = 0;
+      blocks[k] = src->bufs[k];
+      if (src->done[k]) {
+	continue;
+      }
+      if (src->queues) {
+	blocks[k] = src->queues[k]->front(&len);
+	if (len <= 0) {
+	  src->queues[k]->pop();
+	  blocks[k] = src->bufs[k];
+	} else {
+	  lens[k] = len / nout;
+	  held[k] = 1;
+	}
+      } else {
+	lens[k] = fread(src->bufs[k], sizeof(float) * nout, BlockSize, src->stems[k]);
+      }
+      if (lens[k] > 0) {
+	live = 1;
+      } else {
+	src->done[k] = 1;
+      }
+    }
+    if (!live) {
+      break;
+    }
+
+    len = reduce_blocks(blocks, lens, n, nout);
+    if (stem) {
+      fwrite(blocks[0], sizeof(float) * nout, len, stem);
+    } else {
+      memcpy(feed_claim(feed), blocks[0], len * nout * sizeof(float));
+      feed_emit(feed, len);
+    }
+    for (k = 0; k < n; k++) {
+      if (held[k]) {
+	src->queues[k]->pop();
+      }
+    }
+  }
+
+  delete [] blocks;
+  delete [] lens;
+  delete [] held;
+}  // reduce_loop()
+
+//
+// Mix groups first .. last-1 and reduce them to one stream. Returns 0
+// (with job->error set) if a group's inputs couldn't be opened.
+//
+
+static int run_wave(mixjob* job, int size, int first, int last, FILE* stem,
+		    mixfeed* feed) {
+  int n = last - first, nout = job->outchannels;
+  int k, nstarted = 0, ok = 1;
+  group_arg* args = new group_arg[n];
+  pthread_t* threads = new pthread_t[n];
+  reduce_src src;
+
+  src.n = n;
+  src.nout = nout;
+  src.queues = new sndqueue*[n];
+  src.stems = NULL;
+  src.bufs = new float*[n];
+  src.done = new int[n];
+
+  for (k = 0; k < n; k++) {
+    mixjob* sub = &args[k].sub;
+    *sub = *job;
+    sub->inputs = job->inputs + (long) (first + k) * size;
+    sub->nfiles = job->nfiles - (first + k) * size;
+    if (sub->nfiles > size) sub->nfiles = size;
+    sub->error[0] = '\0';
+    args[k].plan = make_plan(sub);
+    args[k].queue = src.queues[k] = new sndqueue(QueueDepth, (long) BlockSize * nout);
+    src.bufs[k] = new float[(long) BlockSize * nout];
+    src.done[k] = 0;
+    if (pthread_create(&threads[k], NULL, group_thread, &args[k]) != 0) {
+      free_plan(args[k].plan);
+      delete src.queues[k];
+      delete [] src.bufs[k];
+      stop_threads(nstarted, src.queues, threads);
+      ok = job_error(job, "couldn't start group thread %d", first + k);
+      break;
+    }
+    nstarted++;
+  }
+
+  if (ok) {
+    reduce_loop(&src, stem, feed);
+    for (k = 0; k < n; k++) {
+      pthread_join(threads[k], NULL);
+    }
+  }
+
+  for (k = 0; k < nstarted; k++) {
+    if (ok && !args[k].ok) {
+      ok = job_error(job, "%s", args[k].sub.error);
+    }
+    free_plan(args[k].plan);
+    delete src.queues[k];
+    delete [] src.bufs[k];
+  }
+  delete [] src.queues;
+  delete [] src.bufs;
+  delete [] src.done;
+  delete [] args;
+  delete [] threads;
+  return ok;
+}  // run_wave()
+
+//
+// Choose the group size, and the number of groups in each wave. Under
+// -F, the largest groups (at most -G) and then the largest waves for
+// which the wave's inputs, the temporary files of all the waves and
+// the output together fit within MaxOpen. Returns 0 (with job->error
+// set) if there are none.
+//
+
+static int open_files(int nfiles, int size, int perwave) {
+  int ngroups = (nfiles + size - 1) / size;
+  int nwaves = (ngroups + perwave - 1) / perwave;
+  long inputs = (long) perwave * size;
+
+  if (inputs > nfiles) inputs = nfiles;
+  return inputs + ((nwaves > 1) ? nwaves : 0) + 1;
+}  // open_files()
+
+int plan_groups(mixjob* job, int* size, int* perwave) {
+  int s, p, ngroups;
+
+  s = (GroupSize > 0) ? GroupSize : DEFAULT_GROUP_SIZE;
+  if (MaxOpen > 0 && s > MaxOpen) {
+    s = MaxOpen;
+  }
+  if (!job->lazyopen) {
+    *size = s;
+    *perwave = (job->nfiles + s - 1) / s;
+    return 1;
+  }
+
+  for (; s > 0; s--) {
+    ngroups = (job->nfiles + s - 1) / s;
+    for (p = 1; p < ngroups; p *= 2)
+      ;
+    for (; p >= 1; p /= 2) {
+      if (open_files(job->nfiles, s, p) <= MaxOpen) {
+	*size = s;
+	*perwave = p;
+	return 1;
+      }
+    }
+  }
+  return job_error(job, "%d inputs can't be mixed with at most %d files open at once."
+		   " Raise -F.", job->nfiles, MaxOpen);
+}  // plan_groups()
+
+int mix_grouped(mixjob* job, SNDFILE* out, int size, int perwave) {
+  int nout = job->outchannels;
+  int ngroups, nwaves, w, last, ok;
+  mixfeed feed;
+  FILE** stems;
+  reduce_src src;
+
+  ngroups = (job->nfiles + size - 1) / size;
+  nwaves = (ngroups + perwave - 1) / perwave;
+
+  feed.inputs = NULL;
+  feed.bufs = NULL;
+  feed.queues = NULL;
+  feed.out = out;
+  feed.outbuf = new float[(long) BlockSize * nout];
+  feed.outqueue = NULL;
+  feed.limit = make_limiter(job);
+  feed.nout = nout;
+
+  if (Verbose) {
+    fprintf(stderr, "Starting mix of %d inputs in %d groups of %d", job->nfiles,
+	    ngroups, size);
+    if (nwaves > 1) {
+      fprintf(stderr, ", %d groups at a time", perwave);
+    }
+    fprintf(stderr, " (%s)...\n", simd_name(simd_level()));
+  }
+
+  ok = 1;
+  if (nwaves == 1) {
+    ok = run_wave(job, size, 0, ngroups, NULL, &feed);
+  } else {
+    stems = new FILE*[nwaves];
+    for (w = 0; w < nwaves; w++) {
+      stems[w] = NULL;
+    }
+    for (w = 0; w < nwaves && ok; w++) {
+      if ((stems[w] = tmpfile()) == NULL) {
+	ok = job_error(job, "couldn't create a temporary file");
+	break;
+      }
+      last = (w + 1) * perwave;
+      if (last > ngroups) last = ngroups;
+      ok = run_wave(job, size, w * perwave, last, stems[w], NULL);
+      if (ok && (fflush(stems[w]) != 0 || ferror(stems[w]))) {
+	ok = job_error(job, "couldn't write a temporary file");
+      }
+      rewind(stems[w]);
+      if (Verbose) {
+	fprintf(stderr, "Mixed groups %d to %d\n", w * perwave, last - 1);
+      }
+    }
+
+    if (ok) {
+      src.n = nwaves;
+      src.nout = nout;
+      src.queues = NULL;
+      src.stems = stems;
+      src.bufs = new float*[nwaves];
+      src.done = new int[nwaves];
+      for (w = 0; w < nwaves; w++) {
+	src.bufs[w] = new float[(long) BlockSize * nout];
+	src.done[w] = 0;
+      }
+      reduce_loop(&src, NULL, &feed);
+      for (w = 0; w < nwaves; w++) {
+	delete [] src.bufs[w];
+      }
+      delete [] src.bufs;
+      delete [] src.done;
+    }
+    for (w = 0; w < nwaves; w++) {
+      if (stems[w]) fclose(stems[w]);
+    }
+    delete [] stems;
+  }
+
+  if (ok) {
+    feed_finish(&feed);
+  }
+  delete [] feed.outbuf;
+  delete feed.limit;
+
+  if (Verbose) {
+    fprintf(stderr, "Done.\n");
+  }
+  return ok;
+}  // mix_grouped()
+
+//////////////////////////////////////////////////////////////////////
+//
+// Live mode.
+//
+// The mix runs on a clock, one block (10 ms by default) per tick. At
+// each tick, whatever has arrived on each input is read without
+// blocking. An input with a whole block waiting contributes it, and
+// one without is silent for that block (an underrun) instead of
+// stalling the others. An input that delivers faster than the clock
+// would build up delay, so once more than LiveLatency is waiting its
+// oldest blocks are dropped.
+//
+// A FIFO with no writer reads as end of file. An input counts as
+// connected once it has delivered something, and the mix ends when
+// every input has been connected and has then reached end of file.
+// Underruns and drops are reported on stderr every few seconds while
+// they keep happening, and in total at the end.
+//
+
+#define LIVE_REPORT 5.0		//  Seconds between counter reports
+
+struct livein {
+  char*     buf;		//  Raw bytes read but not yet mixed
+  long      have;		//  Bytes in buf
+  int       connected;
+  int       eof;
+  long long underruns;
+  long long dropped;		//  Blocks thrown away for being too late
+  long long reported;		//  underruns + dropped at the last report
+};
+
+//
+// Read whatever is waiting, keeping at most cap bytes (a whole number
+// of blocks). The poll() keeps a blocking descriptor (stdin) from
+// holding up the mix.
+//
+
+static void live_read(mixinput* in, livein* lv, long blockbytes, long cap) {
+  struct pollfd pfd;
+  long n;
+
+  for (;;) {
+    if (lv->have == cap) {
+      memmove(lv->buf, lv->buf + blockbytes, cap - blockbytes);
+      lv->have -= blockbytes;
+      lv->dropped++;
+    }
+    pfd.fd = in->fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) <= 0) {
+      break;			//  Nothing waiting
+    }
+    n = read(in->fd, lv->buf + lv->have, cap - lv->have);
+    if (n > 0) {
+      lv->have += n;
+      lv->connected = 1;
+      lv->eof = 0;
+    } else {
+      if (n == 0 && lv->connected) {
+	lv->eof = 1;
+      }
+      break;			//  Nothing more for now
+    }
+  }
+}  // live_read()
+
+static void live_report(mixjob* job, livein* lvs, long long ticks, int all) {
+  for (int i = 0; i < job->nfiles; i++) {
+    livein* lv = &lvs[i];
+    if (all || lv->underruns + lv->dropped != lv->reported) {
+      fprintf(stderr, "%s: %.1f s: '%s': %lld underruns, %lld dropped blocks\n",
+	      ProgName, ticks * (double) BlockSize / job->outrate,
+	      job->inputs[i].fname, lv->underruns, lv->dropped);
+      lv->reported = lv->underruns + lv->dropped;
+    }
+  }
+}  // live_report()
+
+void mix_live(mixjob* job, mixplan* plan, SNDFILE* out) {
+  int nfiles = job->nfiles;
+  mixinput* inputs = job->inputs;
+  livein* lvs = new livein[nfiles];
+  float** planes = new float*[nfiles];
+  float* gains = new float[nfiles];
+  long* lens = new long[nfiles];
+  float* raw = new float[(long) BlockSize * LiveChannels];
+  long blockbytes = (long) BlockSize * LiveChannels * sizeof(short);
+  long maxblocks, cap, j;
+  long long ticks = 0, late = 0, nextreport;
+  long period;			//  Nanoseconds per block
+  struct timespec next, now;
+  short sample;
+  int i, live;
+  mixfeed feed;
+
+  maxblocks = lround(LiveLatency * job->outrate / 1000.0 / BlockSize);
+  if (maxblocks < 1) maxblocks = 1;
+  cap = (maxblocks + 1) * blockbytes;
+  period = lround(1e9 * BlockSize / job->outrate);
+  nextreport = lround(LIVE_REPORT * job->outrate / BlockSize);
+  if (nextreport < 1) nextreport = 1;
+
+  for (i = 0; i < nfiles; i++) {
+    lvs[i].buf = new char[cap];
+    lvs[i].have = 0;
+    lvs[i].connected = 0;
+    lvs[i].eof = 0;
+    lvs[i].underruns = 0;
+    lvs[i].dropped = 0;
+    lvs[i].reported = 0;
+    planes[i] = new float[(long) BlockSize * LiveChannels];
+    gains[i] = 1.0;
+  }
+
+  feed.inputs = inputs;
+  feed.bufs = NULL;
+  feed.queues = NULL;
+  feed.out = out;
+  feed.outbuf = new float[(long) BlockSize * plan->nout];
+  feed.outqueue = NULL;
+  feed.limit = make_limiter(job);
+  feed.nout = plan->nout;
+
+  if (Verbose) {
+    fprintf(stderr, "Starting live mix of %d inputs, %d frame blocks, up to %ld blocks waiting...\n",
+	    nfiles, BlockSize, maxblocks);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  for (;;) {
+
+    // Wait for the next tick. If the output has held us up for longer
+    // than the latency target, start the clock again from now.
+
+    next.tv_nsec += period;
+    while (next.tv_nsec >= 1000000000L) {
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - next.tv_sec) * 1e9 + (now.tv_nsec - next.tv_nsec)
+	> (double) maxblocks * period) {
+      next = now;
+      late++;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+      ;
+
+    live = 0;
+    for (i = 0; i < nfiles; i++) {
+      livein* lv = &lvs[i];
+      live_read(&inputs[i], lv, blockbytes, cap);
+      if (lv->have >= blockbytes) {
+	for (j = 0; j < (long) BlockSize * LiveChannels; j++) {
+	  memcpy(&sample, lv->buf + j * sizeof(short), sizeof(short));
+	  raw[j] = sample / 32768.0;
+	}
+	deinterleave(raw, BlockSize, LiveChannels, planes[i], BlockSize);
+	memmove(lv->buf, lv->buf + blockbytes, lv->have - blockbytes);
+	lv->have -= blockbytes;
+	lens[i] = BlockSize;
+      } else {
+	lens[i] = 0;
+	if (lv->connected && !lv->eof) {
+	  lv->underruns++;
+	}
+      }
+      if (!lv->connected || !lv->eof || lv->have >= blockbytes) {
+	live = 1;
+      }
+    }
+    if (!live) {
+      break;
+    }
+
+    mix_block(plan, planes, gains, lens, BlockSize, feed_claim(&feed));
+    feed_emit(&feed, BlockSize);
+    ticks++;
+    if (ticks % nextreport == 0) {
+      live_report(job, lvs, ticks, 0);
+    }
+  }
+  feed_finish(&feed);
+
+  live_report(job, lvs, ticks, 1);
+  if (late > 0) {
+    fprintf(stderr, "%s: the output fell behind %lld times\n", ProgName, late);
+  }
+
+  for (i = 0; i < nfiles; i++) {
+    delete [] lvs[i].buf;
+    delete [] planes[i];
+  }
+  delete [] lvs;
+  delete [] planes;
+  delete [] gains;
+  delete [] lens;
+  delete [] raw;
+  delete [] feed.outbuf;
+  delete feed.limit;
+}  // mix_live()
+
+//////////////////////////////////////////////////////////////////////
+//
+// Given the set of sound files, compute all the scaling factors so
+// that the loudest sound doesn't change, and all the others are
+// equalized.
+//
+// Statistics come from the cache file if there is one and it has an
+// up to date entry. The remaining inputs are analyzed in parallel,
+// and the cache is rewritten with their results.
+//
+// Note: The sounds are all rewound to the start as a side effect.
+//
+// Returns 0 (with job->error set) if an input can't be analyzed, or
+// is too short to have a level.
+//
+// In batch mode several jobs may share the cache. The file is only
+// touched under CacheLock, and it is read again just before it is
+// rewritten, so that entries added by other jobs in the meantime are
+// kept.
+//
+
+static pthread_mutex_t CacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+struct level_arg {
+  mixinput* inputs;
+  jstat* stats;
+  double* lufs;			//  Only filled in with LoudGain
+  int* todo;			//  Indexes of inputs to analyze
+  char (*failed)[1024];	//  Why an input couldn't be analyzed, or ""
+};
+
+static void level_job(void* p, int job) {
+  level_arg* arg = (level_arg*) p;
+  int i = arg->todo[job];
+  mixinput* in = &arg->inputs[i];
+  loudness* loud = NULL;
+  sndindex* ix = NULL;
+
+  SNDFILE* sound = in->sound;
+  SF_INFO info;
+  char why[256];
+
+  // Under -F the input is only open while it's analyzed.
+
+  if (sound == NULL) {
+    info = in->info;
+    if ((sound = open_sound(in->fname, SFM_READ, &info, why, sizeof(why))) == NULL) {
+      snprintf(arg->failed[i], sizeof(arg->failed[i]), "couldn't open '%s' for autogain: %s",
+	       in->fname, why);
+      return;
+    }
+  }
+  if (LoudGain) {
+    loud = new loudness(in->info.samplerate, in->info.channels);
+  } else if (UseIndex) {
+    ix = sndindex_open(in->fname, 1);
+  }
+  if (!level_snd(sound, &(in->info), &(arg->stats[i]), loud, ix)) {
+    snprintf(arg->failed[i], sizeof(arg->failed[i]), "seek failed while analyzing '%s'",
+	     in->fname);
+  }
+  sndindex_close(ix);
+  if (loud) {
+    arg->lufs[i] = loud->integrated();
+    delete loud;
+  }
+  if (sound != in->sound) {
+    sf_close(sound);
+  }
+}  // level_job()
+
+int auto_gain(mixjob* job, int nfiles, mixinput* inputs) {
+  int i, ntodo, ok = 1;
+  float minscale;
+  jstat* stats;
+  double* lufs;
+  cache_entry* entries = NULL;
+  cache_entry* keys;
+  cache_entry* hit;
+  cache_entry* grown;
+  int nentries = 0;
+  level_arg arg;
+
+  if (Verbose) {
+    fprintf(stderr, "Computing auto-gain...\n");
+  }
+
+  stats = new jstat[nfiles];
+  lufs = new double[nfiles];
+  keys = new cache_entry[nfiles];
+  arg.todo = new int[nfiles];
+  arg.failed = new char[nfiles][1024];
+  arg.inputs = inputs;
+  arg.stats = stats;
+  arg.lufs = lufs;
+
+  // Without the memory to read the cache, everything is analyzed.
+
+  if (CacheFile) {
+    pthread_mutex_lock(&CacheLock);
+    if ((nentries = read_cache(CacheFile, &entries)) < 0) {
+      nentries = 0;
+    }
+    pthread_mutex_unlock(&CacheLock);
+  }
+
+  ntodo = 0;
+  for (i = 0; i < nfiles; i++) {
+    keys[i].path = NULL;
+    arg.failed[i][0] = '\0';
+    hit = NULL;
+    if (CacheFile && cache_key(inputs[i].fname, &keys[i])) {
+      hit = find_cache(entries, nentries, &keys[i]);
+    }
+    if (hit) {
+      stats[i] = hit->stat;
+      lufs[i] = hit->lufs;
+    } else {
+      arg.todo[ntodo++] = i;
+    }
+    if (Verbose) {
+      fprintf(stderr, "%s: %s\n", inputs[i].fname, hit ? "cached" : "analyzing");
+    }
+  }
+
+  run_jobs(ntodo, Threads, level_job, &arg);
+
+  for (i = 0; i < nfiles && ok; i++) {
+    if (arg.failed[i][0]) {
+      ok = job_error(job, "%s", arg.failed[i]);
+    } else if (!LoudGain && stats[i].n() < 2) {
+      ok = job_error(job, "'%s' is too short for autogain", inputs[i].fname);
+    }
+  }
+
+  // Add or replace the cache entries of the inputs just analyzed. The
+  // cache is left as it is if there isn't the memory to update it.
+
+  if (CacheFile && ntodo > 0) {
+    pthread_mutex_lock(&CacheLock);
+    for (i = 0; i < nentries; i++) {
+      free(entries[i].path);
+    }
+    free(entries);
+    grown = NULL;
+    if ((nentries = read_cache(CacheFile, &entries)) >= 0) {
+      grown = (cache_entry*) realloc(entries, (nentries + ntodo) * sizeof(cache_entry));
+    }
+    if (grown == NULL) {
+      for (i = 0; i < nentries; i++) {
+	free(entries[i].path);
+      }
+      free(entries);
+      entries = NULL;
+      nentries = 0;
+      ntodo = 0;
+      if (ok) {
+	ok = job_error(job, "out of memory updating cache file '%s'", CacheFile);
+      }
+    } else {
+      entries = grown;
+    }
+    for (int k = 0; k < ntodo; k++) {
+      i = arg.todo[k];
+      if (keys[i].path == NULL || arg.failed[i][0]) {
+	continue;		// Not a regular file, or not analyzed
+      }
+      keys[i].stat = stats[i];
+      keys[i].lufs = lufs[i];
+
+      // Replace any stale entry for the same file and parameters.
+      hit = NULL;
+      for (int e = 0; e < nentries && !hit; e++) {
+	if (entries[e].sampletime == keys[i].sampletime
+	    && entries[e].samplesize == keys[i].samplesize
+	    && entries[e].seed == keys[i].seed
+	    && !strcmp(entries[e].path, keys[i].path)) {
+	  hit = &entries[e];
+	}
+      }
+      if (!hit) {
+	hit = &entries[nentries++];
+	hit->path = NULL;
+      }
+      free(hit->path);
+      *hit = keys[i];
+      keys[i].path = NULL;
+    }
+    if (grown) {
+      write_cache(CacheFile, entries, nentries);
+    }
+    pthread_mutex_unlock(&CacheLock);
+  }
+
+  // An input with no block above the loudness gate is silent as far
+  // as -k is concerned. It is left at the loudest input's level rather
+  // than boosted without limit.
+
+  minscale = 0.0;
+  for (i = 0; i < nfiles && ok; i++) {
+    if (!LoudGain) {
+      inputs[i].scale = 1.0 / stats[i].std();
+    } else if (lufs[i] == -HUGE_VAL) {
+      inputs[i].scale = 0.0;
+      if (Verbose) {
+	fprintf(stderr, "%s: no loudness above the gate\n", inputs[i].fname);
+      }
+      continue;
+    } else {
+      inputs[i].scale = pow(10.0, -lufs[i] / 20.0);
+      if (Verbose) {
+	fprintf(stderr, "%s: %.2f LUFS\n", inputs[i].fname, lufs[i]);
+      }
+    }
+    if (minscale == 0.0 || minscale > inputs[i].scale) minscale = inputs[i].scale;
+  }
+  for (i = 0; i < nfiles && ok; i++) {
+    if (inputs[i].scale == 0.0 || minscale == 0.0) {
+      inputs[i].scale = 1.0;
+    } else {
+      inputs[i].scale /= minscale;
+    }
+    if (inputs[i].sound) {
+      sf_seek(inputs[i].sound, 0, SEEK_SET);
+    }
+  }
+
+  for (i = 0; i < nentries; i++) {
+    free(entries[i].path);
+  }
+  for (i = 0; i < nfiles; i++) {
+    free(keys[i].path);
+  }
+  free(entries);
+  delete [] keys;
+  delete [] stats;
+  delete [] lufs;
+  delete [] arg.todo;
+  delete [] arg.failed;
+  return ok;
+}  // auto_gain()
+
+//////////////////////////////////////////////////////////////////////
+//
+// Compute the statistics used for autogain on the given sound. If
+// loud isn't NULL, the same audio is fed to the loudness meter. The
+// excerpts are the ones sndstat_random() would read, and the meter is
+// restarted at each one. If ix isn't NULL (and there's no meter), the
+// statistics are taken from it instead. Returns 0 if a seek fails.
+//
+
+static long level_read(SNDFILE* in, int channels, long maxframes, float* buf,
+		       long bufframes, jstat* stat, loudness* loud) {
+  long total = 0, want, n;
+
+  while (maxframes < 0 || total < maxframes) {
+    want = bufframes;
+    if (maxframes >= 0 && maxframes - total < want) {
+      want = maxframes - total;
+    }
+    n = sf_readf_float(in, buf, want);
+    if (n <= 0) {
+      break;
+    }
+    stat->data(buf, n * channels);
+    loud->add(buf, n);
+    total += n;
+    if (n < want) {
+      break;
+    }
+  }
+  return total;
+}  // level_read()
+
+int level_snd(SNDFILE* in, SF_INFO* sfinfo, jstat* stat, loudness* loud,
+	      sndindex* ix) {
+  const long bufframes = 10000;
+  float* buf;
+  long size, count, k;
+  long* starts;
+  jstat* got;
+  int ok = 1;
+
+  if (loud == NULL) {
+    if (ix) {
+      got = sndindex_random(ix, in, sfinfo, "iamix audio file", RandomSampleTime,
+			    RandomSampleSize, stat, RandomSeed);
+    } else if (sfinfo->frames < RandomSampleTime * sfinfo->samplerate) {
+      got = sndstat(in, sfinfo, "iamix audio file", 0.0, -1.0, stat);
+    } else {
+      got = sndstat_random(in, sfinfo, "iamix audio file", RandomSampleTime,
+			   RandomSampleSize, stat, NULL, RandomSeed);
+    }
+    sf_seek(in, 0, SEEK_SET);	// Rewind to the start of the snd
+    return got != NULL;
+  }
+
+  buf = new float[bufframes * sfinfo->channels];
   if (sfinfo->frames < RandomSampleTime * sfinfo->samplerate) {
-    (void) sndstat(in, sfinfo, "iamix audio file", 0.0, -1.0, &stat);
+    (void) level_read(in, sfinfo->channels, -1, buf, bufframes, stat, loud);
   } else {
-    (void) sndstat_random(in, sfinfo, "iamix audio file", RandomSampleTime, RandomSampleSize, &stat);
+    size = (long) (sfinfo->samplerate * RandomSampleSize);
+    if (size < 1) size = 1;
+    count = (long) ceil(sfinfo->samplerate * RandomSampleTime / size);
+    starts = new long[count];
+    sndstat_strata(sfinfo->frames, size, count, RandomSeed, starts);
+    for (k = 0; k < count; k++) {
+      if (sf_seek(in, starts[k], SEEK_SET) == -1) {
+	ok = 0;
+	break;
+      }
+      loud->restart();
+      (void) level_read(in, sfinfo->channels, size, buf, bufframes, stat, loud);
+    }
+    delete [] starts;
   }
+  delete [] buf;
   sf_seek(in, 0, SEEK_SET);	// Rewind to the start of the snd
-  return stat.std();
-}  // std_snd()
+  return ok;
+}  // level_snd()
+
+//////////////////////////////////////////////////////////////////////
+//
+// The autogain cache.
+//
+// The cache file is plain text with one line per input:
+//
+//   stat2 size mtime sampletime samplesize seed n mean m2 min max path
+//   loud2 size mtime sampletime samplesize seed lufs n mean m2 min max path
+//
+// where n through max are jstat::save() output, and path runs to the
+// end of the line. A loud2 line also holds the integrated loudness, and
+// serves with or without -k. An entry is only used if the path, size,
+// modification time and sampling parameters all match. Lines of any
+// other kind are ignored. That includes the "std" and "lufs" lines of
+// older versions, which saved raw sums, and the "stat" and "loud" lines
+// from before the excerpts were chosen by seed.
+//
+
+//
+// Fill in the key fields for fname. Returns 0 if the file can't be
+// cached (e.g. stdin or a pipe).
+//
+
+int cache_key(const char* fname, cache_entry* key) {
+  struct stat sb;
+  char path[PATH_MAX];
+
+  if (stat(fname, &sb) != 0 || !S_ISREG(sb.st_mode)
+      || realpath(fname, path) == NULL) {
+    return 0;
+  }
+  if ((key->path = strdup(path)) == NULL) {
+    return 0;
+  }
+  key->size = sb.st_size;
+  key->mtime = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+  key->sampletime = RandomSampleTime;
+  key->samplesize = RandomSampleSize;
+  key->seed = RandomSeed;
+  key->hasloud = LoudGain;
+  key->lufs = 0.0;
+  return 1;
+}  // cache_key()
+
+cache_entry* find_cache(cache_entry* entries, int nentries, const cache_entry* key) {
+  for (int i = 0; i < nentries; i++) {
+    if (entries[i].size == key->size && entries[i].mtime == key->mtime
+	&& entries[i].sampletime == key->sampletime
+	&& entries[i].samplesize == key->samplesize
+	&& entries[i].seed == key->seed
+	&& (entries[i].hasloud || !key->hasloud)
+	&& !strcmp(entries[i].path, key->path)) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}  // find_cache()
+
+//
+// Returns the number of entries read. A missing cache file is the
+// same as an empty one. Malformed lines are skipped. Returns -1, with
+// no entries, if there isn't the memory to read it all.
+//
+
+int read_cache(const char* fname, cache_entry** entries) {
+  FILE* fp;
+  char line[PATH_MAX + 1024];
+  char kind[16];
+  char* p;
+  int pos, lpos, field, len;
+  int n = 0, max = 64, nomem = 0;
+  cache_entry e;
+  cache_entry* grown;
+
+  *entries = NULL;
+  if ((fp = fopen(fname, "r")) == NULL) {
+    return 0;
+  }
+  if ((*entries = (cache_entry*) malloc(max * sizeof(cache_entry))) == NULL) {
+    fclose(fp);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    len = strlen(line);
+    if (len > 0 && line[len-1] == '\n') {
+      line[len-1] = '\0';
+    }
+    if (sscanf(line, "%15s %lld %lld %f %f %llu %n", kind, &e.size, &e.mtime,
+	       &e.sampletime, &e.samplesize, &e.seed, &pos) != 6) {
+      continue;
+    }
+    e.hasloud = !strcmp(kind, "loud2");
+    e.lufs = 0.0;
+    if (e.hasloud) {
+      if (sscanf(line + pos, "%lf %n", &e.lufs, &lpos) != 1) {
+	continue;
+      }
+      pos += lpos;
+    } else if (strcmp(kind, "stat2")) {
+      continue;
+    }
+    if (!e.stat.load(line + pos)) {
+      continue;
+    }
+    // The path follows the five jstat fields.
+    p = line + pos;
+    for (field = 0; field < 5; field++) {
+      while (*p == ' ') p++;
+      while (*p && *p != ' ') p++;
+    }
+    if (*p++ != ' ' || *p == '\0') {
+      continue;
+    }
+    if (n == max) {
+      max *= 2;
+      if ((grown = (cache_entry*) realloc(*entries, max * sizeof(cache_entry))) == NULL) {
+	nomem = 1;
+	break;
+      }
+      *entries = grown;
+    }
+    if ((e.path = strdup(p)) == NULL) {
+      nomem = 1;
+      break;
+    }
+    (*entries)[n++] = e;
+  }
+  fclose(fp);
+
+  if (nomem) {
+    while (n > 0) {
+      free((*entries)[--n].path);
+    }
+    free(*entries);
+    *entries = NULL;
+    return -1;
+  }
+  return n;
+}  // read_cache()
+
+//
+// Write to a temporary file and rename it into place, so a reader
+// never sees a partial cache.
+//
+
+void write_cache(const char* fname, cache_entry* entries, int nentries) {
+  FILE* fp;
+  char* tmpname;
+
+  if ((tmpname = (char*) malloc(strlen(fname) + 32)) == NULL) {
+    fprintf(stderr, "%s: out of memory writing cache file '%s'\n", ProgName, fname);
+    return;
+  }
+  sprintf(tmpname, "%s.%d.tmp", fname, (int) getpid());
+  if ((fp = fopen(tmpname, "w")) == NULL) {
+    fprintf(stderr, "%s: couldn't write cache file '%s'\n", ProgName, tmpname);
+    free(tmpname);
+    return;
+  }
+  for (int i = 0; i < nentries; i++) {
+    fprintf(fp, "%s %lld %lld %.9g %.9g %llu ", entries[i].hasloud ? "loud2" : "stat2",
+	    entries[i].size, entries[i].mtime,
+	    entries[i].sampletime, entries[i].samplesize, entries[i].seed);
+    if (entries[i].hasloud) {
+      fprintf(fp, "%.17g ", entries[i].lufs);
+    }
+    entries[i].stat.save(fp);
+    fprintf(fp, " %s\n", entries[i].path);
+  }
+  if (fclose(fp) != 0 || rename(tmpname, fname) != 0) {
+    fprintf(stderr, "%s: couldn't update cache file '%s'\n", ProgName, fname);
+    unlink(tmpname);
+  }
+  free(tmpname);
+}  // write_cache()
 
 
 //////////////////////////////////////////////////////////////////////
@@ -0,0 +1,611 @@
+//////////////////////////////////////////////////////////////////////
+//
+// File: iaqc.cc
+//
+// Copyright 2016 International Computer Science Institute
+// See the file LICENSE for licensing terms.
+//
+// Scan audio files for problems that whole-file statistics can't
+// locate, and list where they are:
+//
+//   clip     At least -r samples in a row at or beyond +-level
+//   dropout  A run of exact zeros at least -z msec long
+//   stuck    The same nonzero, unclipped value repeated for at least
+//            -s msec
+//   dc       A stretch of -w second windows whose mean is beyond
+//            +-level
+//
+// Each channel is checked on its own. Events are printed one per line
+// as "infile channel start end kind", with times in seconds. These are
+// iachop's columns, but iachop would take the kind for an output file
+// name, so give -o to make the list iachop input: the last column is
+// then an output file name in a directory, and the list can be given
+// to iachop as is to cut out the events for listening. With -b, the
+// events of each file are also merged over channels and kinds and
+// written next to it as "start end" lines, ready for iableep.
+//
+// iachop and iableep turn a time into a frame by truncating
+// time*rate, so the times are printed at the middle of the frame they
+// stand for. That survives the rounding of the printed decimals and of
+// their float arithmetic, where the exact frame boundary would often
+// come back as the frame before.
+//
+// Each file is read once in blocks, and each channel of a block is turned
+// into three bit masks (at or beyond the clip level, zero, and equal
+// to the sample before) by sample_masks() in sndsimd.cc. The runs are
+// then found a 64 bit word at a time, so the clean stretches that
+// make up almost all of a file cost a few instructions per 64
+// samples. Several files are scanned at once (-j), and the output is
+// printed in the order of the files on the command line.
+//
+// Requires libsndfile from http://www.mega-nerd.com/libsndfile
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sndfile.h>
+
+#include "sndsimd.h"
+#include "sndthread.h"
+
+//////////////////////////////////////////////////////////////////////
+//
+// Globals
+//
+
+// Frames read at a time. Must be a multiple of 64, so that the masks
+// of a block are whole words.
+
+#define QC_BLOCK (4096)
+
+char* ProgName;
+
+static int    Verbose = 0;
+static float  ClipLevel = 0.9999;	// -c: |x| at or beyond this is clipped
+static int    ClipRun = 3;		// -r: samples in a row to count as clipping
+static float  ZeroTime = 10.0;		// -z: msec of zeros to count as a dropout
+static float  StuckTime = 5.0;		// -s: msec of one value to count as stuck
+static float  DCLevel = 0.05;		// -d: |mean| at or beyond this is offset
+static float  DCWindow = 1.0;		// -w: seconds over which the mean is taken
+static char*  OutDir = NULL;		// -o: name iachop outputs in this directory
+static char*  BleepSuffix = NULL;	// -b: write iableep lists to infile+suffix
+static int    Threads = 0;		// -j: files at once, or one per CPU if 0
+
+enum { EV_CLIP, EV_ZERO, EV_STUCK, EV_DC, EV_KINDS };
+
+static const char* KindNames[EV_KINDS] = { "clip", "dropout", "stuck", "dc" };
+
+//////////////////////////////////////////////////////////////////////
+//
+// Types
+//
+
+// One event, in frames. The end is one past the last frame.
+
+struct qc_event {
+  long start;
+  long end;
+  int  channel;
+  int  kind;
+};
+
+// One input file, which is scanned as one job.
+
+struct qc_file {
+  const char* fname;
+  int       samplerate;
+  qc_event* events;
+  long      nevents;
+  long      maxevents;
+  char      error[4096 + 32];	//  Empty if the file was scanned
+  int       done;
+};
+
+struct pool_arg {
+  qc_file* files;
+  int nfiles;
+  int next;			//  Next file to report
+  pthread_mutex_t lock;
+};
+
+//////////////////////////////////////////////////////////////////////
+//
+// Prototypes
+//
+
+static int  scan_file(qc_file* f);
+static void scan_runs(const unsigned long long* mask, long n, long base, long* open,
+		      long minlen, long lead, int channel, int kind, qc_file* f);
+static void add_event(qc_file* f, long start, long end, int channel, int kind);
+static int  compare_events(const void* a, const void* b);
+static double frame_time(long frame, double sr);
+static void print_events(qc_file* f);
+static int  write_bleeps(qc_file* f);
+static void qc_job(void* p, int k);
+void  usage();
+float my_atof(char*);
+int   my_atoi(char*);
+
+//////////////////////////////////////////////////////////////////////
+//
+// Main
+//
+
+int main(int argc, char** argv) {
+  int ch;
+  int i, nfailed;
+  pool_arg arg;
+
+  ProgName = argv[0];
+
+  while ((ch = getopt(argc, argv, "c:r:z:s:d:w:o:b:j:S:vh?")) != -1) {
+    switch (ch) {
+    case 'c':
+      ClipLevel = my_atof(optarg);
+      break;
+    case 'r':
+      ClipRun = my_atoi(optarg);
+      break;
+    case 'z':
+      ZeroTime = my_atof(optarg);
+      break;
+    case 's':
+      StuckTime = my_atof(optarg);
+      break;
+    case 'd':
+      DCLevel = my_atof(optarg);
+      break;
+    case 'w':
+      DCWindow = my_atof(optarg);
+      break;
+    case 'o':
+      OutDir = optarg;
+      break;
+    case 'b':
+      BleepSuffix = optarg;
+      break;
+    case 'j':
+      Threads = my_atoi(optarg);
+      break;
+    case 'S':
+      simd_set_level(my_atoi(optarg));
+      break;
+    case 'v':
+      Verbose = 1;
+      break;
+    case 'h':
+    case '?':
+    default:
+      usage();
+    }
+  }
+
+  if (optind >= argc) {
+    usage();
+  }
+  if (ClipLevel <= 0.0 || ClipRun < 1 || ZeroTime <= 0.0 || StuckTime <= 0.0
+      || DCLevel <= 0.0 || DCWindow <= 0.0) {
+    fprintf(stderr, "%s: levels, run lengths and times must be greater than 0\n",
+	    ProgName);
+    usage();
+  }
+
+  // Each file is a job. Events are printed by whichever thread
+  // finishes the file that is next in line, so the output doesn't
+  // depend on timing.
+
+  arg.nfiles = argc - optind;
+  arg.files = new qc_file[arg.nfiles];
+  arg.next = 0;
+  for (i = 0; i < arg.nfiles; i++) {
+    arg.files[i].fname = argv[optind + i];
+    arg.files[i].events = NULL;
+    arg.files[i].nevents = 0;
+    arg.files[i].maxevents = 0;
+    arg.files[i].error[0] = '\0';
+    arg.files[i].done = 0;
+  }
+  pthread_mutex_init(&arg.lock, NULL);
+  run_jobs(arg.nfiles, Threads, qc_job, &arg);
+  pthread_mutex_destroy(&arg.lock);
+
+  nfailed = 0;
+  for (i = 0; i < arg.nfiles; i++) {
+    if (arg.files[i].error[0]) {
+      nfailed++;
+    }
+  }
+  delete [] arg.files;
+  return nfailed ? 1 : 0;
+}  // main()
+
+//////////////////////////////////////////////////////////////////////
+//
+// Scanning
+//
+
+static void qc_job(void* p, int k) {
+  pool_arg* arg = (pool_arg*) p;
+  qc_file* f = &arg->files[k];
+
+  if (scan_file(f) && BleepSuffix) {
+    write_bleeps(f);
+  }
+
+  pthread_mutex_lock(&arg->lock);
+  f->done = 1;
+  while (arg->next < arg->nfiles && arg->files[arg->next].done) {
+    qc_file* g = &arg->files[arg->next++];
+    if (g->error[0]) {
+      fflush(stdout);
+      fprintf(stderr, "%s: %s\n", ProgName, g->error);
+    } else {
+      print_events(g);
+    }
+    free(g->events);
+    g->events = NULL;
+  }
+  pthread_mutex_unlock(&arg->lock);
+}  // qc_job()
+
+//
+// Read the file once and collect its events, sorted by start time.
+// Returns 0 and sets f->error on failure.
+//
+// Run state is kept per channel and kind across blocks, as the frame
+// where the open run started, or -1. The sample before each block is
+// kept in front of the block's planes so that the first "same" bit
+// compares across the boundary. It starts as a NaN, which equals
+// nothing.
+//
+
+static int scan_file(qc_file* f) {
+  SNDFILE* in;
+  SF_INFO info;
+  float* buf;
+  float* planes;
+  float* x;
+  unsigned long long* masks;
+  unsigned long long* clip;
+  unsigned long long* zero;
+  unsigned long long* same;
+  long* open;
+  double* dcsum;
+  long* dcopen;
+  long nread, pos, dcpos, window, zerolen, stucklen, start, m, n, j, w, nwords;
+  double sum, sumsq;
+  float lo, hi;
+  int c, nch, kind;
+  const long stride = QC_BLOCK + 1;
+
+  memset(&info, 0, sizeof(info));
+  if ((in = sf_open(f->fname, SFM_READ, &info)) == NULL) {
+    snprintf(f->error, sizeof(f->error), "Failed to open %s: %s",
+	     f->fname, sf_strerror(NULL));
+    return 0;
+  }
+  nch = info.channels;
+  f->samplerate = info.samplerate;
+
+  // Run lengths in frames. A stuck run of n same bits covers n+1
+  // samples, counting the one it repeats.
+
+  zerolen = lround(ZeroTime * info.samplerate / 1000.0);
+  if (zerolen < 1) zerolen = 1;
+  stucklen = lround(StuckTime * info.samplerate / 1000.0);
+  if (stucklen < 2) stucklen = 2;
+  window = lround(DCWindow * info.samplerate);
+  if (window < 1) window = 1;
+
+  nwords = QC_BLOCK / 64;
+  buf = new float[QC_BLOCK * nch];
+  planes = new float[stride * nch];
+  masks = new unsigned long long[3 * nwords];
+  clip = masks;
+  zero = masks + nwords;
+  same = masks + 2 * nwords;
+  open = new long[EV_DC * nch];
+  dcsum = new double[nch];
+  dcopen = new long[nch];
+  for (c = 0; c < nch; c++) {
+    planes[c * stride] = NAN;
+    for (kind = 0; kind < EV_DC; kind++) {
+      open[c * EV_DC + kind] = -1;
+    }
+    dcsum[c] = 0.0;
+    dcopen[c] = -1;
+  }
+
+  pos = 0;			//  Frame at the start of the block
+  dcpos = 0;			//  Frames into the current DC window
+  while ((nread = sf_readf_float(in, buf, QC_BLOCK)) > 0) {
+    deinterleave(buf, nread, nch, planes + 1, stride);
+
+    for (c = 0; c < nch; c++) {
+      x = planes + c * stride + 1;
+
+      // Clipped, zero and stuck runs. A repeated zero or clipped value
+      // is reported as that, not as stuck.
+
+      sample_masks(x, nread, ClipLevel, clip, zero, same);
+      for (w = 0; w < nwords; w++) {
+	same[w] &= ~(zero[w] | clip[w]);
+      }
+      scan_runs(clip, nread, pos, &open[c * EV_DC + EV_CLIP], ClipRun, 0, c, EV_CLIP, f);
+      scan_runs(zero, nread, pos, &open[c * EV_DC + EV_ZERO], zerolen, 0, c, EV_ZERO, f);
+      scan_runs(same, nread, pos, &open[c * EV_DC + EV_STUCK], stucklen, 1, c, EV_STUCK, f);
+
+      // DC offset, one window at a time. Consecutive windows that are
+      // off make one event.
+
+      for (j = 0, m = dcpos; j < nread; j += n) {
+	n = window - m;
+	if (n > nread - j) n = nread - j;
+	block_moments(x + j, n, 0.0, &sum, &sumsq, &lo, &hi);
+	dcsum[c] += sum;
+	m += n;
+	if (m < window) {
+	  break;
+	}
+	start = pos + j + n - window;
+	if (fabs(dcsum[c] / window) >= DCLevel) {
+	  if (dcopen[c] < 0) dcopen[c] = start;
+	} else if (dcopen[c] >= 0) {
+	  add_event(f, dcopen[c], start, c, EV_DC);
+	  dcopen[c] = -1;
+	}
+	dcsum[c] = 0.0;
+	m = 0;
+      }
+
+      x[-1] = x[nread - 1];
+    }
+    dcpos = (dcpos + nread) % window;
+    pos += nread;
+  }
+
+  // Close whatever is still open at the end of the file. A partial
+  // last DC window counts if it's at least half a window.
+
+  for (c = 0; c < nch; c++) {
+    for (kind = 0; kind < EV_DC; kind++) {
+      start = open[c * EV_DC + kind];
+      long minlen = (kind == EV_CLIP) ? ClipRun : (kind == EV_ZERO) ? zerolen : stucklen;
+      if (start >= 0 && pos - start >= minlen) {
+	add_event(f, start, pos, c, kind);
+      }
+    }
+    if (dcpos > 0 && 2 * dcpos >= window && fabs(dcsum[c] / dcpos) >= DCLevel) {
+      if (dcopen[c] < 0) dcopen[c] = pos - dcpos;
+    } else if (dcopen[c] >= 0) {
+      add_event(f, dcopen[c], pos - dcpos, c, EV_DC);
+      dcopen[c] = -1;
+    }
+    if (dcopen[c] >= 0) {
+      add_event(f, dcopen[c], pos, c, EV_DC);
+    }
+  }
+
+  if (nread < 0 || sf_error(in)) {
+    snprintf(f->error, sizeof(f->error), "Error reading %s: %s",
+	     f->fname, sf_strerror(in));
+  }
+  sf_close(in);
+  delete [] buf;
+  delete [] planes;
+  delete [] masks;
+  delete [] open;
+  delete [] dcsum;
+  delete [] dcopen;
+  if (f->error[0]) {
+    return 0;
+  }
+
+  qsort(f->events, f->nevents, sizeof(qc_event), compare_events);
+  if (Verbose) {
+    fprintf(stderr, "%s: %ld frames, %d channels, %ld events\n",
+	    f->fname, pos, nch, f->nevents);
+  }
+  return 1;
+}  // scan_file()
+
+//
+// Follow the runs of set bits in the masks of one block of n frames
+// starting at frame base. *open is where the run that is still going
+// started, or -1. A run that ends is added if it's at least minlen
+// frames long, after moving its start back by lead frames. Bits past
+// n are clear, so a run that reaches the end of a short (last) block
+// ends there.
+//
+
+static void scan_runs(const unsigned long long* mask, long n, long base, long* open,
+		      long minlen, long lead, int channel, int kind, qc_file* f) {
+  unsigned long long rest;
+  long w, nwords, at;
+  int k;
+
+  nwords = (n + 63) / 64;
+  for (w = 0; w < nwords; w++) {
+
+    // Nothing starts or ends in a word that's all clear outside a run
+    // or all set inside one.
+
+    if (mask[w] == (*open < 0 ? 0ULL : ~0ULL)) {
+      continue;
+    }
+    k = 0;
+    while (k < 64) {
+      if (*open < 0) {
+	rest = mask[w] >> k;
+	if (rest == 0) break;
+	k += __builtin_ctzll(rest);
+	*open = base + w * 64 + k - lead;
+      } else {
+	rest = ~mask[w] >> k;
+	if (rest == 0) break;
+	k += __builtin_ctzll(rest);
+	at = base + w * 64 + k;
+	if (at - *open >= minlen) {
+	  add_event(f, *open, at, channel, kind);
+	}
+	*open = -1;
+      }
+    }
+  }
+}  // scan_runs()
+
+static void add_event(qc_file* f, long start, long end, int channel, int kind) {
+  if (f->nevents == f->maxevents) {
+    f->maxevents = f->maxevents ? 2 * f->maxevents : 64;
+    f->events = (qc_event*) realloc(f->events, f->maxevents * sizeof(qc_event));
+    if (!f->events) {
+      fprintf(stderr, "Out of memory in %s line %d\n", __FILE__, __LINE__);
+      exit(1);
+    }
+  }
+  f->events[f->nevents].start = start;
+  f->events[f->nevents].end = end;
+  f->events[f->nevents].channel = channel;
+  f->events[f->nevents].kind = kind;
+  f->nevents++;
+}  // add_event()
+
+static int compare_events(const void* a, const void* b) {
+  const qc_event* x = (const qc_event*) a;
+  const qc_event* y = (const qc_event*) b;
+
+  if (x->start != y->start) return x->start < y->start ? -1 : 1;
+  if (x->channel != y->channel) return x->channel - y->channel;
+  if (x->kind != y->kind) return x->kind - y->kind;
+  return x->end < y->end ? -1 : x->end > y->end;
+}  // compare_events()
+
+//////////////////////////////////////////////////////////////////////
+//
+// Output
+//
+
+static double frame_time(long frame, double sr) {
+  return (frame + 0.5) / sr;
+}  // frame_time()
+
+//
+// One line per event, with the end exclusive (as iachop takes it).
+// With -o, the last column is
+// outdir/base.kind.N.ext, where base and ext are the input's file name
+// without and with its directory and extension, and N counts the
+// events of the file from 1.
+//
+
+static void print_events(qc_file* f) {
+  const char* base;
+  const char* ext;
+  int baselen;
+  long i;
+  double sr = f->samplerate;
+
+  base = strrchr(f->fname, '/');
+  base = base ? base + 1 : f->fname;
+  ext = strrchr(base, '.');
+  if (!ext || ext == base) ext = base + strlen(base);
+  baselen = ext - base;
+  if (!*ext) ext = ".wav";
+
+  for (i = 0; i < f->nevents; i++) {
+    qc_event* e = &f->events[i];
+    printf("%s %d %.6f %.6f ", f->fname, e->channel, frame_time(e->start, sr),
+	   frame_time(e->end, sr));
+    if (OutDir) {
+      printf("%s/%.*s.%s.%ld%s\n", OutDir, baselen, base, KindNames[e->kind], i + 1, ext);
+    } else {
+      printf("%s\n", KindNames[e->kind]);
+    }
+  }
+}  // print_events()
+
+//
+// -b. iableep wants sorted ranges that don't overlap, so events that
+// overlap or touch are merged, whatever their channel or kind. Its end
+// times are inclusive, so each range ends at its last frame.
+// Returns 0 and sets f->error on failure.
+//
+
+static int write_bleeps(qc_file* f) {
+  char fname[4096];
+  FILE* fp;
+  long i, start, end;
+  double sr = f->samplerate;
+
+  snprintf(fname, sizeof(fname), "%s%s", f->fname, BleepSuffix);
+  if ((fp = fopen(fname, "w")) == NULL) {
+    snprintf(f->error, sizeof(f->error), "Failed to open %s for writing", fname);
+    return 0;
+  }
+  for (i = 0; i < f->nevents; ) {
+    start = f->events[i].start;
+    end = f->events[i].end;
+    for (i++; i < f->nevents && f->events[i].start <= end; i++) {
+      if (f->events[i].end > end) end = f->events[i].end;
+    }
+    fprintf(fp, "%.6f %.6f\n", frame_time(start, sr), frame_time(end - 1, sr));
+  }
+  if (fclose(fp) != 0) {
+    snprintf(f->error, sizeof(f->error), "Error writing %s", fname);
+    return 0;
+  }
+  return 1;
+}  // write_bleeps()
+
+//////////////////////////////////////////////////////////////////////
+//
+// Print command line usage and exit.
+//
+
+void usage() {
+  fprintf(stderr, "\nUsage: %s [options] infile1 infile2 ...\n", ProgName);
+  fprintf(stderr, "where\n");
+  fprintf(stderr, " -c level    Samples at or beyond +-level are clipped [%g]\n", ClipLevel);
+  fprintf(stderr, " -r samples  Clipped samples in a row to report [%d]\n", ClipRun);
+  fprintf(stderr, " -z msec     Shortest run of zeros to report as a dropout [%g]\n", ZeroTime);
+  fprintf(stderr, " -s msec     Shortest run of one repeated value to report as stuck [%g]\n",
+	  StuckTime);
+  fprintf(stderr, " -d level    Report windows whose mean is beyond +-level as dc [%g]\n",
+	  DCLevel);
+  fprintf(stderr, " -w secs     Window over which the mean is taken for -d [%g]\n", DCWindow);
+  fprintf(stderr, " -o dir      Print outdir/base.kind.N.ext as the last column, for iachop\n");
+  fprintf(stderr, " -b suffix   Also write each file's events to infile+suffix, for iableep\n");
+  fprintf(stderr, " -j threads  Number of files to scan at once [one per CPU]\n");
+  fprintf(stderr, " -S level    Limit vector instructions (0=none 1=sse 2=avx2 3=avx512)\n");
+  fprintf(stderr, " -v          Verbose\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "    One line is printed per event:\n\n");
+  fprintf(stderr, "      infile channel start end kind\n\n");
+  fprintf(stderr, "    with 0-based channels and times in seconds. kind is one of\n");
+  fprintf(stderr, "    clip, dropout, stuck or dc. Stuck runs don't include zeros or\n");
+  fprintf(stderr, "    clipped values. Give -o to make the list iachop input. Each time\n");
+  fprintf(stderr, "    is the middle of its frame. Exits with 1 if any file couldn't\n");
+  fprintf(stderr, "    be read.\n");
+  fprintf(stderr, "\n");
+  exit(1);
+}  // usage()
+
+float my_atof(char* in) {
+  float out;
+  if (sscanf(in, "%f", &out) != 1) {
+    usage();
+  }
+  return out;
+}  // my_atof()
+
+int my_atoi(char* in) {
+  int out;
+  if (sscanf(in, "%d", &out) != 1) {
+    usage();
+  }
+  return out;
+}  // my_atoi()
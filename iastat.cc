@@ -16,15 +16,81 @@
 //     Converted to use libsndfile instead of Dan Ellis's dpwelib.
 //     Renamed to iastat
 //
+// With -j, each file is analyzed as a separate job on a pool of
+// threads, and the results are reported per file, in the order the
+// files were given, followed by the results over all of them.
+//
+// With -t, a large file that can be seeked cheaply (uncompressed) is
+// split into ranges of frames that are scanned by separate threads,
+// each with its own handle on the file, and the partial statistics
+// are merged in order.
+//
+// 16 and 24 bit PCM WAV and NIST files are read by mapping them into
+// memory and summing the integer samples directly (see sndstat_pcm()),
+// rather than through libsndfile's conversion to float. -V says which
+// way each file was read.
+//
+// -p and -c report percentiles and how much of the data is near full
+// scale, from a jhist (see sndstats.h): exact for 8 and 16 bit files,
+// within 0.5% otherwise. With -j they're merged over files like the
+// rest.
+//
+// A file with several channels is treated as one stream of samples,
+// unless -C is given, which adds the statistics of each channel, or
+// -X, which adds the covariance (-X c) or correlation (-X r) matrix of
+// the channels. Both come from a jcov, which sees every frame in the
+// same pass as the rest; the percentiles stay over all channels.
+//
+// -f adds spectral statistics from a Welch averaged power spectrum
+// with -f points per segment (see jspec in sndstats.h): the total
+// power, the DC level, the mains hum (the first HUM_HARMONICS
+// harmonics of -H Hz, or of 50 or 60 Hz, whichever is stronger), the
+// spectral flatness, and the power in each -B band, all in dB
+// relative to full scale except the flatness. Every file in the run
+// has to have the same sample rate, and is read through libsndfile.
+//
+// With -I, the statistics come from a sidecar index of block totals
+// next to each file (see sndindex.cc), which is built the first time
+// and rebuilt whenever the file changes. Only the partial blocks at the
+// ends of the -k/-e range (or of each -r excerpt) are read from the
+// file itself. The index has no percentiles, channels or spectrum, so
+// it can't be used with -p, -c, -C, -X or -f.
+//
+// With -M, the statistics are of segments listed in a manifest, one
+// per line as
+//
+//   file start end [label]
+//
+// with times in seconds (rounded to the nearest frame), an end of -
+// for the end of the file, and a label (the rest of the line) that
+// defaults to file:start-end. Blank lines and lines starting with #
+// are skipped. Each file is read once, from its first segment to its
+// last, however many segments it has and whether or not they overlap
+// (see sndstat_segments()), and with -j several files are read at
+// once. One line of results is printed per segment, in the order of
+// the manifest.
+//
+// With -F, iastat instead writes features for each frame of the file:
+// RMS energy, peak magnitude and zero crossing rate over a window of
+// -w msec every -s msec (by default 25 and 10). They're written as
+// text, one frame per line headed by its start time in seconds, or
+// with -b as a matrix of native floats after the header frame_header.
+//
 
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <math.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include <sndfile.h>
 
 #include "sndstats.h"
+#include "sndthread.h"
+#include "sndindex.h"
 
 //////////////////////////////////////////////////////////////////////
 //
@@ -46,6 +112,121 @@ static float skip_time;
 static float end_time;
 static float random_sample;
 static float random_size;
+static unsigned long long random_seed;
+static int per_file;
+static int threads;
+static int chunk_threads;
+static int show_path;
+static const char* frame_out;	// -F file, or NULL
+static float frame_window;	// -w, msec
+static float frame_shift;	// -s, msec
+static int frame_binary;
+static double percentiles[32];	// -p, in percent
+static int npercentiles;
+static float clip_level;	// -c, or negative for none
+static int want_hist;		// Something above needs a jhist
+static int per_channel;		// -C
+static int cov_matrix;		// -X: 'c', 'r', or 0 for none
+static int want_cov;		// Either of the above
+static int use_index;		// -I
+static int spec_size;		// -f, or 0 for no spectrum
+static double bands[32][2];	// -B, in Hz
+static int nbands;
+static float mains_freq;	// -H, or 0 to pick 50 or 60
+static const char* manifest;	// -M file, or NULL
+
+// How a file was read, for -V.
+
+enum { PATH_FLOAT = 1, PATH_PCM, PATH_RANDOM, PATH_INDEX };
+
+// Smallest range of frames worth giving a thread of its own with -t.
+#define MIN_CHUNK_FRAMES (1L << 20)
+
+// -F reads this many samples at a time, and recomputes the sliding sum
+// of squares from scratch every FRAME_RESYNC samples.
+#define FRAME_BLOCK (10000)
+#define FRAME_RESYNC (1L << 16)
+
+// Harmonics of the mains frequency counted as hum, and the candidates
+// when -H isn't given.
+#define HUM_HARMONICS (5)
+#define MAINS_EU (50.0)
+#define MAINS_US (60.0)
+
+//////////////////////////////////////////////////////////////////////
+//
+// Types
+//
+
+// One file of a -j run.
+
+struct file_job {
+  const char* fname;
+  jstat stat;
+  jhist hist;			//  Cleared once merged into the total
+  jcov* cov;			//  With -C or -X. Freed once merged.
+  jspec* spec;			//  With -f. Likewise.
+  char  error[1024];		//  Empty if the file was analyzed
+  int   done;
+};
+
+// The ranges of one file scanned at once with -t.
+
+struct chunk_arg {
+  const char* fname;
+  long*  bounds;		//  Range k is frames bounds[k] to bounds[k+1]-1
+  jstat* stats;
+  jhist* hists;			//  Or NULL
+  jcov** covs;			//  Or NULL
+  jspec** specs;		//  Or NULL
+  int*   path;			//  How range k was read, or 0 if it failed
+};
+
+// Start of a -F -b file, followed by FRAME_COLUMNS floats per frame.
+// Frame k covers samples start + k*shift to start + k*shift + window - 1.
+
+#define FRAME_COLUMNS 3		//  RMS, peak, zero crossing rate
+
+struct frame_header {
+  char    magic[4];		//  "IAFR"
+  int32_t version;		//  1
+  int32_t columns;		//  FRAME_COLUMNS
+  int32_t samplerate;
+  int32_t window;		//  Samples per frame
+  int32_t shift;		//  Samples between frames
+  int64_t start;		//  First sample of frame 0
+};
+
+// One segment of a -M manifest.
+
+struct segment {
+  const char* fname;
+  double start;			//  Seconds
+  double end;			//  Seconds, or negative for the end of the file
+  char*  label;
+  jstat  stat;
+};
+
+// The segments of one file, which are read as one job.
+
+struct segment_file {
+  segment** segs;
+  long   nsegs;
+  int    reported;		//  Set once error has been printed
+  char   error[1024];		//  Empty if the file was read
+};
+
+struct pool_arg {
+  file_job* jobs;
+  int njobs;
+  int next;			//  Next file to report
+  jhist* total;			//  Histograms of the files reported so far
+  jcov** total_cov;		//  Likewise for -C and -X
+  int cov_mismatch;		//  Set if the files' channels differ
+  jspec** total_spec;		//  Likewise for -f
+  int spec_mismatch;		//  Set if the files' sample rates differ
+  pthread_mutex_t lock;
+};
 
 //////////////////////////////////////////////////////////////////////
 //
@@ -55,7 +236,20 @@ static float random_size;
 void usage();
 
 static float my_atof(const char*);
-static void print_results(jstat&);
+static int  stat_file(const char* fname, jstat* stat, jhist* hist, jcov** cov,
+		       jspec** spec, char* error, int size);
+static int  stat_chunks(const char* fname, SF_INFO* info, jstat* stat, jhist* hist,
+			jcov* cov, jspec* spec, int* nchunks);
+static void chunk_job(void* arg, int job);
+static void stat_job(void* arg, int job);
+static int  frame_file(const char* fname, char* error, int size);
+static int  run_manifest(const char* fname);
+static void segment_job(void* arg, int job);
+static void print_results(const char* name, jstat&, jhist*);
+static void print_channels(const char* name, jcov*);
+static void print_spectrum(const char* name, jspec*);
+static void parse_percentiles(const char*);
+static void parse_bands(const char*);
 
 //////////////////////////////////////////////////////////////////////
 //
@@ -63,10 +257,13 @@ static void print_results(jstat&);
 //
 
 int main(int argc, char** argv) {
-  SNDFILE* in;
-  SF_INFO info;
-  int c;
+  int c, i, nfailed;
   jstat stat;
+  jhist hist;
+  jcov* cov = NULL;
+  jspec* spec = NULL;
+  char error[1024];
+  pool_arg arg;
   extern char *optarg;
   extern int optind;
   
@@ -84,9 +281,39 @@ int main(int argc, char** argv) {
   end_time = -1.0;
   random_sample = -1.0;
   random_size = 1.0;
+  random_seed = 0;
+  per_file = 0;
+  threads = 0;
+  chunk_threads = 1;
+  show_path = 0;
+  frame_out = NULL;
+  frame_window = 25.0;
+  frame_shift = 10.0;
+  frame_binary = 0;
+  npercentiles = 0;
+  clip_level = -1.0;
+  per_channel = 0;
+  cov_matrix = 0;
+  use_index = 0;
+  spec_size = 0;
+  nbands = 0;
+  mains_freq = 0.0;
+  manifest = NULL;
     
-  while ((c = getopt(argc, argv, "dDe:k:lmnNr:R:vx")) != EOF) {
+  while ((c = getopt(argc, argv, "bB:c:CdDe:f:F:H:Ij:k:lmM:nNp:r:R:s:S:t:vVw:xX:")) != EOF) {
     switch (c) {
+    case 'b':
+      frame_binary = 1;
+      break;
+    case 'B':
+      parse_bands(optarg);
+      break;
+    case 'c':
+      clip_level = my_atof(optarg);
+      break;
+    case 'C':
+      per_channel = 1;
+      break;
     case 'd':
       show_std  = 1;
       break;
@@ -96,6 +323,22 @@ int main(int argc, char** argv) {
     case 'e':
       end_time = my_atof(optarg);
       break;
+    case 'f':
+      spec_size = (int) my_atof(optarg);
+      break;
+    case 'F':
+      frame_out = optarg;
+      break;
+    case 'H':
+      mains_freq = my_atof(optarg);
+      break;
+    case 'I':
+      use_index = 1;
+      break;
+    case 'j':
+      per_file = 1;
+      threads = (int) my_atof(optarg);
+      break;
     case 'k':
       skip_time = my_atof(optarg);
       break;
@@ -105,82 +348,902 @@ int main(int argc, char** argv) {
     case 'm':
       show_mean = 1;
       break;
+    case 'M':
+      manifest = optarg;
+      break;
     case 'n':
       show_min  = 1;
       break;
     case 'N':
       show_n    = 1;
       break;
+    case 'p':
+      parse_percentiles(optarg);
+      break;
     case 'r':
       random_sample = my_atof(optarg);
       break;
     case 'R':
       random_size = my_atof(optarg);
       break;
+    case 's':
+      frame_shift = my_atof(optarg);
+      break;
+    case 'S':
+      random_seed = strtoull(optarg, NULL, 0);
+      break;
+    case 't':
+      chunk_threads = (int) my_atof(optarg);
+      break;
     case 'v':
       show_var  = 1;
       break;
+    case 'V':
+      show_path = 1;
+      break;
+    case 'w':
+      frame_window = my_atof(optarg);
+      break;
     case 'x':
       show_max  = 1;
       break;
+    case 'X':
+      if (strcmp(optarg, "c") && strcmp(optarg, "r")) {
+	usage();
+      }
+      cov_matrix = optarg[0];
+      break;
     }
   }
 
+  if (manifest) {
+    if (optind != argc || frame_out || random_sample > 0.0 || skip_time > 0.0
+	|| end_time > 0.0 || npercentiles > 0 || clip_level >= 0.0 || per_channel
+	|| cov_matrix || spec_size || use_index) {
+      usage();
+    }
+    return run_manifest(manifest);
+  }
   if (optind >= argc) {
     usage();
   }
+  want_hist = (npercentiles > 0 || clip_level >= 0.0);
+  want_cov = (per_channel || cov_matrix);
 
   if (random_sample > 0.0 && (skip_time > 0.0 || end_time > 0.0)) {
     usage();
   }
-  
-  for (; optind < argc; optind++) {
-    
-    // I should really have command line args for headerless formats...
-    
-    if ((in = sf_open(argv[optind], SFM_READ, &info)) == NULL) {
-      fprintf(stderr, "%s: couldn't open '%s' as input sound file\n",
-	      ProgName, argv[optind]);
+  if (use_index && (want_hist || want_cov || spec_size)) {
+    usage();
+  }
+  if (spec_size && (spec_size < 16 || (spec_size & (spec_size - 1)))) {
+    fprintf(stderr, "%s: -f must be a power of two, at least 16\n", ProgName);
+    usage();
+  }
+
+  if (frame_out) {
+    if (optind != argc - 1 || random_sample > 0.0 || per_file
+	|| frame_window <= 0.0 || frame_shift <= 0.0) {
       usage();
     }
-    
-    if (info.channels != 1) {
-      fprintf(stderr, "%s: %s is a multi channel sound files. Not (yet) supported.\n",
-	      ProgName, argv[optind]);
+    if (!frame_file(argv[optind], error, sizeof(error))) {
+      fprintf(stderr, "%s: %s\n", ProgName, error);
       exit(1);
     }
+    return 0;
+  }
+  
+  if (!per_file) {
+    for (; optind < argc; optind++) {
+      if (!stat_file(argv[optind], &stat, want_hist ? &hist : NULL, want_cov ? &cov : NULL,
+		     spec_size ? &spec : NULL, error, sizeof(error))) {
+	fprintf(stderr, "%s: %s\n", ProgName, error);
+	exit(1);
+      }
+    }
+    print_results(NULL, stat, &hist);
+    if (cov) {
+      print_channels(NULL, cov);
+      delete cov;
+    }
+    if (spec) {
+      print_spectrum(NULL, spec);
+      delete spec;
+    }
+    return 0;
+  }
 
-    if ((random_sample > 0.0 || skip_time > 0) && !info.seekable) {
-      fprintf(stderr, "%s: %s is not seekable. Try setting random_sample to 0 and/or skip_time to 0.\n",
-	      ProgName, argv[optind]);
-      exit(1);
+  // Each file is a job. Results are printed by whichever thread
+  // finishes the file that is next in line, and merged in file order
+  // at the end, so the output doesn't depend on timing. Histograms are
+  // merged as they're printed, so that at most a few are kept at once.
+
+  arg.njobs = argc - optind;
+  arg.jobs = new file_job[arg.njobs];
+  arg.next = 0;
+  arg.total = &hist;
+  arg.total_cov = &cov;
+  arg.cov_mismatch = 0;
+  arg.total_spec = &spec;
+  arg.spec_mismatch = 0;
+  for (i = 0; i < arg.njobs; i++) {
+    arg.jobs[i].fname = argv[optind + i];
+    arg.jobs[i].error[0] = '\0';
+    arg.jobs[i].done = 0;
+    arg.jobs[i].cov = NULL;
+    arg.jobs[i].spec = NULL;
+  }
+  pthread_mutex_init(&arg.lock, NULL);
+  run_jobs(arg.njobs, threads, stat_job, &arg);
+  pthread_mutex_destroy(&arg.lock);
+
+  nfailed = 0;
+  for (i = 0; i < arg.njobs; i++) {
+    if (arg.jobs[i].error[0] == '\0') {
+      stat.merge(arg.jobs[i].stat);
+    } else {
+      nfailed++;
+    }
+  }
+  if (stat.n() >= 2) {
+    print_results("TOTAL", stat, &hist);
+    if (cov && !arg.cov_mismatch) {
+      print_channels("TOTAL", cov);
+    } else if (cov) {
+      fflush(stdout);
+      fprintf(stderr, "%s: no TOTAL for -C or -X, since the files have different"
+	      " numbers of channels\n", ProgName);
     }
+    if (spec && !arg.spec_mismatch) {
+      print_spectrum("TOTAL", spec);
+    } else if (spec) {
+      fflush(stdout);
+      fprintf(stderr, "%s: no TOTAL for -f, since the files have different"
+	      " sample rates\n", ProgName);
+    }
+  }
+  delete cov;
+  delete spec;
+  if (nfailed > 0) {
+    fflush(stdout);
+    fprintf(stderr, "%s: %d of %d files failed\n", ProgName, nfailed, arg.njobs);
+  }
+  delete [] arg.jobs;
+  return (nfailed > 0) ? 1 : 0;
+}
+
+//
+// Add the samples of one file to stat. Returns 0 with a message in
+// error if the file can't be analyzed.
+//
+
+//
+// With cov, the per channel statistics go to *cov, which is created
+// for this file's channels if it's NULL, and otherwise has to match.
+//
+
+static int stat_file(const char* fname, jstat* stat, jhist* hist, jcov** cov,
+		     jspec** spec, char* error, int size) {
+  SNDFILE* in;
+  SF_INFO info;
+  sndindex* ix;
+  jspec* fspec = NULL;
+  jstat* got;
+  int path = 0, nchunks = 0;
+
+  // I should really have command line args for headerless formats...
+
+  if ((in = sf_open(fname, SFM_READ, &info)) == NULL) {
+    snprintf(error, size, "couldn't open '%s' as input sound file", fname);
+    return 0;
+  }
     
+  if (cov && *cov == NULL) {
+    *cov = new jcov(info.channels, cov_matrix != 0);
+  } else if (cov && (*cov)->channels() != info.channels) {
+    snprintf(error, size, "%s has %d channels, not %d like the files before it",
+	     fname, info.channels, (*cov)->channels());
+    sf_close(in);
+    return 0;
+  }
+  if (spec && *spec && (*spec)->samplerate() != info.samplerate) {
+    snprintf(error, size, "%s has a sample rate of %d, not %d like the files before it",
+	     fname, info.samplerate, (*spec)->samplerate());
+    sf_close(in);
+    return 0;
+  }
+
+  if ((random_sample > 0.0 || skip_time > 0) && !info.seekable) {
+    snprintf(error, size, "%s is not seekable. Try setting random_sample to 0 and/or skip_time to 0.",
+	     fname);
+    sf_close(in);
+    return 0;
+  }
+    
+  // The spectrum of this file is taken with its own channels, then
+  // merged into *spec, which may come from files with other channels.
+
+  if (spec) {
+    fspec = new jspec(spec_size, info.samplerate, info.channels);
+  }
+
+  if (use_index && (ix = sndindex_open(fname, 1)) != NULL) {
     if (random_sample > 0.0) {
-      sndstat_random(in, &info, argv[optind], random_sample, random_size, &stat);
+      got = sndindex_random(ix, in, &info, fname, random_sample, random_size, stat,
+			    random_seed);
     } else {
-      sndstat(in, &info, argv[optind], skip_time, end_time, &stat);
+      got = sndindex_range(ix, in, &info, fname, (long) (info.samplerate * skip_time),
+			   (end_time > 0.0) ? (long) (info.samplerate * end_time) : -1,
+			   stat);
     }
+    sndindex_close(ix);
+    path = PATH_INDEX;
+  } else if (random_sample > 0.0) {
+    got = sndstat_random(in, &info, fname, random_sample, random_size, stat, hist,
+			 random_seed, cov ? *cov : NULL, fspec);
+    path = PATH_RANDOM;
+  } else if (chunk_threads != 1
+	     && (path = stat_chunks(fname, &info, stat, hist, cov ? *cov : NULL,
+				    fspec, &nchunks)) != 0) {
+    got = stat;
+  } else if (!cov && !fspec && sndstat_pcm(fname, &info, (long) (info.samplerate * skip_time),
+			 (end_time > 0.0) ? (long) (info.samplerate * end_time) : -1,
+			 stat, hist)) {
+    got = stat;
+    path = PATH_PCM;
+  } else {
+    got = sndstat(in, &info, fname, skip_time, end_time, stat, hist, cov ? *cov : NULL,
+		  fspec);
+    path = PATH_FLOAT;
+  }
 
+  if (got == NULL) {
+    snprintf(error, size, "seek failed in '%s'", fname);
+    delete fspec;
     sf_close(in);
+    return 0;
   }
-  print_results(stat);
-  
-  return 0;
-}
+
+  if (show_path) {
+    char chunks[32] = "";
+    if (nchunks > 1) {
+      snprintf(chunks, sizeof(chunks), " in %d chunks", nchunks);
+    }
+    fprintf(stderr, "%s: %s: %s%s\n", ProgName, fname,
+	    (path == PATH_PCM) ? "integer PCM (mapped)" :
+	    (path == PATH_RANDOM) ? "float (random excerpts)" :
+	    (path == PATH_INDEX) ? "index" : "float", chunks);
+  }
+
+  if (fspec && *spec == NULL) {
+    *spec = fspec;
+  } else if (fspec) {
+    (*spec)->merge(*fspec);
+    delete fspec;
+  }
+
+  sf_close(in);
+  return 1;
+}  // stat_file()
+
+//
+// Scan the -k/-e range of the file in chunks on several threads.
+// Returns how the chunks were read, or 0, having done nothing, if the
+// file is better read straight through: it's compressed (so every
+// seek means decoding), or too short to be worth splitting.
+//
+
+static int stat_chunks(const char* fname, SF_INFO* info, jstat* stat, jhist* hist,
+		       jcov* cov, jspec* spec, int* count) {
+  long start, end, n;
+  int k, nchunks, path;
+  chunk_arg arg;
+
+  if (!info->seekable) {
+    return 0;
+  }
+  switch (info->format & SF_FORMAT_SUBMASK) {
+  case SF_FORMAT_PCM_S8:
+  case SF_FORMAT_PCM_U8:
+  case SF_FORMAT_PCM_16:
+  case SF_FORMAT_PCM_24:
+  case SF_FORMAT_PCM_32:
+  case SF_FORMAT_FLOAT:
+  case SF_FORMAT_DOUBLE:
+  case SF_FORMAT_ULAW:
+  case SF_FORMAT_ALAW:
+    break;
+  default:
+    return 0;
+  }
+
+  // The same frames sndstat() would read.
+
+  start = (long) (info->samplerate * skip_time);
+  end = (long) (info->samplerate * end_time);
+  if (end <= 0 || end > info->frames) {
+    end = info->frames;
+  }
+  n = end - start;
+
+  nchunks = (chunk_threads > 0) ? chunk_threads : num_cpus();
+  if (nchunks > n / MIN_CHUNK_FRAMES) {
+    nchunks = n / MIN_CHUNK_FRAMES;
+  }
+  if (nchunks < 2) {
+    return 0;
+  }
+
+  arg.fname = fname;
+  arg.bounds = new long[nchunks + 1];
+  arg.stats = new jstat[nchunks];
+  arg.hists = hist ? new jhist[nchunks] : NULL;
+  arg.covs = NULL;
+  if (cov) {
+    arg.covs = new jcov*[nchunks];
+    for (k = 0; k < nchunks; k++) {
+      arg.covs[k] = new jcov(info->channels, cov_matrix != 0);
+    }
+  }
+  arg.specs = NULL;
+  if (spec) {
+    arg.specs = new jspec*[nchunks];
+    for (k = 0; k < nchunks; k++) {
+      arg.specs[k] = new jspec(spec->size(), info->samplerate, info->channels);
+    }
+  }
+  arg.path = new int[nchunks];
+  for (k = 0; k <= nchunks; k++) {
+    arg.bounds[k] = start + (long) ((double) n * k / nchunks);
+  }
+  run_jobs(nchunks, nchunks, chunk_job, &arg);
+
+  path = arg.path[0];
+  for (k = 0; k < nchunks; k++) {
+    if (arg.path[k] == 0) path = 0;
+  }
+  if (path) {
+    for (k = 0; k < nchunks; k++) {
+      stat->merge(arg.stats[k]);
+      if (hist) hist->merge(arg.hists[k]);
+      if (cov) cov->merge(*arg.covs[k]);
+      if (spec) spec->merge(*arg.specs[k]);
+    }
+    *count = nchunks;
+  }
+  delete [] arg.bounds;
+  delete [] arg.stats;
+  delete [] arg.hists;
+  if (cov) {
+    for (k = 0; k < nchunks; k++) {
+      delete arg.covs[k];
+    }
+    delete [] arg.covs;
+  }
+  if (spec) {
+    for (k = 0; k < nchunks; k++) {
+      delete arg.specs[k];
+    }
+    delete [] arg.specs;
+  }
+  delete [] arg.path;
+  return path;
+}  // stat_chunks()
+
+static void chunk_job(void* p, int k) {
+  chunk_arg* arg = (chunk_arg*) p;
+  SNDFILE* in;
+  SF_INFO info;
+  jhist* hist;
+
+  info.format = 0;
+  if ((in = sf_open(arg->fname, SFM_READ, &info)) == NULL) {
+    arg->path[k] = 0;
+    return;
+  }
+  hist = arg->hists ? &arg->hists[k] : NULL;
+  if (!arg->covs && !arg->specs && sndstat_pcm(arg->fname, &info, arg->bounds[k], arg->bounds[k+1], &arg->stats[k], hist)) {
+    arg->path[k] = PATH_PCM;
+  } else if (sndstat_range(in, &info, arg->fname, arg->bounds[k], arg->bounds[k+1],
+			   &arg->stats[k], hist, arg->covs ? arg->covs[k] : NULL,
+			   arg->specs ? arg->specs[k] : NULL) != NULL) {
+    arg->path[k] = PATH_FLOAT;
+  } else {
+    arg->path[k] = 0;
+  }
+  sf_close(in);
+}  // chunk_job()
+
+static void stat_job(void* p, int k) {
+  pool_arg* arg = (pool_arg*) p;
+  file_job* job = &arg->jobs[k];
+
+  if (stat_file(job->fname, &job->stat, want_hist ? &job->hist : NULL,
+		want_cov ? &job->cov : NULL, spec_size ? &job->spec : NULL,
+		job->error, sizeof(job->error))
+      && job->stat.n() < 2) {
+    snprintf(job->error, sizeof(job->error), "%s is too short to analyze", job->fname);
+  }
+
+  pthread_mutex_lock(&arg->lock);
+  job->done = 1;
+  while (arg->next < arg->njobs && arg->jobs[arg->next].done) {
+    file_job* j = &arg->jobs[arg->next++];
+    if (j->error[0]) {
+      fflush(stdout);
+      fprintf(stderr, "%s: %s\n", ProgName, j->error);
+      delete j->cov;
+      j->cov = NULL;
+      delete j->spec;
+      j->spec = NULL;
+    } else {
+      print_results(j->fname, j->stat, &j->hist);
+      arg->total->merge(j->hist);
+      j->hist.clear();
+      if (j->cov) {
+	print_channels(j->fname, j->cov);
+	if (*arg->total_cov == NULL) {
+	  *arg->total_cov = new jcov(j->cov->channels(), cov_matrix != 0);
+	}
+	if (!(*arg->total_cov)->merge(*j->cov)) {
+	  arg->cov_mismatch = 1;
+	}
+	delete j->cov;
+	j->cov = NULL;
+      }
+      if (j->spec) {
+	print_spectrum(j->fname, j->spec);
+	if (*arg->total_spec == NULL) {
+	  *arg->total_spec = j->spec;
+	} else {
+	  if (!(*arg->total_spec)->merge(*j->spec)) {
+	    arg->spec_mismatch = 1;
+	  }
+	  delete j->spec;
+	}
+	j->spec = NULL;
+      }
+    }
+  }
+  pthread_mutex_unlock(&arg->lock);
+}  // stat_job()
+
+//
+// -M. Read the manifest, group its segments by file, read the files
+// on -j threads, and print the segments in manifest order. Returns
+// the exit status.
+//
+
+static int segment_compare(const void* a, const void* b) {
+  const segment* x = *(const segment* const*) a;
+  const segment* y = *(const segment* const*) b;
+  int c = strcmp(x->fname, y->fname);
+
+  if (c != 0) {
+    return c;
+  }
+  return (x < y) ? -1 : (x > y);	//  Manifest order within a file
+}  // segment_compare()
+
+static int run_manifest(const char* fname) {
+  FILE* fp;
+  char line[4096];
+  char file[4096], start[64], end[64];
+  char label[sizeof(file) + sizeof(start) + sizeof(end)];
+  segment* segs = NULL;
+  segment* seg;
+  segment** order;
+  segment_file* files;
+  segment_file** owner;
+  long nsegs = 0, maxsegs = 0, lineno = 0, nfiles, i, j;
+  int pos, nfailed;
+  char* p;
+  char* e;
+
+  if ((fp = (strcmp(fname, "-") == 0) ? stdin : fopen(fname, "r")) == NULL) {
+    fprintf(stderr, "%s: couldn't open manifest '%s'\n", ProgName, fname);
+    exit(1);
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    lineno++;
+    if ((p = strchr(line, '\n')) != NULL) *p = '\0';
+    for (p = line; *p == ' ' || *p == '\t'; p++)
+      ;
+    if (*p == '\0' || *p == '#') {
+      continue;
+    }
+    if (sscanf(p, "%4095s %63s %63s %n", file, start, end, &pos) != 3) {
+      fprintf(stderr, "%s: %s line %ld: expected 'file start end [label]'\n",
+	      ProgName, fname, lineno);
+      exit(1);
+    }
+    if (nsegs == maxsegs) {
+      maxsegs = maxsegs ? 2 * maxsegs : 1024;
+      segs = (segment*) realloc(segs, maxsegs * sizeof(segment));
+      if (!segs) {
+	fprintf(stderr, "Out of memory in %s line %d\n", __FILE__, __LINE__);
+	exit(1);
+      }
+    }
+    seg = &segs[nsegs];
+    seg->start = strtod(start, &e);
+    if (*e != '\0' || seg->start < 0.0) {
+      fprintf(stderr, "%s: %s line %ld: bad start time %s\n", ProgName, fname, lineno, start);
+      exit(1);
+    }
+    if (strcmp(end, "-") == 0) {
+      seg->end = -1.0;
+    } else {
+      seg->end = strtod(end, &e);
+      if (*e != '\0' || seg->end < seg->start) {
+	fprintf(stderr, "%s: %s line %ld: bad end time %s\n", ProgName, fname, lineno, end);
+	exit(1);
+      }
+    }
+    seg->fname = strdup(file);
+    p += pos;
+    for (e = p + strlen(p); e > p && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r'); e--)
+      ;
+    *e = '\0';
+    if (*p) {
+      seg->label = strdup(p);
+    } else {
+      snprintf(label, sizeof(label), "%s:%s-%s", file, start, end);
+      seg->label = strdup(label);
+    }
+    seg->stat.clear();
+    nsegs++;
+  }
+  if (fp != stdin) {
+    fclose(fp);
+  }
+
+  // Runs of segments of the same file, which become the jobs.
+
+  order = new segment*[nsegs];
+  for (i = 0; i < nsegs; i++) {
+    order[i] = &segs[i];
+  }
+  qsort(order, nsegs, sizeof(segment*), segment_compare);
+  files = new segment_file[nsegs > 0 ? nsegs : 1];
+  nfiles = 0;
+  for (i = 0; i < nsegs; i = j) {
+    for (j = i + 1; j < nsegs && strcmp(order[j]->fname, order[i]->fname) == 0; j++)
+      ;
+    files[nfiles].segs = order + i;
+    files[nfiles].nsegs = j - i;
+    files[nfiles].reported = 0;
+    files[nfiles].error[0] = '\0';
+    nfiles++;
+  }
+  run_jobs(nfiles, per_file ? threads : 1, segment_job, files);
+
+  // Each segment's file, for its error, if any.
+
+  owner = new segment_file*[nsegs];
+  for (i = 0; i < nfiles; i++) {
+    for (j = 0; j < files[i].nsegs; j++) {
+      owner[files[i].segs[j] - segs] = &files[i];
+    }
+  }
+
+  nfailed = 0;
+  for (i = 0; i < nsegs; i++) {
+    if (owner[i]->error[0]) {
+      if (!owner[i]->reported) {
+	fflush(stdout);
+	fprintf(stderr, "%s: %s\n", ProgName, owner[i]->error);
+	owner[i]->reported = 1;
+      }
+      nfailed++;
+    } else if (segs[i].stat.n() < 2) {
+      fflush(stdout);
+      fprintf(stderr, "%s: segment %s is too short to analyze\n", ProgName, segs[i].label);
+      nfailed++;
+    } else {
+      print_results(segs[i].label, segs[i].stat, NULL);
+    }
+  }
+  if (nfailed > 0) {
+    fflush(stdout);
+    fprintf(stderr, "%s: %d of %ld segments failed\n", ProgName, nfailed, nsegs);
+  }
+
+  for (i = 0; i < nsegs; i++) {
+    free((char*) segs[i].fname);
+    free(segs[i].label);
+  }
+  free(segs);
+  delete [] order;
+  delete [] files;
+  delete [] owner;
+  return (nfailed > 0) ? 1 : 0;
+}  // run_manifest()
+
+static void segment_job(void* p, int k) {
+  segment_file* file = &((segment_file*) p)[k];
+  const char* fname = file->segs[0]->fname;
+  SNDFILE* in;
+  SF_INFO info;
+  long* starts;
+  long* ends;
+  jstat* stats;
+  long i;
+
+  if ((in = sf_open(fname, SFM_READ, &info)) == NULL) {
+    snprintf(file->error, sizeof(file->error), "couldn't open '%s' as input sound file", fname);
+    return;
+  }
+  starts = new long[file->nsegs];
+  ends = new long[file->nsegs];
+  stats = new jstat[file->nsegs];
+  for (i = 0; i < file->nsegs; i++) {
+    starts[i] = (long) floor(file->segs[i]->start * info.samplerate + 0.5);
+    ends[i] = (file->segs[i]->end < 0.0) ? -1
+      : (long) floor(file->segs[i]->end * info.samplerate + 0.5);
+  }
+  if (sndstat_segments(in, &info, fname, file->nsegs, starts, ends, stats)) {
+    for (i = 0; i < file->nsegs; i++) {
+      file->segs[i]->stat = stats[i];
+    }
+  } else {
+    snprintf(file->error, sizeof(file->error), "seek failed in '%s'", fname);
+  }
+  delete [] starts;
+  delete [] ends;
+  delete [] stats;
+  sf_close(in);
+}  // segment_job()
+
+//
+// Write the -F features of one file. The sum of squares and the count
+// of zero crossings in the window are updated as each sample comes in
+// and the oldest goes out. The peak is the head of a queue of the
+// window's samples in decreasing order of magnitude, from which each
+// sample that is no bigger than a newer one has been dropped, so every
+// sample is queued and dropped at most once.
+//
+
+static int frame_file(const char* fname, char* error, int size) {
+  SNDFILE* in;
+  SF_INFO info;
+  FILE* out;
+  frame_header head;
+  float buf[FRAME_BLOCK];
+  float row[FRAME_COLUMNS];
+  float* ring;			//  Sample i is at ring[i % window]
+  long* queue;			//  Peak queue, also indexed % window
+  long window, shift, start, end, want, nread, i, j, qhead, qtail;
+  long crossings;
+  double sumsq;
+  float x, old;
+
+  if ((in = sf_open(fname, SFM_READ, &info)) == NULL) {
+    snprintf(error, size, "couldn't open '%s' as input sound file", fname);
+    return 0;
+  }
+  if (info.channels != 1) {
+    snprintf(error, size, "%s is a multi channel sound files. Not (yet) supported.", fname);
+    sf_close(in);
+    return 0;
+  }
+  window = lround(info.samplerate * frame_window / 1000.0);
+  shift = lround(info.samplerate * frame_shift / 1000.0);
+  if (window < 2 || shift < 1) {
+    snprintf(error, size, "frames of %g msec every %g msec are too short at %d Hz",
+	     frame_window, frame_shift, info.samplerate);
+    sf_close(in);
+    return 0;
+  }
+  start = (long) (info.samplerate * skip_time);
+  end = (end_time > 0.0) ? (long) (info.samplerate * end_time) : -1;
+  if (start > 0 && sf_seek(in, start, SEEK_SET) == -1) {
+    snprintf(error, size, "%s is not seekable. Try setting skip_time to 0.", fname);
+    sf_close(in);
+    return 0;
+  }
+  if (strcmp(frame_out, "-") == 0) {
+    out = stdout;
+  } else if ((out = fopen(frame_out, "w")) == NULL) {
+    snprintf(error, size, "couldn't write '%s'", frame_out);
+    sf_close(in);
+    return 0;
+  }
+
+  if (frame_binary) {
+    memcpy(head.magic, "IAFR", 4);
+    head.version = 1;
+    head.columns = FRAME_COLUMNS;
+    head.samplerate = info.samplerate;
+    head.window = window;
+    head.shift = shift;
+    head.start = start;
+    fwrite(&head, sizeof(head), 1, out);
+  }
+
+  ring = new float[window];
+  queue = new long[window];
+  qhead = qtail = 0;
+  sumsq = 0.0;
+  crossings = 0;
+  i = 0;
+
+  for (;;) {
+    want = FRAME_BLOCK;
+    if (end >= 0 && end - start - i < want) {
+      want = end - start - i;
+    }
+    if (want <= 0 || (nread = sf_readf_float(in, buf, want)) <= 0) {
+      break;
+    }
+    for (j = 0; j < nread; j++, i++) {
+      x = buf[j];
+
+      // Sample i - window leaves, taking the crossing after it with it.
+
+      if (i >= window) {
+	old = ring[i % window];
+	sumsq -= (double) old * old;
+	crossings -= ((old < 0.0) != (ring[(i + 1) % window] < 0.0));
+	if (queue[qhead % window] == i - window) {
+	  qhead++;
+	}
+      }
+      if (i > 0) {
+	crossings += ((x < 0.0) != (ring[(i - 1) % window] < 0.0));
+      }
+      ring[i % window] = x;
+      sumsq += (double) x * x;
+      while (qtail > qhead && fabsf(ring[queue[(qtail - 1) % window] % window]) <= fabsf(x)) {
+	qtail--;
+      }
+      queue[qtail++ % window] = i;
+
+      if ((i + 1) % FRAME_RESYNC == 0 && i >= window - 1) {
+	sumsq = 0.0;
+	for (long k = 0; k < window; k++) {
+	  sumsq += (double) ring[k] * ring[k];
+	}
+      }
+
+      if (i >= window - 1 && (i - window + 1) % shift == 0) {
+	row[0] = sqrt((sumsq > 0.0) ? sumsq / window : 0.0);
+	row[1] = fabsf(ring[queue[qhead % window] % window]);
+	row[2] = (float) crossings / (window - 1);
+	if (frame_binary) {
+	  fwrite(row, sizeof(float), FRAME_COLUMNS, out);
+	} else {
+	  fprintf(out, "%.3f %g %g %g\n", (double) (start + i - window + 1) / info.samplerate,
+		  row[0], row[1], row[2]);
+	}
+      }
+    }
+    if (nread < want) {
+      break;
+    }
+  }
+
+  delete [] ring;
+  delete [] queue;
+  sf_close(in);
+  if (out == stdout ? fflush(out) != 0 : fclose(out) != 0) {
+    snprintf(error, size, "error writing '%s'", frame_out);
+    return 0;
+  }
+  return 1;
+}  // frame_file()
 
 void usage() {
-  fprintf(stderr, "Usage: %s -mxnNdvDl -k # -e # -r # -R # infile\n", ProgName);
+  fprintf(stderr, "Usage: %s -mxnNdvDlVCI -p #,# -c # -X c|r -f # -B #-#,... -H # -k # -e # -r # -R # -S # -j # -t # infile ...\n", ProgName);
+  fprintf(stderr, "   OR   %s -mxnNdvDl -j # -M manifest\n", ProgName);
+  fprintf(stderr, "   OR   %s -F outfile -w # -s # -b -k # -e # infile\n", ProgName);
   fprintf(stderr, " m - mean\n x - max\n n - min\n N - number of points\n");
   fprintf(stderr, " d - std\n v - variance\n D - 1/std\n l - show labels\n");
   fprintf(stderr, " k N - skip N seconds before starting analysis\n");
-  fprintf(stderr, " e N - stop after about N seconds (this is approximate)\n");
+  fprintf(stderr, " e N - stop after N seconds\n");
   fprintf(stderr, " r N - sample for a total of N seconds randomly\n");
   fprintf(stderr, " R N - random sample size of N seconds (defaults to 1.0)\n");
+  fprintf(stderr, " S N - seed for where the random samples are taken (defaults to 0)\n");
+  fprintf(stderr, " j N - analyze N files at once (0 for one per CPU), and report\n");
+  fprintf(stderr, "       each file followed by the TOTAL over all of them\n");
+  fprintf(stderr, " t N - scan each large uncompressed file in N pieces at once\n");
+  fprintf(stderr, "       (0 for one per CPU)\n");
+  fprintf(stderr, " V - report how each file was read (integer PCM or float)\n");
+  fprintf(stderr, " I - use (and if need be build) an index file next to each file,\n");
+  fprintf(stderr, "     so that repeated runs read only the ends of the -k/-e range\n");
+  fprintf(stderr, "     or of each -r sample\n");
+  fprintf(stderr, " p N,N,... - percentiles, e.g. 1,50,99 (exact for 8 and 16 bit\n");
+  fprintf(stderr, "       files, otherwise within 0.5%%)\n");
+  fprintf(stderr, " c N - fraction of samples with magnitude at least N (e.g. 0.99)\n");
+  fprintf(stderr, " C - also report each channel of a multi channel file\n");
+  fprintf(stderr, " X c|r - also report the covariance (c) or correlation (r) matrix\n");
+  fprintf(stderr, "         of the channels\n");
+  fprintf(stderr, " f N - also report spectral statistics from N point FFTs (a power\n");
+  fprintf(stderr, "       of two): power, DC, mains hum, flatness, then each -B band.\n");
+  fprintf(stderr, "       Levels are in dB re full scale\n");
+  fprintf(stderr, " B N-N,... - frequency bands in Hz for -f, e.g. 0-300,300-3400,3400-\n");
+  fprintf(stderr, " H N - mains frequency for -f (defaults to 50 or 60, whichever is stronger)\n");
+  fprintf(stderr, " M file - statistics of each segment listed in file, one per line as\n");
+  fprintf(stderr, "          'infile start end [label]' in seconds (end - for the end)\n");
+  fprintf(stderr, " F file - write RMS, peak and zero crossing rate per frame to file\n");
+  fprintf(stderr, "          (- for stdout) instead of the statistics above\n");
+  fprintf(stderr, " w N - frame window of N msec (defaults to 25)\n");
+  fprintf(stderr, " s N - frame shift of N msec (defaults to 10)\n");
+  fprintf(stderr, " b - write frames as binary floats after a header, not text\n");
   fprintf(stderr, "\nNote: -r cannot be specified with -k or -e\n");
+  fprintf(stderr, "      -I cannot be specified with -p, -c, -C, -X or -f\n");
   exit(1);
 }
 
+//
+// -p list: comma separated percentiles.
+//
+
+static void parse_percentiles(const char* list) {
+  const char* p = list;
+  char* end;
+  double v;
+
+  npercentiles = 0;
+  for (;;) {
+    v = strtod(p, &end);
+    if (end == p || v < 0.0 || v > 100.0
+	|| npercentiles == (int) (sizeof(percentiles) / sizeof(percentiles[0]))) {
+      fprintf(stderr, "Bad percentile list %s\n", list);
+      usage();
+    }
+    percentiles[npercentiles++] = v;
+    if (*end == '\0') {
+      break;
+    }
+    if (*end != ',') {
+      fprintf(stderr, "Bad percentile list %s\n", list);
+      usage();
+    }
+    p = end + 1;
+  }
+}  // parse_percentiles()
+
+//
+// -B list: comma separated lo-hi bands in Hz. A missing hi means up to
+// the Nyquist frequency.
+//
+
+static void parse_bands(const char* list) {
+  const char* p = list;
+  char* end;
+  double lo, hi;
+
+  nbands = 0;
+  for (;;) {
+    lo = strtod(p, &end);
+    if (end == p || *end != '-' || lo < 0.0
+	|| nbands == (int) (sizeof(bands) / sizeof(bands[0]))) {
+      fprintf(stderr, "Bad band list %s\n", list);
+      usage();
+    }
+    p = end + 1;
+    hi = strtod(p, &end);
+    if (end == p) {
+      hi = HUGE_VAL;
+    } else if (hi <= lo) {
+      fprintf(stderr, "Bad band list %s\n", list);
+      usage();
+    }
+    bands[nbands][0] = lo;
+    bands[nbands][1] = hi;
+    nbands++;
+    if (*end == '\0') {
+      break;
+    }
+    if (*end != ',') {
+      fprintf(stderr, "Bad band list %s\n", list);
+      usage();
+    }
+    p = end + 1;
+  }
+}  // parse_bands()
+
 static float my_atof(const char* in) {
   float out;
   if (sscanf(in, "%f", &out) != 1) {
@@ -190,7 +1253,79 @@ static float my_atof(const char* in) {
   return out;
 }
 
-static void print_results(jstat& stat) {
+//
+// -f. The levels are in dB relative to a full scale square wave (a
+// full scale sine is -3 dB). One line headed by name:spec (or just
+// spec), or with -l one labelled line each.
+//
+
+static double decibels(double power) {
+  return 10.0 * log10(power);		// -inf for silence
+}  // decibels()
+
+static void print_spectrum(const char* name, jspec* spec) {
+  double df = (double) spec->samplerate() / spec->size();
+  double mains = mains_freq;
+  char label[64];
+  int i;
+
+  if (spec->segments() == 0) {
+    fprintf(stderr, "%s: %s is shorter than one -f segment\n", ProgName,
+	    name ? name : "the input");
+    return;
+  }
+  if (mains <= 0.0) {
+    mains = (spec->tone(MAINS_EU, HUM_HARMONICS) > spec->tone(MAINS_US, HUM_HARMONICS))
+      ? MAINS_EU : MAINS_US;
+  }
+
+  if (show_labs) {
+    printf("  %s%sSpectrum: %d points, %lld segments\n", name ? name : "", name ? ":" : "",
+	   spec->size(), spec->segments());
+    printf("     Power: %f dB\n", decibels(spec->power(0.0, HUGE_VAL)));
+    printf("        DC: %f dB\n", decibels(spec->tone(0.0, 1)));
+    snprintf(label, sizeof(label), "Hum %gHz", mains);
+    printf("%10s: %f dB\n", label, decibels(spec->tone(mains, HUM_HARMONICS)));
+    printf("  Flatness: %f\n", spec->flatness(2.0 * df, HUGE_VAL));
+    for (i = 0; i < nbands; i++) {
+      if (bands[i][1] == HUGE_VAL) {
+	snprintf(label, sizeof(label), "%g-Hz", bands[i][0]);
+      } else {
+	snprintf(label, sizeof(label), "%g-%gHz", bands[i][0], bands[i][1]);
+      }
+      printf("%10s: %f dB\n", label, decibels(spec->power(bands[i][0], bands[i][1])));
+    }
+    return;
+  }
+
+  printf("%s%sspec %f %f %f %g %f", name ? name : "", name ? ":" : "",
+	 decibels(spec->power(0.0, HUGE_VAL)), decibels(spec->tone(0.0, 1)),
+	 decibels(spec->tone(mains, HUM_HARMONICS)), mains,
+	 spec->flatness(2.0 * df, HUGE_VAL));
+  for (i = 0; i < nbands; i++) {
+    printf(" %f", decibels(spec->power(bands[i][0], bands[i][1])));
+  }
+  printf("\n");
+}  // print_spectrum()
+
+//
+// If name isn't NULL, the results are for one of several files, and
+// are headed by its name. hist may be NULL for results (of one
+// channel) without percentiles.
+//
+
+static void print_results(const char* name, jstat& stat, jhist* hist) {
+  char label[16];
+  int i;
+
+  if (name) {
+    if (show_labs) {
+      printf("  File: %s\n", name);
+    } else {
+      printf("%s ", name);
+    }
+  }
+
   if (show_mean) {
     if (show_labs) {
       printf("  Mean: ");
@@ -231,7 +1366,7 @@ static void print_results(jstat& stat) {
     if (show_labs) {
       printf("     N: ");
     }
-    printf("%d", stat.n());
+    printf("%lld", stat.n());
     if (show_labs) {
       printf("\n");
     } else {
@@ -274,6 +1409,69 @@ static void print_results(jstat& stat) {
       printf(" ");
     }
   }
+
+  for (i = 0; hist && i < npercentiles; i++) {
+    if (show_labs) {
+      snprintf(label, sizeof(label), "P%g", percentiles[i]);
+      printf("%6s: ", label);
+    }
+    printf("%f", hist->quantile(percentiles[i] / 100.0));
+    if (show_labs) {
+      printf("\n");
+    } else {
+      printf(" ");
+    }
+  }
+
+  if (hist && clip_level >= 0.0) {
+    if (show_labs) {
+      printf("  Clip: ");
+    }
+    printf("%f", (double) hist->above(clip_level) / hist->n());
+    if (show_labs) {
+      printf("\n");
+    } else {
+      printf(" ");
+    }
+  }
   printf("\n");
 }
 
+//
+// -C and -X. Each line is headed by name:chN or name:covN / name:corrN
+// (just chN etc. if name is NULL).
+//
+
+static void print_channels(const char* name, jcov* cov) {
+  char label[1024];
+  int i, j, c = cov->channels();
+  jstat s;
+
+  if (per_channel) {
+    for (i = 0; i < c; i++) {
+      snprintf(label, sizeof(label), "%s%sch%d", name ? name : "", name ? ":" : "", i);
+      s = cov->channel(i);
+      print_results(label, s, NULL);
+    }
+  }
+  if (cov_matrix) {
+    for (i = 0; i < c; i++) {
+      if (show_labs) {
+	printf("  %s%s%s%d:", name ? name : "", name ? ":" : "",
+	       (cov_matrix == 'c') ? "Cov" : "Corr", i);
+      } else {
+	printf("%s%s%s%d", name ? name : "", name ? ":" : "",
+	       (cov_matrix == 'c') ? "cov" : "corr", i);
+      }
+      for (j = 0; j < c; j++) {
+	if (cov_matrix == 'c') {
+	  printf(" %g", cov->cov(i, j));	// Often tiny
+	} else {
+	  printf(" %f", cov->corr(i, j));
+	}
+      }
+      printf("\n");
+    }
+  }
+}  // print_channels()
+
@@ -0,0 +1,211 @@
+//////////////////////////////////////////////////////////////////////
+//
+// File: limitcheck.cc
+//
+// Copyright 2016 International Computer Science Institute
+// See the file LICENSE for licensing terms.
+//
+// Regression check for the iamix peak limiter (sndlimit.cc). Runs
+// the limiter over test signals, fed in blocks of random size, and
+// compares every output sample with the s/m/h formulas at the top of
+// sndlimit.cc, worked out the slow way for each frame. Prints the
+// number of mismatches for each case, and exits with 1 if there are
+// any.
+//
+// The signals include a decaying passage, where the peak gain rises
+// on every frame for longer than the look-ahead, which is the worst
+// case for the sliding minimum.
+//
+// Not built by default. Use "make limitcheck".
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "sndsimd.h"
+#include "sndlimit.h"
+
+char* ProgName;
+
+static long Frames = 20000;
+
+void usage();
+static void make_signal(float* x, long frames, int channels, int kind);
+static long check(const float* x, long frames, int channels, long look, float ceiling,
+		  double release);
+
+int main(int argc, char** argv) {
+  const int chans[] = { 1, 2, 3 };
+  const long looks[] = { 1, 2, 4, 37, 480 };
+  const double releases[] = { 0.0, 10.0, 2000.0 };
+  int c, ci, li, ri, kind;
+  long bad, total = 0;
+  float* x;
+  extern char *optarg;
+
+  ProgName = argv[0];
+
+  while ((c = getopt(argc, argv, "hn:")) != EOF) {
+    switch (c) {
+    case 'n':
+      Frames = atol(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (Frames <= 0) {
+    usage();
+  }
+
+  // The case from the report: 20 frames of falling level, L = 4
+
+  x = new float[20];
+  for (long j = 0; j < 20; j++) {
+    x[j] = 1.0 - 0.04 * j;
+  }
+  bad = check(x, 20, 1, 4, 0.5, 0.0);
+  printf("%-32s %ld\n", "decay, 1 channel, L 4", bad);
+  total += bad;
+  delete [] x;
+
+  x = new float[Frames * 3];
+  for (kind = 0; kind < 2; kind++) {
+    for (ci = 0; ci < (int) (sizeof(chans) / sizeof(chans[0])); ci++) {
+      make_signal(x, Frames, chans[ci], kind);
+      for (li = 0; li < (int) (sizeof(looks) / sizeof(looks[0])); li++) {
+	for (ri = 0; ri < (int) (sizeof(releases) / sizeof(releases[0])); ri++) {
+	  bad = check(x, Frames, chans[ci], looks[li], 0.5, releases[ri]);
+	  printf("%-6s %d ch, L %3ld, release %6g  %ld\n", kind ? "decay" : "bursts",
+		 chans[ci], looks[li], releases[ri], bad);
+	  total += bad;
+	}
+      }
+    }
+  }
+  delete [] x;
+
+  printf("%ld mismatches\n", total);
+  return (total > 0) ? 1 : 0;
+}  // main()
+
+void usage() {
+  fprintf(stderr, "\nUsage: %s [-n frames]\n\n", ProgName);
+  fprintf(stderr, " -n frames   Length of each test signal [%ld]\n\n", Frames);
+  exit(1);
+}  // usage()
+
+//
+// kind 0 is noise with loud bursts. kind 1 is a train of notes, each
+// starting loud and decaying over a few hundred frames.
+//
+
+static void make_signal(float* x, long frames, int channels, int kind) {
+  long j;
+  int c;
+  float level;
+
+  srandom(1);
+  for (j = 0; j < frames; j++) {
+    if (kind == 0) {
+      level = (random() % 50 == 0) ? 2.0 : 0.3;
+    } else {
+      level = 1.5 * exp(-(j % 700) / 150.0);
+    }
+    for (c = 0; c < channels; c++) {
+      x[j * channels + c] = level * ((random() / (float) RAND_MAX) * 2.0 - 1.0);
+    }
+  }
+}  // make_signal()
+
+//
+// Returns the number of output samples that differ from the formulas.
+//
+
+static long check(const float* x, long frames, int channels, long look, float ceiling,
+		  double release) {
+  long total = frames + look - 1;
+  float* in = new float[total * channels];
+  float* out = new float[frames * channels];
+  float* buf = new float[frames * channels];
+  float* r = new float[total];
+  double* m = new double[total];
+  double rel, h, state, want;
+  float g;
+  long j, i, k, n, got, done, bad;
+  limiter lim(channels, look, ceiling, release);
+
+  // Feed the limiter in blocks of random size, then flush it.
+
+  srandom(look * 7 + channels);
+  done = 0;
+  for (j = 0; j < frames; j += n) {
+    n = 1 + random() % 300;
+    if (n > frames - j) n = frames - j;
+    for (i = 0; i < n * channels; i++) {
+      buf[i] = x[j * channels + i];
+    }
+    got = lim.process(buf, n);
+    for (i = 0; i < got * channels; i++) {
+      out[done * channels + i] = buf[i];
+    }
+    done += got;
+  }
+  while ((got = lim.flush(buf, 1 + random() % 300)) > 0) {
+    for (i = 0; i < got * channels; i++) {
+      out[done * channels + i] = buf[i];
+    }
+    done += got;
+  }
+  if (done != frames) {
+    fprintf(stderr, "%s: got %ld frames back, not %ld\n", ProgName, done, frames);
+    exit(1);
+  }
+
+  // The same thing by brute force. Frames before the start have a
+  // peak gain of 1, and the padding at the end is silence.
+
+  for (i = 0; i < total * channels; i++) {
+    in[i] = (i < frames * channels) ? x[i] : 0.0;
+  }
+  peak_gains(in, total, channels, ceiling, r);
+  rel = (release > 0.0) ? 1.0 - exp(-1.0 / release) : 1.0;
+  state = 1.0;
+  for (k = 0; k < total; k++) {
+    g = 1.0;
+    for (i = k - look + 1; i <= k; i++) {
+      if (i >= 0 && r[i] < g) g = r[i];
+    }
+    state += (1.0 - state) * rel;
+    if (g < state) state = g;
+    m[k] = state;
+  }
+
+  bad = 0;
+  for (k = look - 1; k < total; k++) {
+    j = k - look + 1;
+    h = 0.0;
+    for (i = k - look + 1; i <= k; i++) {
+      h += (i >= 0) ? m[i] : 1.0;
+    }
+    h /= look;
+    if (h > r[j]) h = r[j];
+    for (i = 0; i < channels; i++) {
+      want = x[j * channels + i] * h;
+      if (want > ceiling) want = ceiling;
+      if (want < -ceiling) want = -ceiling;
+      if (fabs(out[j * channels + i] - want) > 1e-5 * (fabs(want) + 1e-3)) {
+	bad++;
+      }
+    }
+  }
+
+  delete [] in;
+  delete [] out;
+  delete [] buf;
+  delete [] r;
+  delete [] m;
+  return bad;
+}  // check()
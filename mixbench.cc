@@ -0,0 +1,133 @@
+//////////////////////////////////////////////////////////////////////
+//
+// File: mixbench.cc
+//
+// Copyright 2016 International Computer Science Institute
+// See the file LICENSE for licensing terms.
+//
+// Microbenchmark for the iamix accumulation kernel (mix_accumulate()
+// in sndsimd.cc). For 2, 8, 32 and 128 inputs, and for every
+// instruction set level the CPU supports, report the memory traffic
+// of the kernel in GB/s. Traffic counts each input block read once
+// and the output block written once.
+//
+// Not built by default. Use "make mixbench".
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "sndsimd.h"
+
+char* ProgName;
+
+static long BlockSize = 8192;
+static float MinTime = 0.5;
+
+void usage();
+static double now();
+static double bench(int nin, float** in, const long* lens, const float* scales,
+		    float* out);
+
+int main(int argc, char** argv) {
+  const int ninputs[] = { 2, 8, 32, 128 };
+  const int ntests = sizeof(ninputs) / sizeof(ninputs[0]);
+  int c, t, i, level, maxlevel;
+  long j;
+  float** in;
+  long* lens;
+  float* scales;
+  float* out;
+  extern char *optarg;
+
+  ProgName = argv[0];
+
+  while ((c = getopt(argc, argv, "b:ht:")) != EOF) {
+    switch (c) {
+    case 'b':
+      BlockSize = atol(optarg);
+      break;
+    case 't':
+      MinTime = atof(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (BlockSize <= 0 || MinTime <= 0.0) {
+    usage();
+  }
+
+  maxlevel = simd_level();
+  in = new float*[ninputs[ntests-1]];
+  lens = new long[ninputs[ntests-1]];
+  scales = new float[ninputs[ntests-1]];
+  out = new float[BlockSize];
+  for (i = 0; i < ninputs[ntests-1]; i++) {
+    in[i] = new float[BlockSize];
+    for (j = 0; j < BlockSize; j++) {
+      in[i][j] = (random() / (float) RAND_MAX) - 0.5;
+    }
+    lens[i] = BlockSize;
+    scales[i] = 0.5 + i / 256.0;
+  }
+
+  printf("%8s", "inputs");
+  for (level = SIMD_SCALAR; level <= maxlevel; level++) {
+    printf(" %10s", simd_name(level));
+  }
+  printf("   (GB/s, block of %ld samples)\n", BlockSize);
+
+  for (t = 0; t < ntests; t++) {
+    printf("%8d", ninputs[t]);
+    for (level = SIMD_SCALAR; level <= maxlevel; level++) {
+      simd_set_level(level);
+      printf(" %10.2f", bench(ninputs[t], in, lens, scales, out));
+      fflush(stdout);
+    }
+    printf("\n");
+  }
+
+  for (i = 0; i < ninputs[ntests-1]; i++) {
+    delete [] in[i];
+  }
+  delete [] in;
+  delete [] lens;
+  delete [] scales;
+  delete [] out;
+  return 0;
+}  // main()
+
+void usage() {
+  fprintf(stderr, "\nUsage: %s -b blocksize -t mintime\n\n", ProgName);
+  fprintf(stderr, " -b size     Samples per block [%ld]\n", BlockSize);
+  fprintf(stderr, " -t time     Minimum seconds to run each measurement [%f]\n\n", MinTime);
+  exit(1);
+}  // usage()
+
+static double now() {
+  struct timeval tp;
+  gettimeofday(&tp, NULL);
+  return tp.tv_sec + tp.tv_usec * 1e-6;
+}  // now()
+
+//
+// Run the kernel until MinTime has passed and return GB/s.
+//
+
+static double bench(int nin, float** in, const long* lens, const float* scales,
+		    float* out) {
+  long iters = 0;
+  double start, elapsed;
+
+  start = now();
+  do {
+    mix_accumulate(out, BlockSize, nin, in, lens, scales);
+    iters++;
+    elapsed = now() - start;
+  } while (elapsed < MinTime);
+
+  return iters * (nin + 1.0) * BlockSize * sizeof(float) / elapsed / 1e9;
+}  // bench()
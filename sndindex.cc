@@ -0,0 +1,383 @@
+//////////////////////////////////////////////////////////////////////
+//
+// File: sndindex.cc
+//
+// Copyright 2016 International Computer Science Institute
+// See the file LICENSE for licensing terms.
+//
+// A pyramid of jstat totals over fixed blocks of a sound file, kept in
+// a sidecar file next to it (foo.wav.iax) so that it's built once.
+// Level 0 has a block per SNDINDEX_BLOCK frames, and each level above
+// merges SNDINDEX_FANOUT blocks of the one below, up to a single block
+// for the whole file.
+//
+// A range of frames is answered by reading the partial blocks at its
+// ends from the file, and covering the rest from the bottom up: at
+// each level, the blocks that don't line up with a block of the next
+// level are merged in, and the rest is left to that level. That's at
+// most 2 * (SNDINDEX_FANOUT - 1) blocks per level, so the cost
+// doesn't depend on the length of the range.
+//
+// The sidecar records the size and modification time of the file it
+// was built from, and is rebuilt if either has changed.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include <sndfile.h>
+
+#include "sndindex.h"
+
+extern char *ProgName;
+
+static const char sndindex_magic[4] = { 'I', 'A', 'I', 'X' };
+#define SNDINDEX_VERSION (1)
+
+//
+// Blocks at each level for a file of the given length. Returns the
+// number of levels, or 0 if there would be too many (corrupt header).
+//
+
+static int sndindex_shape(long long frames, long* nblocks, int max) {
+  int levels = 1;
+
+  nblocks[0] = (long) ((frames + SNDINDEX_BLOCK - 1) / SNDINDEX_BLOCK);
+  while (nblocks[levels - 1] > 1) {
+    if (levels == max) {
+      return 0;
+    }
+    nblocks[levels] = (nblocks[levels - 1] + SNDINDEX_FANOUT - 1) / SNDINDEX_FANOUT;
+    levels++;
+  }
+  return levels;
+}  // sndindex_shape()
+
+static sndindex* sndindex_alloc(long long frames) {
+  long nblocks[64];
+  sndindex* ix;
+  int l, levels;
+
+  if (frames < 0 || (levels = sndindex_shape(frames, nblocks, 64)) == 0) {
+    return NULL;
+  }
+  ix = new sndindex;
+  memset(&ix->head, 0, sizeof(ix->head));
+  memcpy(ix->head.magic, sndindex_magic, sizeof(sndindex_magic));
+  ix->head.version = SNDINDEX_VERSION;
+  ix->head.frames = frames;
+  ix->head.block = SNDINDEX_BLOCK;
+  ix->head.fanout = SNDINDEX_FANOUT;
+  ix->head.levels = levels;
+  ix->level = new sndindex_block*[levels];
+  ix->nblocks = new long[levels];
+  for (l = 0; l < levels; l++) {
+    ix->nblocks[l] = nblocks[l];
+    ix->level[l] = new sndindex_block[nblocks[l] > 0 ? nblocks[l] : 1];
+  }
+  return ix;
+}  // sndindex_alloc()
+
+static void sndindex_free(sndindex* ix) {
+  int l;
+
+  for (l = 0; l < ix->head.levels; l++) {
+    delete [] ix->level[l];
+  }
+  delete [] ix->level;
+  delete [] ix->nblocks;
+  delete ix;
+}  // sndindex_free()
+
+static void block_set(sndindex_block* b, jstat& stat) {
+  long long n;
+  stat.get(&n, &b->mean, &b->m2, &b->min, &b->max);
+  b->n = n;
+}  // block_set()
+
+static void block_merge(jstat* stat, const sndindex_block* b) {
+  jstat tmp;
+  tmp.set(b->n, b->mean, b->m2, b->min, b->max);
+  stat->merge(tmp);
+}  // block_merge()
+
+//
+// Read the sidecar, if there is one and it matches the file.
+//
+
+static sndindex* sndindex_load(const char* iname, const struct stat* st, long long mtime) {
+  sndindex_header head;
+  sndindex* ix;
+  FILE* fp;
+  int l, ok;
+
+  if ((fp = fopen(iname, "rb")) == NULL) {
+    return NULL;
+  }
+  if (fread(&head, sizeof(head), 1, fp) != 1
+      || memcmp(head.magic, sndindex_magic, sizeof(sndindex_magic))
+      || head.version != SNDINDEX_VERSION
+      || head.size != (int64_t) st->st_size || head.mtime != mtime
+      || head.block != SNDINDEX_BLOCK || head.fanout != SNDINDEX_FANOUT
+      || (ix = sndindex_alloc(head.frames)) == NULL) {
+    fclose(fp);
+    return NULL;
+  }
+  ok = (ix->head.levels == head.levels);
+  ix->head = head;
+  for (l = 0; ok && l < head.levels; l++) {
+    ok = (fread(ix->level[l], sizeof(sndindex_block), ix->nblocks[l], fp)
+	  == (size_t) ix->nblocks[l]);
+  }
+  ok = ok && getc(fp) == EOF;
+  fclose(fp);
+  if (!ok) {
+    sndindex_free(ix);
+    return NULL;
+  }
+  return ix;
+}  // sndindex_load()
+
+//
+// One pass over the file for level 0, then each level from the one
+// below.
+//
+
+static sndindex* sndindex_build(const char* fname) {
+  SNDFILE* in;
+  SF_INFO info;
+  sndindex* ix;
+  float* buf;
+  long k, j, nread;
+  int l;
+  jstat stat;
+
+  if ((in = sf_open(fname, SFM_READ, &info)) == NULL) {
+    return NULL;
+  }
+  if ((ix = sndindex_alloc(info.frames)) == NULL) {
+    sf_close(in);
+    return NULL;
+  }
+  ix->head.channels = info.channels;
+  ix->head.samplerate = info.samplerate;
+
+  buf = new float[SNDINDEX_BLOCK * info.channels];
+  for (k = 0; k < ix->nblocks[0]; k++) {
+    nread = sf_readf_float(in, buf, SNDINDEX_BLOCK);
+    if (nread <= 0) {
+      break;
+    }
+    stat.clear();
+    stat.data(buf, nread * info.channels);
+    block_set(&ix->level[0][k], stat);
+    if (nread < SNDINDEX_BLOCK && k < ix->nblocks[0] - 1) {
+      break;
+    }
+  }
+  delete [] buf;
+  sf_close(in);
+
+  if (k < ix->nblocks[0]) {
+    // Shorter than the header said
+    sndindex_free(ix);
+    return NULL;
+  }
+
+  for (l = 1; l < ix->head.levels; l++) {
+    for (k = 0; k < ix->nblocks[l]; k++) {
+      stat.clear();
+      for (j = k * SNDINDEX_FANOUT;
+	   j < (k + 1) * SNDINDEX_FANOUT && j < ix->nblocks[l - 1]; j++) {
+	block_merge(&stat, &ix->level[l - 1][j]);
+      }
+      block_set(&ix->level[l][k], stat);
+    }
+  }
+  return ix;
+}  // sndindex_build()
+
+//
+// Write to a temporary file and rename it into place, so a reader
+// never sees half an index. The temporary name is unique, since
+// threads of one process may build the index of the same file at
+// once (e.g. iamix -B jobs that share an input). mkstemp() makes the
+// file private, so it gets the usual permissions before the rename.
+//
+
+static void sndindex_save(sndindex* ix, const char* iname) {
+  char tmp[4096 + 16];
+  FILE* fp;
+  int fd, l, ok;
+
+  snprintf(tmp, sizeof(tmp), "%s.XXXXXX", iname);
+  if ((fd = mkstemp(tmp)) == -1) {
+    return;
+  }
+  if (fchmod(fd, 0644) != 0 || (fp = fdopen(fd, "wb")) == NULL) {
+    close(fd);
+    unlink(tmp);
+    return;
+  }
+  ok = (fwrite(&ix->head, sizeof(ix->head), 1, fp) == 1);
+  for (l = 0; ok && l < ix->head.levels; l++) {
+    ok = (fwrite(ix->level[l], sizeof(sndindex_block), ix->nblocks[l], fp)
+	  == (size_t) ix->nblocks[l]);
+  }
+  if (fclose(fp) != 0) {
+    ok = 0;
+  }
+  if (!ok || rename(tmp, iname) != 0) {
+    unlink(tmp);
+  }
+}  // sndindex_save()
+
+sndindex* sndindex_open(const char* fname, int build) {
+  char iname[4096];
+  struct stat st;
+  long long mtime;
+  sndindex* ix;
+
+  if (stat(fname, &st) != 0 || !S_ISREG(st.st_mode)) {
+    return NULL;
+  }
+  mtime = (long long) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  snprintf(iname, sizeof(iname), "%s%s", fname, SNDINDEX_SUFFIX);
+
+  if ((ix = sndindex_load(iname, &st, mtime)) != NULL || !build) {
+    return ix;
+  }
+  if ((ix = sndindex_build(fname)) == NULL) {
+    return NULL;
+  }
+  ix->head.size = st.st_size;
+  ix->head.mtime = mtime;
+  sndindex_save(ix, iname);
+  return ix;
+}  // sndindex_open()
+
+void sndindex_close(sndindex* ix) {
+  if (ix) {
+    sndindex_free(ix);
+  }
+}  // sndindex_close()
+
+const sndindex_block* sndindex_level(sndindex* ix, int level, long* nblocks) {
+  if (level < 0 || level >= ix->head.levels) {
+    return NULL;
+  }
+  *nblocks = ix->nblocks[level];
+  return ix->level[level];
+}  // sndindex_level()
+
+jstat* sndindex_range(sndindex* ix, SNDFILE* in, SF_INFO* info, const char* fname,
+		      long start, long end, jstat* stat) {
+  long frames = ix->head.frames;
+  long lo, hi;
+  int l;
+  jstat* mine = NULL;
+
+  if (stat == 0) {
+    stat = mine = new jstat();
+  }
+
+  // The index is of the file as it was opened by sndindex_open(). If
+  // in doesn't look like the same file, read it all.
+
+  if (info->frames != frames || info->channels != ix->head.channels) {
+    if (sndstat_range(in, info, fname, start, end, stat) == NULL) {
+      delete mine;
+      return NULL;
+    }
+    return stat;
+  }
+
+  if (end < 0 || end > frames) {
+    end = frames;
+  }
+  if (start < 0) {
+    start = 0;
+  }
+  if (start >= end) {
+    return stat;
+  }
+
+  // Whole blocks lo through hi-1. The last block counts as whole if
+  // the range runs to the end of the file.
+
+  lo = (start + SNDINDEX_BLOCK - 1) / SNDINDEX_BLOCK;
+  hi = (end == frames) ? ix->nblocks[0] : end / SNDINDEX_BLOCK;
+  if (lo >= hi) {
+    if (sndstat_range(in, info, fname, start, end, stat) == NULL) {
+      delete mine;
+      return NULL;
+    }
+    return stat;
+  }
+  if ((start < lo * SNDINDEX_BLOCK
+       && sndstat_range(in, info, fname, start, lo * SNDINDEX_BLOCK, stat) == NULL)
+      || (hi * SNDINDEX_BLOCK < end
+	  && sndstat_range(in, info, fname, hi * SNDINDEX_BLOCK, end, stat) == NULL)) {
+    delete mine;
+    return NULL;
+  }
+
+  for (l = 0; lo < hi; l++) {
+    if (l == ix->head.levels - 1) {
+      while (lo < hi) {
+	block_merge(stat, &ix->level[l][lo++]);
+      }
+      break;
+    }
+    while (lo < hi && lo % SNDINDEX_FANOUT) {
+      block_merge(stat, &ix->level[l][lo++]);
+    }
+    while (hi > lo && hi % SNDINDEX_FANOUT) {
+      block_merge(stat, &ix->level[l][--hi]);
+    }
+    lo /= SNDINDEX_FANOUT;
+    hi /= SNDINDEX_FANOUT;
+  }
+  return stat;
+}  // sndindex_range()
+
+jstat* sndindex_random(sndindex* ix, SNDFILE* in, SF_INFO* info, const char* fname,
+		       float random_sample, float random_size, jstat* stat,
+		       unsigned long long seed) {
+  long size, count, k;
+  long* starts;
+  jstat* mine = NULL;
+
+  if (stat == 0) {
+    stat = mine = new jstat();
+  }
+
+  size = (long) (info->samplerate * random_size);
+  if (size < 1) size = 1;
+  count = (long) ceil(info->samplerate * random_sample / size);
+
+  if (count * size >= info->frames) {
+    if (sndindex_range(ix, in, info, fname, 0, -1, stat) == NULL) {
+      delete mine;
+      return NULL;
+    }
+    return stat;
+  }
+
+  starts = new long[count];
+  sndstat_strata(info->frames, size, count, seed, starts);
+  for (k = 0; k < count; k++) {
+    if (sndindex_range(ix, in, info, fname, starts[k], starts[k] + size, stat) == NULL) {
+      delete [] starts;
+      delete mine;
+      return NULL;
+    }
+  }
+  delete [] starts;
+
+  return stat;
+}  // sndindex_random()
@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////////////
+//
+// File: sndindex.h
+//
+// Copyright 2016 International Computer Science Institute
+// See the file LICENSE for licensing terms.
+//
+// Sidecar index of block statistics, for the statistics of any range
+// of a sound file without decoding all of it. See sndindex.cc
+//
+
+#ifndef SNDINDEX_H
+#define SNDINDEX_H
+
+#include <stdint.h>
+#include <sndfile.h>
+
+#include "sndstats.h"
+
+#define SNDINDEX_SUFFIX ".iax"
+#define SNDINDEX_BLOCK (1024)	//  Frames per block at level 0
+#define SNDINDEX_FANOUT (16)	//  Blocks of level l in one of level l+1
+
+//
+// The index file, in native byte order, is a header followed by the
+// blocks of each level in turn, from level 0 up to a level with a
+// single block. Block k of level l covers frames
+// k*SNDINDEX_BLOCK*SNDINDEX_FANOUT^l onwards (the last block of each
+// level may be short), over all channels.
+//
+
+struct sndindex_header {
+  char    magic[4];		//  "IAIX"
+  int32_t version;		//  1
+  int64_t size;			//  Of the sound file, in bytes
+  int64_t mtime;		//  Of the sound file, in nanoseconds
+  int64_t frames;
+  int32_t channels;
+  int32_t samplerate;
+  int32_t block;		//  SNDINDEX_BLOCK
+  int32_t fanout;		//  SNDINDEX_FANOUT
+  int32_t levels;
+  int32_t pad;
+};
+
+struct sndindex_block {
+  int64_t n;			//  As jstat: number of samples,
+  double  mean;			//  mean,
+  double  m2;			//  sum of squared deviations from the mean,
+  double  min;			//  and extremes
+  double  max;
+};
+
+struct sndindex {
+  sndindex_header  head;
+  sndindex_block** level;	//  level[l] has nblocks[l] blocks
+  long*            nblocks;
+};
+
+// The index of fname, read from its sidecar if that is up to date
+// with the file, otherwise (if build is set) built with one pass over
+// the file and saved, if the directory is writable. NULL if there's no
+// index to be had.
+sndindex* sndindex_open(const char* fname, int build);
+void sndindex_close(sndindex*);
+
+// The blocks of one level, e.g. for drawing an overview of the file
+// (level 0 is the finest). Sets *nblocks, or returns NULL if there's
+// no such level.
+const sndindex_block* sndindex_level(sndindex* ix, int level, long* nblocks);
+
+// Add the statistics of frames start through end-1 (to the end of the
+// file if end is negative) to stat, like sndstat_range(): whole blocks
+// come from the index, and only the partial blocks at either end are
+// read from in. NULL if a seek fails, as for sndstat_range().
+jstat* sndindex_range(sndindex* ix, SNDFILE* in, SF_INFO* info, const char* fname,
+		      long start, long end = -1, jstat* stat = 0);
+
+// The excerpts sndstat_random() would read, each by sndindex_range().
+jstat* sndindex_random(sndindex* ix, SNDFILE* in, SF_INFO* info, const char* fname,
+		       float random_sample, float random_size, jstat* stat = 0,
+		       unsigned long long seed = 0);
+
+#endif // SNDINDEX_H
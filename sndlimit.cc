@@ -0,0 +1,195 @@
+//////////////////////////////////////////////////////////////////////
+//
+// File: sndlimit.cc
+//
+// Copyright 2016 International Computer Science Institute
+// See the file LICENSE for licensing terms.
+//
+// Streaming look-ahead peak limiter.
+//
+// Each frame k has a peak gain r[k], the largest gain (at most 1)
+// that keeps all of its channels within the ceiling. With L frames of
+// look-ahead the limiter computes
+//
+//   s[k] = min(r[k-L+1], ..., r[k])      sliding minimum
+//   m[k] = min(s[k], m[k-1] + (1 - m[k-1]) * release)
+//   h[k] = (m[k-L+1] + ... + m[k]) / L   moving average
+//
+// and outputs frame k-L+1 scaled by h[k]. Every term of the average
+// is at most r[k-L+1], so the output never exceeds the ceiling, while
+// the average turns the steps of the minimum into ramps L frames
+// long that finish just as the peak arrives. The release recursion
+// only ever lowers m, so it slows the recovery after a peak without
+// affecting the bound.
+//
+// The delay line holds L-1 frames, and the output has exactly as many
+// frames as the input.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "sndlimit.h"
+#include "sndsimd.h"
+
+limiter::limiter(int channels, long lookahead, float ceiling, double release) {
+  long i;
+
+  if (lookahead < 1) lookahead = 1;
+  if (release < 0.0) release = 0.0;
+  channels_ = channels;
+  look_ = lookahead;
+  delay_ = lookahead - 1;
+  ceiling_ = ceiling;
+  release_ = (release > 0.0) ? 1.0 - exp(-1.0 / release) : 1.0;
+
+  hist_ = new float[delay_ * channels_];
+  rhist_ = new float[delay_];
+  memset(hist_, 0, delay_ * channels_ * sizeof(float));
+  for (i = 0; i < delay_; i++) {
+    rhist_[i] = 1.0;
+  }
+  work_ = NULL;
+  rwork_ = NULL;
+  gains_ = NULL;
+  cap_ = 0;
+
+  minval_ = new float[look_];
+  minpos_ = new long[look_];
+  minhead_ = 0;
+  mincount_ = 0;
+
+  state_ = 1.0;
+  box_ = new double[look_];
+  for (i = 0; i < look_; i++) {
+    box_[i] = 1.0;
+  }
+  boxpos_ = 0;
+  boxsum_ = look_;
+
+  pos_ = 0;
+  skip_ = delay_;
+  pending_ = -1;
+  reduced_ = 0;
+  mingain_ = 1.0;
+}  // limiter()
+
+limiter::~limiter() {
+  delete [] hist_;
+  delete [] rhist_;
+  delete [] work_;
+  delete [] rwork_;
+  delete [] gains_;
+  delete [] minval_;
+  delete [] minpos_;
+  delete [] box_;
+}  // ~limiter()
+
+void limiter::reserve(long n) {
+  if (n <= cap_) {
+    return;
+  }
+  delete [] work_;
+  delete [] rwork_;
+  delete [] gains_;
+  cap_ = n;
+  work_ = new float[(delay_ + cap_) * channels_];
+  rwork_ = new float[delay_ + cap_];
+  gains_ = new float[cap_];
+}  // reserve()
+
+long limiter::process(float* buf, long n) {
+  long j, k, tail, m;
+  float r, g;
+  double h;
+
+  if (n <= 0) {
+    return 0;
+  }
+  reserve(n);
+
+  // Line the new frames up behind the delayed ones.
+
+  memcpy(work_, hist_, delay_ * channels_ * sizeof(float));
+  memcpy(work_ + delay_ * channels_, buf, n * channels_ * sizeof(float));
+  memcpy(rwork_, rhist_, delay_ * sizeof(float));
+  peak_gains(buf, n, channels_, ceiling_, rwork_ + delay_);
+
+  for (j = 0; j < n; j++) {
+    k = pos_ + j;
+    r = rwork_[delay_ + j];
+
+    // Sliding minimum: drop the oldest entry once it leaves the
+    // window, and any that can never be the minimum again. The
+    // expired one has to go first, since the queue only has room for
+    // look_ frames including this one.
+
+    if (mincount_ > 0 && minpos_[minhead_] <= k - look_) {
+      minhead_ = (minhead_ + 1) % look_;
+      mincount_--;
+    }
+    while (mincount_ > 0
+	   && minval_[(minhead_ + mincount_ - 1) % look_] >= r) {
+      mincount_--;
+    }
+    tail = (minhead_ + mincount_) % look_;
+    minval_[tail] = r;
+    minpos_[tail] = k;
+    mincount_++;
+
+    state_ += (1.0 - state_) * release_;
+    if (minval_[minhead_] < state_) {
+      state_ = minval_[minhead_];
+    }
+
+    boxsum_ += state_ - box_[boxpos_];
+    box_[boxpos_] = state_;
+    boxpos_ = (boxpos_ + 1) % look_;
+    h = boxsum_ / look_;
+
+    // The running sum can drift by an ulp or so. Never let that
+    // take the gain above the delayed frame's own peak gain.
+
+    g = (h < rwork_[j]) ? h : rwork_[j];
+    gains_[j] = g;
+  }
+
+  memcpy(buf, work_, n * channels_ * sizeof(float));
+  apply_gains(buf, n, channels_, gains_, ceiling_);
+  memcpy(hist_, work_ + n * channels_, delay_ * channels_ * sizeof(float));
+  memcpy(rhist_, rwork_ + n, delay_ * sizeof(float));
+  pos_ += n;
+
+  // The first delay_ output frames are from before the start.
+
+  m = (skip_ < n) ? skip_ : n;
+  if (m > 0) {
+    memmove(buf, buf + m * channels_, (n - m) * channels_ * sizeof(float));
+    skip_ -= m;
+  }
+  for (j = m; j < n; j++) {
+    if (gains_[j] < 1.0) {
+      reduced_++;
+      if (gains_[j] < mingain_) mingain_ = gains_[j];
+    }
+  }
+  return n - m;
+}  // process()
+
+long limiter::flush(float* buf, long maxn) {
+  long n, out;
+
+  if (pending_ < 0) {
+    pending_ = delay_;
+  }
+  out = 0;
+  while (out == 0 && pending_ > 0) {
+    n = (pending_ < maxn) ? pending_ : maxn;
+    memset(buf, 0, n * channels_ * sizeof(float));
+    pending_ -= n;
+    out = process(buf, n);
+  }
+  return out;
+}  // flush()
@@ -0,0 +1,68 @@
+//////////////////////////////////////////////////////////////////////
+//
+// File: sndlimit.h
+//
+// Copyright 2016 International Computer Science Institute
+// See the file LICENSE for licensing terms.
+//
+// Streaming look-ahead peak limiter. See sndlimit.cc
+//
+
+#ifndef SNDLIMIT_H
+#define SNDLIMIT_H
+
+class limiter {
+public:
+
+  // lookahead is in frames (at least 1). release is the time constant
+  // of the gain recovery, in frames (0 for none).
+  limiter(int channels, long lookahead, float ceiling, double release);
+  ~limiter();
+
+  // Limit n interleaved frames in place. The output lags the input by
+  // lookahead-1 frames, so fewer than n frames come back at the
+  // start. Returns the number of output frames now in buf.
+  long process(float* buf, long n);
+
+  // After the last process(), write up to maxn of the delayed frames
+  // into buf. Returns the number written, 0 once all are out.
+  long flush(float* buf, long maxn);
+
+  long long reduced() { return reduced_; }	//  Frames with gain < 1
+  float     mingain() { return mingain_; }
+
+private:
+
+  void reserve(long n);
+
+  int    channels_;
+  long   look_;
+  long   delay_;		//  look_ - 1
+  float  ceiling_;
+  double release_;		//  Fraction of the way back to 1 per frame
+
+  float* hist_;			//  Last delay_ input frames
+  float* rhist_;		//  Their peak gains
+  float* work_;			//  hist_ followed by the new frames
+  float* rwork_;		//  rhist_ followed by the new peak gains
+  float* gains_;		//  Gain applied to each output frame
+  long   cap_;			//  Frames of new input work_ can hold
+
+  float* minval_;		//  Sliding minimum of the peak gains over the
+  long*  minpos_;		//  last look_ frames, as a monotonic queue
+  long   minhead_;		//  in a ring of look_ entries
+  long   mincount_;
+
+  double state_;		//  Sliding minimum after release smoothing
+  double* box_;		//  Last look_ values of state_
+  long   boxpos_;
+  double boxsum_;
+
+  long   pos_;			//  Input frames seen, including flush padding
+  long   skip_;			//  Output frames still to drop at the start
+  long   pending_;		//  Padding frames still to feed in flush()
+  long long reduced_;
+  float  mingain_;
+};  //  class limiter
+
+#endif // SNDLIMIT_H
@@ -0,0 +1,54 @@
+//////////////////////////////////////////////////////////////////////
+//
+// File: sndloud.h
+//
+// Copyright 2016 International Computer Science Institute
+// See the file LICENSE for licensing terms.
+//
+// Streaming K-weighted, gated loudness meter (ITU-R BS.1770). See
+// sndloud.cc
+//
+
+#ifndef SNDLOUD_H
+#define SNDLOUD_H
+
+class loudness {
+public:
+
+  loudness(int samplerate, int channels);
+  ~loudness();
+
+  // Feed n interleaved frames.
+  void add(const float* buf, long n);
+
+  // The next add() doesn't follow on from the last one (e.g. after a
+  // seek). Drops the filter state and any partial block, but keeps
+  // the blocks measured so far.
+  void restart();
+
+  // Gated integrated loudness in LUFS of everything fed so far, or
+  // -HUGE_VAL if no block gets past the absolute gate (silence).
+  double integrated();
+
+  long blocks() { return nblocks_; }	//  400 ms blocks measured
+
+private:
+
+  int     channels_;
+  long    step_;		//  Frames in 100 ms (a quarter block)
+
+  double  pb_[3], pa_[3];	//  Pre-filter (high shelf)
+  double  rb_[3], ra_[3];	//  RLB high-pass
+  double* state_;		//  Four filter state values per channel
+
+  double  stepsum_;		//  Sum of squares in the current step
+  long    steppos_;		//  Frames in the current step
+  double  steps_[4];		//  Sums of the last four whole steps
+  int     nsteps_;		//  Whole steps since restart()
+
+  double* energy_;		//  Mean square of each block
+  long    nblocks_;
+  long    maxblocks_;
+};  //  class loudness
+
+#endif // SNDLOUD_H
@@ -0,0 +1,217 @@
+//////////////////////////////////////////////////////////////////////
+//
+// File: sndresample.cc
+//
+// Copyright 2016 International Computer Science Institute
+// See the file LICENSE for licensing terms.
+//
+// Streaming polyphase sample rate conversion.
+//
+// The ratio outrate/inrate is reduced to L/M. Conceptually, the input
+// is upsampled by L (inserting zeros), lowpass filtered, and every Mth
+// sample is kept. The lowpass filter is a Kaiser-windowed sinc with
+// taps_ taps per phase, split into L phases so that only the taps
+// that land on real input samples are ever evaluated. Each output
+// sample is then one dot product of taps_ coefficients with the input
+// history.
+//
+// The output is aligned with the input (the filter delay is
+// compensated) and has ceil(inframes * L / M) frames.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "sndresample.h"
+#include "sndsimd.h"
+
+// Largest filter table we're willing to build, in coefficients.
+#define MAX_COEFS (1 << 22)
+
+static long gcd(long a, long b) {
+  long t;
+  while (b != 0) {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}  // gcd()
+
+// Zeroth order modified Bessel function, for the Kaiser window.
+
+static double bessel_i0(double x) {
+  double sum = 1.0, term = 1.0;
+  int k;
+  for (k = 1; k < 50; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+    if (term < sum * 1e-12) break;
+  }
+  return sum;
+}  // bessel_i0()
+
+resampler::resampler(int inrate, int outrate, int channels, int quality) {
+  // Taps per phase, Kaiser beta, and passband edge as a fraction of
+  // the lower Nyquist frequency for each preset.
+  static const int    qtaps[] = { 8, 24, 48 };
+  static const double qbeta[] = { 5.0, 8.0, 10.5 };
+  static const double qpass[] = { 0.85, 0.91, 0.95 };
+  long g, k, n, len, phase, j;
+  double center, fc, x, w;
+  double* h;
+
+  if (quality < RESAMPLE_FAST) quality = RESAMPLE_FAST;
+  if (quality > RESAMPLE_BEST) quality = RESAMPLE_BEST;
+
+  channels_ = channels;
+  g = gcd(inrate, outrate);
+  up_ = outrate / g;
+  down_ = inrate / g;
+  taps_ = qtaps[quality];
+  coefs_ = NULL;
+  buf_ = NULL;
+  inframes_ = 0;
+  outframes_ = 0;
+  finished_ = 0;
+
+  n = up_ * taps_;
+  if (inrate <= 0 || outrate <= 0 || n > MAX_COEFS) {
+    return;
+  }
+
+  // Prototype filter at the upsampled rate, with gain up_ to make up
+  // for the inserted zeros.
+
+  // The filter is given an odd length (the last tap is zero if n is
+  // even) so that its delay is a whole number of upsampled samples.
+
+  h = new double[n];
+  len = (n % 2 == 0) ? n - 1 : n;
+  center = (len - 1) / 2.0;
+  fc = qpass[quality] * 0.5 / (up_ > down_ ? up_ : down_);
+  for (k = 0; k < n; k++) {
+    if (k >= len) {
+      h[k] = 0.0;
+      continue;
+    }
+    x = k - center;
+    w = 1.0 - (2.0 * x / (len - 1)) * (2.0 * x / (len - 1));
+    w = bessel_i0(qbeta[quality] * sqrt(w > 0.0 ? w : 0.0)) / bessel_i0(qbeta[quality]);
+    h[k] = (x == 0.0) ? 2.0 * fc : sin(2.0 * M_PI * fc * x) / (M_PI * x);
+    h[k] *= w * up_;
+  }
+
+  // Split into phases, each reversed so that it lines up with the
+  // history in increasing time order.
+
+  coefs_ = new float[n];
+  for (phase = 0; phase < up_; phase++) {
+    for (j = 0; j < taps_; j++) {
+      coefs_[phase * taps_ + (taps_ - 1 - j)] = h[phase + j * up_];
+    }
+  }
+  delete [] h;
+  delay_ = (len - 1) / 2;
+
+  // Frames before the start of the input are silence.
+
+  bufsize_ = 4096 + taps_;
+  buf_ = new float[bufsize_ * channels_];
+  memset(buf_, 0, bufsize_ * channels_ * sizeof(float));
+  buflen_ = taps_ - 1;
+  bufstart_ = -(taps_ - 1);
+}  // resampler()
+
+resampler::~resampler() {
+  delete [] coefs_;
+  delete [] buf_;
+}  // ~resampler()
+
+int resampler::ok() {
+  return coefs_ != NULL;
+}  // ok()
+
+void resampler::write(const float* planes, long stride, long n) {
+  long keep, drop, c, newsize;
+  float* newbuf;
+
+  // Drop history the next output no longer needs.
+
+  keep = (long) ((outframes_ * down_ + delay_) / up_) - (taps_ - 1);
+  drop = keep - bufstart_;
+  if (drop > buflen_) drop = buflen_;
+  if (drop > 0) {
+    for (c = 0; c < channels_; c++) {
+      memmove(buf_ + c * bufsize_, buf_ + c * bufsize_ + drop,
+	      (buflen_ - drop) * sizeof(float));
+    }
+    bufstart_ += drop;
+    buflen_ -= drop;
+  }
+
+  if (buflen_ + n > bufsize_) {
+    newsize = 2 * (buflen_ + n);
+    newbuf = new float[newsize * channels_];
+    for (c = 0; c < channels_; c++) {
+      memcpy(newbuf + c * newsize, buf_ + c * bufsize_, buflen_ * sizeof(float));
+    }
+    delete [] buf_;
+    buf_ = newbuf;
+    bufsize_ = newsize;
+  }
+
+  for (c = 0; c < channels_; c++) {
+    if (planes) {
+      memcpy(buf_ + c * bufsize_ + buflen_, planes + c * stride, n * sizeof(float));
+    } else {
+      memset(buf_ + c * bufsize_ + buflen_, 0, n * sizeof(float));
+    }
+  }
+  buflen_ += n;
+  if (planes) {
+    inframes_ += n;
+  }
+}  // write()
+
+//
+// Pad with enough silence for the filter to run past the last input
+// frame. The padding isn't counted as input.
+//
+
+void resampler::finish() {
+  if (!finished_) {
+    write(NULL, 0, taps_ + 1);
+    finished_ = 1;
+  }
+}  // finish()
+
+long resampler::read(float* planes, long stride, long maxn) {
+  long n, c, phase, first;
+  long long t, base, total;
+
+  total = -1;
+  if (finished_) {
+    total = (inframes_ * up_ + down_ - 1) / down_;
+  }
+  for (n = 0; n < maxn; n++) {
+    if (total >= 0 && outframes_ >= total) {
+      break;
+    }
+    t = outframes_ * down_ + delay_;
+    base = t / up_;
+    phase = t % up_;
+    if (base >= bufstart_ + buflen_) {
+      break;			// Need more input
+    }
+    first = (long) (base - (taps_ - 1) - bufstart_);
+    for (c = 0; c < channels_; c++) {
+      planes[c * stride + n] = dot_product(coefs_ + phase * taps_,
+					   buf_ + c * bufsize_ + first, taps_);
+    }
+    outframes_++;
+  }
+  return n;
+}  // read()
@@ -0,0 +1,60 @@
+//////////////////////////////////////////////////////////////////////
+//
+// File: sndresample.h
+//
+// Copyright 2016 International Computer Science Institute
+// See the file LICENSE for licensing terms.
+//
+// Streaming sample rate conversion. See sndresample.cc
+//
+
+#ifndef SNDRESAMPLE_H
+#define SNDRESAMPLE_H
+
+// Quality presets, trading CPU for stopband attenuation and passband
+// width.
+
+enum {
+  RESAMPLE_FAST = 0,
+  RESAMPLE_MEDIUM,
+  RESAMPLE_BEST
+};
+
+class resampler {
+public:
+
+  resampler(int inrate, int outrate, int channels, int quality);
+  ~resampler();
+
+  int  ok();			//  0 if the rate ratio can't be handled
+
+  // Add n input frames. Channel c starts at planes + c*stride.
+  void write(const float* planes, long stride, long n);
+
+  void finish();		//  No more input will be written
+
+  // Produce up to maxn output frames into planar buffers. Returns
+  // the number produced, which is less than maxn only if more input
+  // is needed, or 0 at the end of the stream after finish().
+  long read(float* planes, long stride, long maxn);
+
+private:
+
+  int    channels_;
+  long   up_;			//  Interpolation factor L
+  long   down_;			//  Decimation factor M
+  int    taps_;			//  Filter taps per phase
+  float* coefs_;		//  up_ phases of taps_ coefficients each
+  long   delay_;		//  Filter delay, in upsampled samples
+
+  float* buf_;			//  channels_ histories of bufsize_ frames
+  long   bufsize_;
+  long   buflen_;		//  Frames held in each history
+  long   bufstart_;		//  Input frame index of buf_[0]
+
+  long long inframes_;		//  Input frames written so far
+  long long outframes_;		//  Output frames produced so far
+  int    finished_;
+};  //  class resampler
+
+#endif // SNDRESAMPLE_H
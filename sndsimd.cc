@@ -0,0 +1,1383 @@
+//////////////////////////////////////////////////////////////////////
+//
+// File: sndsimd.cc
+//
+// Copyright 2016 International Computer Science Institute
+// See the file LICENSE for licensing terms.
+//
+// Vectorized inner loops for the ia* tools. Each kernel has a plain C
+// version, which is always available, and SSE/AVX2/AVX-512 versions
+// that are compiled with gcc target attributes and picked at run time
+// according to what the CPU supports. The whole program can therefore
+// still be built for a generic x86-64.
+//
+// Contraction into fused multiply-adds is turned off so that every
+// level rounds exactly like the plain C loops.
+//
+
+#pragma GCC optimize ("fp-contract=off")
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "sndsimd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SNDSIMD_X86 1
+#include <immintrin.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////
+//
+// Defines
+//
+
+// mix_accumulate() works on tiles of the output small enough to stay
+// in L1 cache, and folds in MIX_GROUP inputs per pass over a tile.
+
+#define MIX_TILE (1024)
+#define MIX_GROUP (8)
+
+// pcm16_moments() keeps 32 bit partial sums, each of which grows by at
+// most 2^16 per vector. They are flushed every PCM16_FLUSH vectors.
+
+#define PCM16_FLUSH (1 << 14)
+
+//////////////////////////////////////////////////////////////////////
+//
+// Dispatch
+//
+
+static int Level = -1;		// Level in use. -1 until first needed.
+static int MaxLevel = -1;	// Best level the CPU supports.
+
+static int detect_level() {
+#ifdef SNDSIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+  if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+  if (__builtin_cpu_supports("sse2")) return SIMD_SSE;
+#endif
+  return SIMD_SCALAR;
+}  // detect_level()
+
+int simd_level() {
+  if (Level < 0) {
+    MaxLevel = detect_level();
+    Level = MaxLevel;
+  }
+  return Level;
+}  // simd_level()
+
+void simd_set_level(int level) {
+  simd_level();
+  if (level < SIMD_SCALAR) level = SIMD_SCALAR;
+  Level = (level < MaxLevel) ? level : MaxLevel;
+}  // simd_set_level()
+
+const char* simd_name(int level) {
+  switch (level) {
+  case SIMD_SCALAR: return "scalar";
+  case SIMD_SSE:    return "sse";
+  case SIMD_AVX2:   return "avx2";
+  case SIMD_AVX512: return "avx512";
+  }
+  return "unknown";
+}  // simd_name()
+
+//////////////////////////////////////////////////////////////////////
+//
+// mix_accumulate()
+//
+
+//
+// The original iamix loop. Clears the output, then makes one pass
+// over it per input.
+//
+
+static void mix_scalar(float* out, long n, int nin, const float* const* in,
+		       const long* lens, const float* scales) {
+  int i;
+  long j, len;
+
+  for (j = 0; j < n; j++) {
+    out[j] = 0.0;
+  }
+  for (i = 0; i < nin; i++) {
+    len = (lens[i] < n) ? lens[i] : n;
+    for (j = 0; j < len; j++) {
+      out[j] += in[i][j] * scales[i];
+    }
+  }
+}  // mix_scalar()
+
+//
+// Elements [from, n), where some inputs may have run out.
+//
+
+static void mix_tail(float* out, long from, long n, int nin,
+		     const float* const* in, const long* lens, const float* scales) {
+  int i;
+  long j;
+  float acc;
+
+  for (j = from; j < n; j++) {
+    acc = 0.0;
+    for (i = 0; i < nin; i++) {
+      if (j < lens[i]) {
+	acc += in[i][j] * scales[i];
+      }
+    }
+    out[j] = acc;
+  }
+}  // mix_tail()
+
+#ifdef SNDSIMD_X86
+
+//
+// The vector versions assume every input covers [0, n). They are
+// identical apart from the vector width, so they share one body.
+//
+
+#define MIX_KERNEL(VEC, WIDTH, ZERO, LOAD, STORE, SET1, ADD, MUL)	\
+  long t, tend, j;							\
+  int i, g, gend;							\
+  float acc;								\
+  VEC sv[MIX_GROUP];							\
+  VEC vacc;								\
+									\
+  for (t = 0; t < n; t += MIX_TILE) {					\
+    tend = (t + MIX_TILE < n) ? t + MIX_TILE : n;			\
+    for (g = 0; g < nin; g += MIX_GROUP) {				\
+      gend = (g + MIX_GROUP < nin) ? g + MIX_GROUP : nin;		\
+      for (i = g; i < gend; i++) {					\
+	sv[i - g] = SET1(scales[i]);					\
+      }									\
+      for (j = t; j + WIDTH <= tend; j += WIDTH) {			\
+	vacc = (g == 0) ? ZERO() : LOAD(out + j);			\
+	for (i = g; i < gend; i++) {					\
+	  vacc = ADD(vacc, MUL(LOAD(in[i] + j), sv[i - g]));		\
+	}								\
+	STORE(out + j, vacc);						\
+      }									\
+      for (; j < tend; j++) {						\
+	acc = (g == 0) ? 0.0f : out[j];					\
+	for (i = g; i < gend; i++) {					\
+	  acc += in[i][j] * scales[i];					\
+	}								\
+	out[j] = acc;							\
+      }									\
+    }									\
+  }
+
+__attribute__((target("sse2")))
+static void mix_sse(float* out, long n, int nin, const float* const* in,
+		    const float* scales) {
+  MIX_KERNEL(__m128, 4, _mm_setzero_ps, _mm_loadu_ps, _mm_storeu_ps,
+	     _mm_set1_ps, _mm_add_ps, _mm_mul_ps)
+}  // mix_sse()
+
+__attribute__((target("avx2")))
+static void mix_avx2(float* out, long n, int nin, const float* const* in,
+		     const float* scales) {
+  MIX_KERNEL(__m256, 8, _mm256_setzero_ps, _mm256_loadu_ps, _mm256_storeu_ps,
+	     _mm256_set1_ps, _mm256_add_ps, _mm256_mul_ps)
+}  // mix_avx2()
+
+__attribute__((target("avx512f")))
+static void mix_avx512(float* out, long n, int nin, const float* const* in,
+		       const float* scales) {
+  MIX_KERNEL(__m512, 16, _mm512_setzero_ps, _mm512_loadu_ps, _mm512_storeu_ps,
+	     _mm512_set1_ps, _mm512_add_ps, _mm512_mul_ps)
+}  // mix_avx512()
+
+//
+// A single input covering [0, n) is just a scaled copy. The zero is
+// still added so that -0 comes out as +0, as in the general loop.
+//
+
+#define SCALE_KERNEL(VEC, WIDTH, ZERO, LOAD, STORE, SET1, ADD, MUL)	\
+  VEC sv = SET1(scale);							\
+  long j;								\
+									\
+  for (j = 0; j + WIDTH <= n; j += WIDTH) {				\
+    STORE(out + j, ADD(ZERO(), MUL(LOAD(in + j), sv)));			\
+  }									\
+  for (; j < n; j++) {							\
+    out[j] = 0.0f + in[j] * scale;					\
+  }
+
+__attribute__((target("sse2")))
+static void scale_sse(float* out, long n, const float* in, float scale) {
+  SCALE_KERNEL(__m128, 4, _mm_setzero_ps, _mm_loadu_ps, _mm_storeu_ps,
+	       _mm_set1_ps, _mm_add_ps, _mm_mul_ps)
+}  // scale_sse()
+
+__attribute__((target("avx2")))
+static void scale_avx2(float* out, long n, const float* in, float scale) {
+  SCALE_KERNEL(__m256, 8, _mm256_setzero_ps, _mm256_loadu_ps, _mm256_storeu_ps,
+	       _mm256_set1_ps, _mm256_add_ps, _mm256_mul_ps)
+}  // scale_avx2()
+
+__attribute__((target("avx512f")))
+static void scale_avx512(float* out, long n, const float* in, float scale) {
+  SCALE_KERNEL(__m512, 16, _mm512_setzero_ps, _mm512_loadu_ps, _mm512_storeu_ps,
+	       _mm512_set1_ps, _mm512_add_ps, _mm512_mul_ps)
+}  // scale_avx512()
+
+#endif // SNDSIMD_X86
+
+void mix_accumulate(float* out, long n, int nin, const float* const* in,
+		    const long* lens, const float* scales) {
+  int i;
+  long full = n;		// All inputs cover [0, full)
+
+  if (simd_level() == SIMD_SCALAR || nin == 0) {
+    mix_scalar(out, n, nin, in, lens, scales);
+    return;
+  }
+  for (i = 0; i < nin; i++) {
+    if (lens[i] < full) full = lens[i];
+  }
+  if (full < 0) full = 0;
+
+#ifdef SNDSIMD_X86
+  if (nin == 1 && full == n) {
+    switch (Level) {
+    case SIMD_AVX512:
+      scale_avx512(out, n, in[0], scales[0]);
+      break;
+    case SIMD_AVX2:
+      scale_avx2(out, n, in[0], scales[0]);
+      break;
+    default:
+      scale_sse(out, n, in[0], scales[0]);
+      break;
+    }
+    return;
+  }
+  switch (Level) {
+  case SIMD_AVX512:
+    mix_avx512(out, full, nin, in, scales);
+    break;
+  case SIMD_AVX2:
+    mix_avx2(out, full, nin, in, scales);
+    break;
+  default:
+    mix_sse(out, full, nin, in, scales);
+    break;
+  }
+#endif
+  mix_tail(out, full, n, nin, in, lens, scales);
+}  // mix_accumulate()
+
+//////////////////////////////////////////////////////////////////////
+//
+// dot_product()
+//
+// Several independent partial sums, so that the adds can overlap.
+//
+
+static float dot_scalar(const float* a, const float* b, long n) {
+  float s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+  long j;
+
+  for (j = 0; j + 4 <= n; j += 4) {
+    s0 += a[j] * b[j];
+    s1 += a[j+1] * b[j+1];
+    s2 += a[j+2] * b[j+2];
+    s3 += a[j+3] * b[j+3];
+  }
+  for (; j < n; j++) {
+    s0 += a[j] * b[j];
+  }
+  return (s0 + s1) + (s2 + s3);
+}  // dot_scalar()
+
+#ifdef SNDSIMD_X86
+
+__attribute__((target("sse2")))
+static float dot_sse(const float* a, const float* b, long n) {
+  __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+  float tmp[4];
+  long j;
+
+  for (j = 0; j + 8 <= n; j += 8) {
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + j), _mm_loadu_ps(b + j)));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + j + 4), _mm_loadu_ps(b + j + 4)));
+  }
+  _mm_storeu_ps(tmp, _mm_add_ps(s0, s1));
+  return (tmp[0] + tmp[1]) + (tmp[2] + tmp[3]) + dot_scalar(a + j, b + j, n - j);
+}  // dot_sse()
+
+__attribute__((target("avx2")))
+static float dot_avx2(const float* a, const float* b, long n) {
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+  float tmp[8];
+  long j;
+
+  for (j = 0; j + 16 <= n; j += 16) {
+    s0 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_loadu_ps(a + j), _mm256_loadu_ps(b + j)));
+    s1 = _mm256_add_ps(s1, _mm256_mul_ps(_mm256_loadu_ps(a + j + 8), _mm256_loadu_ps(b + j + 8)));
+  }
+  _mm256_storeu_ps(tmp, _mm256_add_ps(s0, s1));
+  return ((tmp[0] + tmp[1]) + (tmp[2] + tmp[3])) + ((tmp[4] + tmp[5]) + (tmp[6] + tmp[7]))
+    + dot_scalar(a + j, b + j, n - j);
+}  // dot_avx2()
+
+__attribute__((target("avx512f")))
+static float dot_avx512(const float* a, const float* b, long n) {
+  __m512 s0 = _mm512_setzero_ps();
+  float tmp[16], s = 0.0;
+  long j;
+  int k;
+
+  for (j = 0; j + 16 <= n; j += 16) {
+    s0 = _mm512_add_ps(s0, _mm512_mul_ps(_mm512_loadu_ps(a + j), _mm512_loadu_ps(b + j)));
+  }
+  _mm512_storeu_ps(tmp, s0);
+  for (k = 0; k < 16; k++) {
+    s += tmp[k];
+  }
+  return s + dot_scalar(a + j, b + j, n - j);
+}  // dot_avx512()
+
+#endif // SNDSIMD_X86
+
+float dot_product(const float* a, const float* b, long n) {
+#ifdef SNDSIMD_X86
+  switch (simd_level()) {
+  case SIMD_AVX512:
+    return dot_avx512(a, b, n);
+  case SIMD_AVX2:
+    return dot_avx2(a, b, n);
+  case SIMD_SSE:
+    return dot_sse(a, b, n);
+  }
+#endif
+  return dot_scalar(a, b, n);
+}  // dot_product()
+
+//////////////////////////////////////////////////////////////////////
+//
+// peak_gains() and apply_gains()
+//
+// The per-frame work is a max over channels, a divide and a min, all
+// of which round the same way in every version. Mono runs at full
+// vector width. Stereo uses SSE shuffles at every level, like
+// deinterleave(). Other channel counts find the frame peaks with
+// plain loops, and then share the vectorized divide.
+//
+
+static void frame_peaks(const float* in, long from, long frames, int channels,
+			float* peaks) {
+  long j;
+  int c;
+  float a, p;
+
+  for (j = from; j < frames; j++) {
+    p = 0.0;
+    for (c = 0; c < channels; c++) {
+      a = fabsf(in[j * channels + c]);
+      if (a > p) p = a;
+    }
+    peaks[j] = p;
+  }
+}  // frame_peaks()
+
+// gains[j] = min(1, ceiling / max(|src[j]|, FLT_MIN)) for from <= j < n
+
+static void gains_scalar(const float* src, long from, long n, float ceiling,
+			 float* gains) {
+  long j;
+  float p, g;
+
+  for (j = from; j < n; j++) {
+    p = fabsf(src[j]);
+    if (p < FLT_MIN) p = FLT_MIN;
+    g = ceiling / p;
+    gains[j] = (g < 1.0f) ? g : 1.0f;
+  }
+}  // gains_scalar()
+
+static void apply_scalar(float* buf, long from, long frames, int channels,
+			 const float* gains, float ceiling) {
+  long j;
+  int c;
+  float v;
+
+  for (j = from; j < frames; j++) {
+    for (c = 0; c < channels; c++) {
+      v = buf[j * channels + c] * gains[j];
+      if (v > ceiling) v = ceiling;
+      if (v < -ceiling) v = -ceiling;
+      buf[j * channels + c] = v;
+    }
+  }
+}  // apply_scalar()
+
+#ifdef SNDSIMD_X86
+
+#define GAINS_KERNEL(VEC, WIDTH, LOAD, STORE, SET1, ABS, MAX, MIN, DIV)	\
+  VEC tiny = SET1(FLT_MIN);						\
+  VEC one = SET1(1.0f);							\
+  VEC ceil = SET1(ceiling);						\
+  long j;								\
+									\
+  for (j = 0; j + WIDTH <= n; j += WIDTH) {				\
+    VEC p = MAX(ABS(LOAD(src + j)), tiny);				\
+    STORE(gains + j, MIN(DIV(ceil, p), one));				\
+  }									\
+  gains_scalar(src, j, n, ceiling, gains);
+
+#define APPLY_KERNEL(VEC, WIDTH, LOAD, STORE, SET1, MUL, MAX, MIN)	\
+  VEC hi = SET1(ceiling);						\
+  VEC lo = SET1(-ceiling);						\
+  long j;								\
+									\
+  for (j = 0; j + WIDTH <= n; j += WIDTH) {				\
+    STORE(buf + j, MIN(MAX(MUL(LOAD(buf + j), LOAD(gains + j)), lo), hi)); \
+  }									\
+  apply_scalar(buf, j, n, 1, gains, ceiling);
+
+// Clear the sign bit. AVX-512F has its own.
+//
+// The plain AVX-512 min and max intrinsics pass an undefined vector
+// as the (unused) merge source, which some gcc versions warn about.
+// The merging forms with a full mask are the same instruction.
+
+__attribute__((target("sse2")))
+static inline __m128 abs_sse(__m128 x) {
+  return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+}  // abs_sse()
+
+__attribute__((target("avx2")))
+static inline __m256 abs_avx2(__m256 x) {
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+}  // abs_avx2()
+
+__attribute__((target("avx512f")))
+static inline __m512 min_avx512(__m512 a, __m512 b) {
+  return _mm512_mask_min_ps(a, 0xffff, a, b);
+}  // min_avx512()
+
+__attribute__((target("avx512f")))
+static inline __m512 max_avx512(__m512 a, __m512 b) {
+  return _mm512_mask_max_ps(a, 0xffff, a, b);
+}  // max_avx512()
+
+__attribute__((target("sse2")))
+static void gains_sse(const float* src, long n, float ceiling, float* gains) {
+  GAINS_KERNEL(__m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_set1_ps,
+	       abs_sse, _mm_max_ps, _mm_min_ps, _mm_div_ps)
+}  // gains_sse()
+
+__attribute__((target("avx2")))
+static void gains_avx2(const float* src, long n, float ceiling, float* gains) {
+  GAINS_KERNEL(__m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_set1_ps,
+	       abs_avx2, _mm256_max_ps, _mm256_min_ps, _mm256_div_ps)
+}  // gains_avx2()
+
+__attribute__((target("avx512f")))
+static void gains_avx512(const float* src, long n, float ceiling, float* gains) {
+  GAINS_KERNEL(__m512, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_set1_ps,
+	       _mm512_abs_ps, max_avx512, min_avx512, _mm512_div_ps)
+}  // gains_avx512()
+
+__attribute__((target("sse2")))
+static void apply_sse(float* buf, long n, const float* gains, float ceiling) {
+  APPLY_KERNEL(__m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_set1_ps,
+	       _mm_mul_ps, _mm_max_ps, _mm_min_ps)
+}  // apply_sse()
+
+__attribute__((target("avx2")))
+static void apply_avx2(float* buf, long n, const float* gains, float ceiling) {
+  APPLY_KERNEL(__m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_set1_ps,
+	       _mm256_mul_ps, _mm256_max_ps, _mm256_min_ps)
+}  // apply_avx2()
+
+__attribute__((target("avx512f")))
+static void apply_avx512(float* buf, long n, const float* gains, float ceiling) {
+  APPLY_KERNEL(__m512, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_set1_ps,
+	       _mm512_mul_ps, max_avx512, min_avx512)
+}  // apply_avx512()
+
+__attribute__((target("sse2")))
+static long peaks2_sse(const float* in, long frames, float* peaks) {
+  __m128 absmask = _mm_set1_ps(-0.0f);
+  __m128 a, b;
+  long j;
+
+  for (j = 0; j + 4 <= frames; j += 4) {
+    a = _mm_andnot_ps(absmask, _mm_loadu_ps(in + 2*j));
+    b = _mm_andnot_ps(absmask, _mm_loadu_ps(in + 2*j + 4));
+    _mm_storeu_ps(peaks + j, _mm_max_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)),
+					_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+  }
+  return j;
+}  // peaks2_sse()
+
+__attribute__((target("sse2")))
+static long apply2_sse(float* buf, long frames, const float* gains, float ceiling) {
+  __m128 hi = _mm_set1_ps(ceiling);
+  __m128 lo = _mm_set1_ps(-ceiling);
+  __m128 g;
+  long j;
+
+  for (j = 0; j + 4 <= frames; j += 4) {
+    g = _mm_loadu_ps(gains + j);
+    _mm_storeu_ps(buf + 2*j, _mm_min_ps(_mm_max_ps(
+	_mm_mul_ps(_mm_loadu_ps(buf + 2*j), _mm_unpacklo_ps(g, g)), lo), hi));
+    _mm_storeu_ps(buf + 2*j + 4, _mm_min_ps(_mm_max_ps(
+	_mm_mul_ps(_mm_loadu_ps(buf + 2*j + 4), _mm_unpackhi_ps(g, g)), lo), hi));
+  }
+  return j;
+}  // apply2_sse()
+
+#endif // SNDSIMD_X86
+
+void peak_gains(const float* in, long frames, int channels, float ceiling,
+		float* gains) {
+  const float* src = in;
+  long j = 0;
+
+  // Reduce the frames to their peaks first, unless they already are.
+
+  if (channels > 1) {
+#ifdef SNDSIMD_X86
+    if (channels == 2 && simd_level() >= SIMD_SSE) {
+      j = peaks2_sse(in, frames, gains);
+    }
+#endif
+    frame_peaks(in, j, frames, channels, gains);
+    src = gains;
+  }
+
+#ifdef SNDSIMD_X86
+  switch (simd_level()) {
+  case SIMD_AVX512:
+    gains_avx512(src, frames, ceiling, gains);
+    return;
+  case SIMD_AVX2:
+    gains_avx2(src, frames, ceiling, gains);
+    return;
+  case SIMD_SSE:
+    gains_sse(src, frames, ceiling, gains);
+    return;
+  }
+#endif
+  gains_scalar(src, 0, frames, ceiling, gains);
+}  // peak_gains()
+
+void apply_gains(float* buf, long frames, int channels, const float* gains,
+		 float ceiling) {
+  long j = 0;
+
+#ifdef SNDSIMD_X86
+  if (channels == 1) {
+    switch (simd_level()) {
+    case SIMD_AVX512:
+      apply_avx512(buf, frames, gains, ceiling);
+      return;
+    case SIMD_AVX2:
+      apply_avx2(buf, frames, gains, ceiling);
+      return;
+    case SIMD_SSE:
+      apply_sse(buf, frames, gains, ceiling);
+      return;
+    }
+  } else if (channels == 2 && simd_level() >= SIMD_SSE) {
+    j = apply2_sse(buf, frames, gains, ceiling);
+  }
+#endif
+  apply_scalar(buf, j, frames, channels, gains, ceiling);
+}  // apply_gains()
+
+//////////////////////////////////////////////////////////////////////
+//
+// deinterleave() and interleave()
+//
+// These only move data, so the work is in keeping the loads and
+// stores contiguous. Stereo, by far the most common case, gets a
+// shuffle-based version. Three or more channels are moved as 4x4
+// transposes: four channels of four frames at a time, so that both
+// sides are read and written four floats at once. The leftover frames
+// copy one channel at a time, so that at least the planar side is
+// written sequentially.
+//
+
+#ifdef SNDSIMD_X86
+
+__attribute__((target("sse2")))
+static long deinterleave2_sse(const float* in, long frames, float* left, float* right) {
+  long j;
+  __m128 a, b;
+
+  for (j = 0; j + 4 <= frames; j += 4) {
+    a = _mm_loadu_ps(in + 2*j);
+    b = _mm_loadu_ps(in + 2*j + 4);
+    _mm_storeu_ps(left + j, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+    _mm_storeu_ps(right + j, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+  }
+  return j;
+}  // deinterleave2_sse()
+
+__attribute__((target("sse2")))
+static long interleave2_sse(const float* left, const float* right, long frames, float* out) {
+  long j;
+  __m128 l, r;
+
+  for (j = 0; j + 4 <= frames; j += 4) {
+    l = _mm_loadu_ps(left + j);
+    r = _mm_loadu_ps(right + j);
+    _mm_storeu_ps(out + 2*j, _mm_unpacklo_ps(l, r));
+    _mm_storeu_ps(out + 2*j + 4, _mm_unpackhi_ps(l, r));
+  }
+  return j;
+}  // interleave2_sse()
+
+//
+// Channels c to c+3 of four frames make one transpose. If the channel
+// count isn't a multiple of four, the last group overlaps the one
+// before it, which only moves some samples twice. With three channels
+// the fourth lane belongs to the next frame: its load is dropped when
+// deinterleaving, and its store is overwritten by the next row when
+// interleaving. Either way it touches the frame after the group, so
+// the loop stops a frame early.
+//
+
+__attribute__((target("sse2")))
+static long deinterleave4_sse(const float* in, long frames, int channels,
+			      float* planes, long stride) {
+  const float* p;
+  float* q;
+  long j, last = (channels < 4) ? frames - 1 : frames;
+  int c;
+  __m128 r0, r1, r2, r3;
+
+  for (j = 0; j + 4 <= last; j += 4) {
+    for (c = 0; c < channels; c += 4) {
+      if (c + 4 > channels && channels >= 4) {
+	c = channels - 4;
+      }
+      p = in + j * channels + c;
+      r0 = _mm_loadu_ps(p);
+      r1 = _mm_loadu_ps(p + channels);
+      r2 = _mm_loadu_ps(p + 2 * channels);
+      r3 = _mm_loadu_ps(p + 3 * channels);
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      q = planes + c * stride + j;
+      _mm_storeu_ps(q, r0);
+      _mm_storeu_ps(q + stride, r1);
+      _mm_storeu_ps(q + 2 * stride, r2);
+      if (c + 3 < channels) {
+	_mm_storeu_ps(q + 3 * stride, r3);
+      }
+    }
+  }
+  return j;
+}  // deinterleave4_sse()
+
+__attribute__((target("sse2")))
+static long interleave4_sse(const float* planes, long stride, long frames, int channels,
+			    float* out) {
+  const float* p;
+  float* q;
+  long j, last = (channels < 4) ? frames - 1 : frames;
+  int c;
+  __m128 r0, r1, r2, r3;
+
+  for (j = 0; j + 4 <= last; j += 4) {
+    for (c = 0; c < channels; c += 4) {
+      if (c + 4 > channels && channels >= 4) {
+	c = channels - 4;
+      }
+      p = planes + c * stride + j;
+      r0 = _mm_loadu_ps(p);
+      r1 = _mm_loadu_ps(p + stride);
+      r2 = _mm_loadu_ps(p + 2 * stride);
+      r3 = (c + 3 < channels) ? _mm_loadu_ps(p + 3 * stride) : _mm_setzero_ps();
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      q = out + j * channels + c;
+      _mm_storeu_ps(q, r0);
+      _mm_storeu_ps(q + channels, r1);
+      _mm_storeu_ps(q + 2 * channels, r2);
+      _mm_storeu_ps(q + 3 * channels, r3);
+    }
+  }
+  return j;
+}  // interleave4_sse()
+
+#endif // SNDSIMD_X86
+
+void deinterleave(const float* in, long frames, int channels,
+		  float* planes, long stride) {
+  long j = 0;
+  int c;
+  float* plane;
+
+  if (channels == 1) {
+    if (in != planes) {
+      memcpy(planes, in, frames * sizeof(float));
+    }
+    return;
+  }
+#ifdef SNDSIMD_X86
+  if (channels == 2 && simd_level() >= SIMD_SSE) {
+    j = deinterleave2_sse(in, frames, planes, planes + stride);
+  } else if (channels > 2 && simd_level() >= SIMD_SSE) {
+    j = deinterleave4_sse(in, frames, channels, planes, stride);
+  }
+#endif
+  for (c = 0; c < channels; c++) {
+    plane = planes + c * stride;
+    for (long k = j; k < frames; k++) {
+      plane[k] = in[k * channels + c];
+    }
+  }
+}  // deinterleave()
+
+void interleave(const float* planes, long stride, long frames, int channels,
+		float* out) {
+  long j = 0;
+  int c;
+  const float* plane;
+
+  if (channels == 1) {
+    if (out != planes) {
+      memcpy(out, planes, frames * sizeof(float));
+    }
+    return;
+  }
+#ifdef SNDSIMD_X86
+  if (channels == 2 && simd_level() >= SIMD_SSE) {
+    j = interleave2_sse(planes, planes + stride, frames, out);
+  } else if (channels > 2 && simd_level() >= SIMD_SSE) {
+    j = interleave4_sse(planes, stride, frames, channels, out);
+  }
+#endif
+  for (c = 0; c < channels; c++) {
+    plane = planes + c * stride;
+    for (long k = j; k < frames; k++) {
+      out[k * channels + c] = plane[k];
+    }
+  }
+}  // interleave()
+
+//////////////////////////////////////////////////////////////////////
+//
+// block_moments()
+//
+// The samples are widened to double before the shift is taken off, so
+// the sums are as accurate as the per-sample jstat::datum(). Each sum
+// has two accumulators (one per half of the float vector), and min
+// and max stay in float, where they are exact.
+//
+
+static void moments_scalar(const float* x, long n, double shift, double* sum,
+			   double* sumsq, float* lo, float* hi) {
+  double s0 = 0.0, s1 = 0.0, q0 = 0.0, q1 = 0.0, d0, d1;
+  float l = HUGE_VALF, h = -HUGE_VALF;
+  long j;
+
+  for (j = 0; j + 2 <= n; j += 2) {
+    d0 = x[j] - shift;
+    d1 = x[j+1] - shift;
+    s0 += d0;
+    s1 += d1;
+    q0 += d0 * d0;
+    q1 += d1 * d1;
+    if (x[j] < l) l = x[j];
+    if (x[j] > h) h = x[j];
+    if (x[j+1] < l) l = x[j+1];
+    if (x[j+1] > h) h = x[j+1];
+  }
+  for (; j < n; j++) {
+    d0 = x[j] - shift;
+    s0 += d0;
+    q0 += d0 * d0;
+    if (x[j] < l) l = x[j];
+    if (x[j] > h) h = x[j];
+  }
+  *sum = s0 + s1;
+  *sumsq = q0 + q1;
+  *lo = l;
+  *hi = h;
+}  // moments_scalar()
+
+#ifdef SNDSIMD_X86
+
+//
+// LOWER and UPPER widen the two halves of a float vector. MIN and MAX
+// take the new data first, so that a NaN leaves the running value
+// alone. The tail goes through moments_scalar() and is folded in last.
+//
+
+#define MOMENTS_KERNEL(VEC, DVEC, WIDTH, LOAD, STORE, SET1, MIN, MAX,	\
+		       LOWER, UPPER, DZERO, DSTORE, DSET1, DADD, DSUB, DMUL) \
+  DVEC c = DSET1(shift);						\
+  DVEC s0 = DZERO(), s1 = DZERO(), q0 = DZERO(), q1 = DZERO();		\
+  DVEC d0, d1;								\
+  VEC v, vlo = SET1(HUGE_VALF), vhi = SET1(-HUGE_VALF);			\
+  float flo[WIDTH], fhi[WIDTH];						\
+  double ds[WIDTH / 2], dq[WIDTH / 2];					\
+  long j;								\
+  int k;								\
+									\
+  for (j = 0; j + WIDTH <= n; j += WIDTH) {				\
+    v = LOAD(x + j);							\
+    vlo = MIN(v, vlo);							\
+    vhi = MAX(v, vhi);							\
+    d0 = DSUB(LOWER(v), c);						\
+    d1 = DSUB(UPPER(v), c);						\
+    s0 = DADD(s0, d0);							\
+    s1 = DADD(s1, d1);							\
+    q0 = DADD(q0, DMUL(d0, d0));					\
+    q1 = DADD(q1, DMUL(d1, d1));					\
+  }									\
+  moments_scalar(x + j, n - j, shift, sum, sumsq, lo, hi);		\
+  STORE(flo, vlo);							\
+  STORE(fhi, vhi);							\
+  DSTORE(ds, DADD(s0, s1));						\
+  DSTORE(dq, DADD(q0, q1));						\
+  for (k = 0; k < WIDTH; k++) {						\
+    if (flo[k] < *lo) *lo = flo[k];					\
+    if (fhi[k] > *hi) *hi = fhi[k];					\
+  }									\
+  for (k = 0; k < WIDTH / 2; k++) {					\
+    *sum += ds[k];							\
+    *sumsq += dq[k];							\
+  }
+
+#define LOWER_SSE(v) _mm_cvtps_pd(v)
+#define UPPER_SSE(v) _mm_cvtps_pd(_mm_movehl_ps(v, v))
+#define LOWER_AVX2(v) _mm256_cvtps_pd(_mm256_castps256_ps128(v))
+#define UPPER_AVX2(v) _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1))
+#define LOWER_AVX512(v) lower_avx512(v)
+#define UPPER_AVX512(v) upper_avx512(v)
+
+// The zero-masking forms with a full mask, for the same reason as
+// min_avx512().
+
+__attribute__((target("avx512f")))
+static inline __m512d lower_avx512(__m512 v) {
+  __m256d half = _mm512_maskz_extractf64x4_pd(0xf, _mm512_castps_pd(v), 0);
+  return _mm512_maskz_cvtps_pd(0xff, _mm256_castpd_ps(half));
+}  // lower_avx512()
+
+__attribute__((target("avx512f")))
+static inline __m512d upper_avx512(__m512 v) {
+  __m256d half = _mm512_maskz_extractf64x4_pd(0xf, _mm512_castps_pd(v), 1);
+  return _mm512_maskz_cvtps_pd(0xff, _mm256_castpd_ps(half));
+}  // upper_avx512()
+
+__attribute__((target("sse2")))
+static void moments_sse(const float* x, long n, double shift, double* sum,
+			double* sumsq, float* lo, float* hi) {
+  MOMENTS_KERNEL(__m128, __m128d, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_set1_ps,
+		 _mm_min_ps, _mm_max_ps, LOWER_SSE, UPPER_SSE,
+		 _mm_setzero_pd, _mm_storeu_pd, _mm_set1_pd,
+		 _mm_add_pd, _mm_sub_pd, _mm_mul_pd)
+}  // moments_sse()
+
+__attribute__((target("avx2")))
+static void moments_avx2(const float* x, long n, double shift, double* sum,
+			 double* sumsq, float* lo, float* hi) {
+  MOMENTS_KERNEL(__m256, __m256d, 8, _mm256_loadu_ps, _mm256_storeu_ps,
+		 _mm256_set1_ps, _mm256_min_ps, _mm256_max_ps,
+		 LOWER_AVX2, UPPER_AVX2,
+		 _mm256_setzero_pd, _mm256_storeu_pd, _mm256_set1_pd,
+		 _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd)
+}  // moments_avx2()
+
+__attribute__((target("avx512f")))
+static void moments_avx512(const float* x, long n, double shift, double* sum,
+			   double* sumsq, float* lo, float* hi) {
+  MOMENTS_KERNEL(__m512, __m512d, 16, _mm512_loadu_ps, _mm512_storeu_ps,
+		 _mm512_set1_ps, min_avx512, max_avx512,
+		 LOWER_AVX512, UPPER_AVX512,
+		 _mm512_setzero_pd, _mm512_storeu_pd, _mm512_set1_pd,
+		 _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd)
+}  // moments_avx512()
+
+#endif // SNDSIMD_X86
+
+void block_moments(const float* x, long n, double shift, double* sum,
+		   double* sumsq, float* lo, float* hi) {
+#ifdef SNDSIMD_X86
+  switch (simd_level()) {
+  case SIMD_AVX512:
+    moments_avx512(x, n, shift, sum, sumsq, lo, hi);
+    return;
+  case SIMD_AVX2:
+    moments_avx2(x, n, shift, sum, sumsq, lo, hi);
+    return;
+  case SIMD_SSE:
+    moments_sse(x, n, shift, sum, sumsq, lo, hi);
+    return;
+  }
+#endif
+  moments_scalar(x, n, shift, sum, sumsq, lo, hi);
+}  // block_moments()
+
+//////////////////////////////////////////////////////////////////////
+//
+// cross_moment()
+//
+// Like block_moments(), widened to double before the shifts are taken
+// off, with two accumulators.
+//
+
+static double cross_scalar(const float* a, const float* b, long n, double ca, double cb) {
+  double s0 = 0.0, s1 = 0.0;
+  long j;
+
+  for (j = 0; j + 2 <= n; j += 2) {
+    s0 += (a[j] - ca) * (b[j] - cb);
+    s1 += (a[j+1] - ca) * (b[j+1] - cb);
+  }
+  for (; j < n; j++) {
+    s0 += (a[j] - ca) * (b[j] - cb);
+  }
+  return s0 + s1;
+}  // cross_scalar()
+
+#ifdef SNDSIMD_X86
+
+#define CROSS_KERNEL(VEC, DVEC, WIDTH, LOAD, LOWER, UPPER, DZERO, DSTORE, \
+		     DSET1, DADD, DSUB, DMUL)				\
+  DVEC va = DSET1(ca), vb = DSET1(cb);					\
+  DVEC s0 = DZERO(), s1 = DZERO();					\
+  VEC x, y;								\
+  double tmp[WIDTH / 2], s;						\
+  long j;								\
+  int k;								\
+									\
+  for (j = 0; j + WIDTH <= n; j += WIDTH) {				\
+    x = LOAD(a + j);							\
+    y = LOAD(b + j);							\
+    s0 = DADD(s0, DMUL(DSUB(LOWER(x), va), DSUB(LOWER(y), vb)));	\
+    s1 = DADD(s1, DMUL(DSUB(UPPER(x), va), DSUB(UPPER(y), vb)));	\
+  }									\
+  DSTORE(tmp, DADD(s0, s1));						\
+  s = cross_scalar(a + j, b + j, n - j, ca, cb);			\
+  for (k = 0; k < WIDTH / 2; k++) {					\
+    s += tmp[k];							\
+  }									\
+  return s;
+
+__attribute__((target("sse2")))
+static double cross_sse(const float* a, const float* b, long n, double ca, double cb) {
+  CROSS_KERNEL(__m128, __m128d, 4, _mm_loadu_ps, LOWER_SSE, UPPER_SSE,
+	       _mm_setzero_pd, _mm_storeu_pd, _mm_set1_pd,
+	       _mm_add_pd, _mm_sub_pd, _mm_mul_pd)
+}  // cross_sse()
+
+__attribute__((target("avx2")))
+static double cross_avx2(const float* a, const float* b, long n, double ca, double cb) {
+  CROSS_KERNEL(__m256, __m256d, 8, _mm256_loadu_ps, LOWER_AVX2, UPPER_AVX2,
+	       _mm256_setzero_pd, _mm256_storeu_pd, _mm256_set1_pd,
+	       _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd)
+}  // cross_avx2()
+
+__attribute__((target("avx512f")))
+static double cross_avx512(const float* a, const float* b, long n, double ca, double cb) {
+  CROSS_KERNEL(__m512, __m512d, 16, _mm512_loadu_ps, LOWER_AVX512, UPPER_AVX512,
+	       _mm512_setzero_pd, _mm512_storeu_pd, _mm512_set1_pd,
+	       _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd)
+}  // cross_avx512()
+
+#endif // SNDSIMD_X86
+
+double cross_moment(const float* a, const float* b, long n, double ca, double cb) {
+#ifdef SNDSIMD_X86
+  switch (simd_level()) {
+  case SIMD_AVX512:
+    return cross_avx512(a, b, n, ca, cb);
+  case SIMD_AVX2:
+    return cross_avx2(a, b, n, ca, cb);
+  case SIMD_SSE:
+    return cross_sse(a, b, n, ca, cb);
+  }
+#endif
+  return cross_scalar(a, b, n, ca, cb);
+}  // cross_moment()
+
+//////////////////////////////////////////////////////////////////////
+//
+// pcm16_moments()
+//
+// pmaddwd against ones gives pairwise sums of samples, and against the
+// samples themselves gives pairwise sums of squares. The latter can
+// reach 2^31 (two samples of -32768), one more than an int32 holds, so
+// it is taken as unsigned and widened to 64 bits at once. The sums of
+// samples stay in 32 bit lanes for up to PCM16_FLUSH vectors. AVX-512F
+// has no 16 bit operations (they're AVX-512BW), so that level uses the
+// AVX2 kernel.
+//
+
+static void pcm16_scalar(const unsigned char* p, long n, int bigendian,
+			 long long* sum, unsigned long long* sumsq, int* lo, int* hi) {
+  long long s = 0;
+  unsigned long long q = 0;
+  int l = 32767, h = -32768, x;
+  long j;
+
+  for (j = 0; j < n; j++, p += 2) {
+    x = bigendian ? (short) ((p[0] << 8) | p[1]) : (short) ((p[1] << 8) | p[0]);
+    s += x;
+    q += (unsigned) (x * x);
+    if (x < l) l = x;
+    if (x > h) h = x;
+  }
+  *sum = s;
+  *sumsq = q;
+  *lo = l;
+  *hi = h;
+}  // pcm16_scalar()
+
+#ifdef SNDSIMD_X86
+
+#define PCM16_KERNEL(VEC, WIDTH, LOAD, STORE, ZERO, SET1, OR, SLLI, SRLI, \
+		     MIN, MAX, MADD, ADD32, ADD64, UNPACKLO, UNPACKHI)	\
+  VEC ones = SET1(1), zero = ZERO();					\
+  VEC vlo = SET1(32767), vhi = SET1(-32768);				\
+  VEC vs, vq0 = ZERO(), vq1 = ZERO(), v, sq;				\
+  int s32[WIDTH / 2];							\
+  short slo[WIDTH], shi[WIDTH];						\
+  unsigned long long q64[WIDTH / 4];					\
+  long long s = 0;							\
+  unsigned long long q = 0;						\
+  long j = 0, m, jend;							\
+  int k;								\
+									\
+  while (j + WIDTH <= n) {						\
+    m = (n - j) / WIDTH;						\
+    if (m > PCM16_FLUSH) m = PCM16_FLUSH;				\
+    jend = j + m * WIDTH;						\
+    vs = ZERO();							\
+    for (; j < jend; j += WIDTH) {					\
+      v = LOAD((const VEC*) (p + 2 * j));				\
+      if (bigendian) v = OR(SLLI(v, 8), SRLI(v, 8));			\
+      vlo = MIN(vlo, v);						\
+      vhi = MAX(vhi, v);						\
+      vs = ADD32(vs, MADD(v, ones));					\
+      sq = MADD(v, v);							\
+      vq0 = ADD64(vq0, UNPACKLO(sq, zero));				\
+      vq1 = ADD64(vq1, UNPACKHI(sq, zero));				\
+    }									\
+    STORE((VEC*) s32, vs);						\
+    for (k = 0; k < WIDTH / 2; k++) {					\
+      s += s32[k];							\
+    }									\
+  }									\
+  pcm16_scalar(p + 2 * j, n - j, bigendian, sum, sumsq, lo, hi);	\
+  STORE((VEC*) slo, vlo);						\
+  STORE((VEC*) shi, vhi);						\
+  STORE((VEC*) q64, ADD64(vq0, vq1));					\
+  for (k = 0; k < WIDTH / 4; k++) {					\
+    q += q64[k];							\
+  }									\
+  for (k = 0; k < WIDTH; k++) {						\
+    if (slo[k] < *lo) *lo = slo[k];					\
+    if (shi[k] > *hi) *hi = shi[k];					\
+  }									\
+  *sum += s;								\
+  *sumsq += q;
+
+__attribute__((target("sse2")))
+static void pcm16_sse(const unsigned char* p, long n, int bigendian,
+		      long long* sum, unsigned long long* sumsq, int* lo, int* hi) {
+  PCM16_KERNEL(__m128i, 8, _mm_loadu_si128, _mm_storeu_si128,
+	       _mm_setzero_si128, _mm_set1_epi16, _mm_or_si128,
+	       _mm_slli_epi16, _mm_srli_epi16, _mm_min_epi16, _mm_max_epi16,
+	       _mm_madd_epi16, _mm_add_epi32, _mm_add_epi64,
+	       _mm_unpacklo_epi32, _mm_unpackhi_epi32)
+}  // pcm16_sse()
+
+__attribute__((target("avx2")))
+static void pcm16_avx2(const unsigned char* p, long n, int bigendian,
+		       long long* sum, unsigned long long* sumsq, int* lo, int* hi) {
+  PCM16_KERNEL(__m256i, 16, _mm256_loadu_si256, _mm256_storeu_si256,
+	       _mm256_setzero_si256, _mm256_set1_epi16, _mm256_or_si256,
+	       _mm256_slli_epi16, _mm256_srli_epi16, _mm256_min_epi16,
+	       _mm256_max_epi16, _mm256_madd_epi16, _mm256_add_epi32,
+	       _mm256_add_epi64, _mm256_unpacklo_epi32, _mm256_unpackhi_epi32)
+}  // pcm16_avx2()
+
+#endif // SNDSIMD_X86
+
+void pcm16_moments(const unsigned char* p, long n, int bigendian,
+		   long long* sum, unsigned long long* sumsq, int* lo, int* hi) {
+#ifdef SNDSIMD_X86
+  switch (simd_level()) {
+  case SIMD_AVX512:
+  case SIMD_AVX2:
+    pcm16_avx2(p, n, bigendian, sum, sumsq, lo, hi);
+    return;
+  case SIMD_SSE:
+    pcm16_sse(p, n, bigendian, sum, sumsq, lo, hi);
+    return;
+  }
+#endif
+  pcm16_scalar(p, n, bigendian, sum, sumsq, lo, hi);
+}  // pcm16_moments()
+
+//////////////////////////////////////////////////////////////////////
+//
+// multiply_vectors()
+//
+
+static void multiply_scalar(float* out, const float* a, const float* b, long n) {
+  long j;
+
+  for (j = 0; j < n; j++) {
+    out[j] = a[j] * b[j];
+  }
+}  // multiply_scalar()
+
+#ifdef SNDSIMD_X86
+
+#define MULTIPLY_KERNEL(WIDTH, LOAD, STORE, MUL)			\
+  long j;								\
+									\
+  for (j = 0; j + WIDTH <= n; j += WIDTH) {				\
+    STORE(out + j, MUL(LOAD(a + j), LOAD(b + j)));			\
+  }									\
+  multiply_scalar(out + j, a + j, b + j, n - j);
+
+__attribute__((target("sse2")))
+static void multiply_sse(float* out, const float* a, const float* b, long n) {
+  MULTIPLY_KERNEL(4, _mm_loadu_ps, _mm_storeu_ps, _mm_mul_ps)
+}  // multiply_sse()
+
+__attribute__((target("avx2")))
+static void multiply_avx2(float* out, const float* a, const float* b, long n) {
+  MULTIPLY_KERNEL(8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_mul_ps)
+}  // multiply_avx2()
+
+__attribute__((target("avx512f")))
+static void multiply_avx512(float* out, const float* a, const float* b, long n) {
+  MULTIPLY_KERNEL(16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_mul_ps)
+}  // multiply_avx512()
+
+#endif // SNDSIMD_X86
+
+void multiply_vectors(float* out, const float* a, const float* b, long n) {
+#ifdef SNDSIMD_X86
+  switch (simd_level()) {
+  case SIMD_AVX512:
+    multiply_avx512(out, a, b, n);
+    return;
+  case SIMD_AVX2:
+    multiply_avx2(out, a, b, n);
+    return;
+  case SIMD_SSE:
+    multiply_sse(out, a, b, n);
+    return;
+  }
+#endif
+  multiply_scalar(out, a, b, n);
+}  // multiply_vectors()
+
+//////////////////////////////////////////////////////////////////////
+//
+// fft_stage()
+//
+// The vector kernels take WIDTH consecutive butterflies of a group at
+// a time, so the first stages, where half is less than WIDTH, are left
+// to the plain loop.
+//
+
+static void fft_scalar(float* re, float* im, long n, long half,
+		       const float* wr, const float* wi) {
+  float tr, ti, ar, ai;
+  float* r0;
+  float* i0;
+  long g, j;
+
+  for (g = 0; g < n; g += 2 * half) {
+    r0 = re + g;
+    i0 = im + g;
+    for (j = 0; j < half; j++) {
+      tr = r0[half + j] * wr[j] - i0[half + j] * wi[j];
+      ti = r0[half + j] * wi[j] + i0[half + j] * wr[j];
+      ar = r0[j];
+      ai = i0[j];
+      r0[j] = ar + tr;
+      i0[j] = ai + ti;
+      r0[half + j] = ar - tr;
+      i0[half + j] = ai - ti;
+    }
+  }
+}  // fft_scalar()
+
+#ifdef SNDSIMD_X86
+
+#define FFT_KERNEL(VEC, WIDTH, LOAD, STORE, ADD, SUB, MUL)		\
+  VEC br, bi, cr, ci, tr, ti, ar, ai;					\
+  float* r0;								\
+  float* i0;								\
+  long g, j;								\
+									\
+  if (half < WIDTH) {							\
+    fft_scalar(re, im, n, half, wr, wi);				\
+    return;								\
+  }									\
+  for (g = 0; g < n; g += 2 * half) {					\
+    r0 = re + g;							\
+    i0 = im + g;							\
+    for (j = 0; j < half; j += WIDTH) {					\
+      br = LOAD(r0 + half + j);						\
+      bi = LOAD(i0 + half + j);						\
+      cr = LOAD(wr + j);						\
+      ci = LOAD(wi + j);						\
+      tr = SUB(MUL(br, cr), MUL(bi, ci));				\
+      ti = ADD(MUL(br, ci), MUL(bi, cr));				\
+      ar = LOAD(r0 + j);						\
+      ai = LOAD(i0 + j);						\
+      STORE(r0 + j, ADD(ar, tr));					\
+      STORE(i0 + j, ADD(ai, ti));					\
+      STORE(r0 + half + j, SUB(ar, tr));				\
+      STORE(i0 + half + j, SUB(ai, ti));				\
+    }									\
+  }
+
+__attribute__((target("sse2")))
+static void fft_sse(float* re, float* im, long n, long half,
+		    const float* wr, const float* wi) {
+  FFT_KERNEL(__m128, 4, _mm_loadu_ps, _mm_storeu_ps,
+	     _mm_add_ps, _mm_sub_ps, _mm_mul_ps)
+}  // fft_sse()
+
+__attribute__((target("avx2")))
+static void fft_avx2(float* re, float* im, long n, long half,
+		     const float* wr, const float* wi) {
+  FFT_KERNEL(__m256, 8, _mm256_loadu_ps, _mm256_storeu_ps,
+	     _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps)
+}  // fft_avx2()
+
+__attribute__((target("avx512f")))
+static void fft_avx512(float* re, float* im, long n, long half,
+		       const float* wr, const float* wi) {
+  FFT_KERNEL(__m512, 16, _mm512_loadu_ps, _mm512_storeu_ps,
+	     _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps)
+}  // fft_avx512()
+
+#endif // SNDSIMD_X86
+
+void fft_stage(float* re, float* im, long n, long half,
+	       const float* wr, const float* wi) {
+#ifdef SNDSIMD_X86
+  switch (simd_level()) {
+  case SIMD_AVX512:
+    fft_avx512(re, im, n, half, wr, wi);
+    return;
+  case SIMD_AVX2:
+    fft_avx2(re, im, n, half, wr, wi);
+    return;
+  case SIMD_SSE:
+    fft_sse(re, im, n, half, wr, wi);
+    return;
+  }
+#endif
+  fft_scalar(re, im, n, half, wr, wi);
+}  // fft_stage()
+
+//////////////////////////////////////////////////////////////////////
+//
+// sample_masks()
+//
+// The vector kernels fill whole words, 64/WIDTH compares at a time,
+// and leave any partial last word to the plain loop.
+//
+
+static void masks_scalar(const float* x, long n, float level, unsigned long long* clip,
+			 unsigned long long* zero, unsigned long long* same) {
+  unsigned long long bit;
+  long j;
+
+  for (j = 0; j < n; j++) {
+    if (j % 64 == 0) {
+      clip[j / 64] = zero[j / 64] = same[j / 64] = 0;
+    }
+    bit = 1ULL << (j % 64);
+    if (fabsf(x[j]) >= level) clip[j / 64] |= bit;
+    if (x[j] == 0.0f) zero[j / 64] |= bit;
+    if (x[j] == x[j - 1]) same[j / 64] |= bit;
+  }
+}  // masks_scalar()
+
+#ifdef SNDSIMD_X86
+
+#define MASKS_KERNEL(VEC, WIDTH, LOAD, SET1, ZERO, ABS, GE, EQ)		\
+  VEC lv = SET1(level), zv = ZERO(), v;					\
+  unsigned long long c, z, s;						\
+  long j, w;								\
+  int k;								\
+									\
+  for (w = 0; (w + 1) * 64 <= n; w++) {					\
+    c = z = s = 0;							\
+    for (k = 0; k < 64; k += WIDTH) {					\
+      j = w * 64 + k;							\
+      v = LOAD(x + j);							\
+      c |= (unsigned long long) GE(ABS(v), lv) << k;			\
+      z |= (unsigned long long) EQ(v, zv) << k;				\
+      s |= (unsigned long long) EQ(v, LOAD(x + j - 1)) << k;		\
+    }									\
+    clip[w] = c;							\
+    zero[w] = z;							\
+    same[w] = s;							\
+  }									\
+  masks_scalar(x + w * 64, n - w * 64, level, clip + w, zero + w, same + w);
+
+#define GE_SSE(a, b) _mm_movemask_ps(_mm_cmpge_ps(a, b))
+#define EQ_SSE(a, b) _mm_movemask_ps(_mm_cmpeq_ps(a, b))
+#define GE_AVX2(a, b) _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GE_OQ))
+#define EQ_AVX2(a, b) _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ))
+#define GE_AVX512(a, b) _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ)
+#define EQ_AVX512(a, b) _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ)
+
+__attribute__((target("sse2")))
+static void masks_sse(const float* x, long n, float level, unsigned long long* clip,
+		      unsigned long long* zero, unsigned long long* same) {
+  MASKS_KERNEL(__m128, 4, _mm_loadu_ps, _mm_set1_ps, _mm_setzero_ps, abs_sse,
+	       GE_SSE, EQ_SSE)
+}  // masks_sse()
+
+__attribute__((target("avx2")))
+static void masks_avx2(const float* x, long n, float level, unsigned long long* clip,
+		       unsigned long long* zero, unsigned long long* same) {
+  MASKS_KERNEL(__m256, 8, _mm256_loadu_ps, _mm256_set1_ps, _mm256_setzero_ps, abs_avx2,
+	       GE_AVX2, EQ_AVX2)
+}  // masks_avx2()
+
+__attribute__((target("avx512f")))
+static void masks_avx512(const float* x, long n, float level, unsigned long long* clip,
+			 unsigned long long* zero, unsigned long long* same) {
+  MASKS_KERNEL(__m512, 16, _mm512_loadu_ps, _mm512_set1_ps, _mm512_setzero_ps,
+	       _mm512_abs_ps, GE_AVX512, EQ_AVX512)
+}  // masks_avx512()
+
+#endif // SNDSIMD_X86
+
+void sample_masks(const float* x, long n, float level, unsigned long long* clip,
+		  unsigned long long* zero, unsigned long long* same) {
+#ifdef SNDSIMD_X86
+  switch (simd_level()) {
+  case SIMD_AVX512:
+    masks_avx512(x, n, level, clip, zero, same);
+    return;
+  case SIMD_AVX2:
+    masks_avx2(x, n, level, clip, zero, same);
+    return;
+  case SIMD_SSE:
+    masks_sse(x, n, level, clip, zero, same);
+    return;
+  }
+#endif
+  masks_scalar(x, n, level, clip, zero, same);
+}  // sample_masks()
@@ -0,0 +1,133 @@
+//////////////////////////////////////////////////////////////////////
+//
+// File: sndsimd.h
+//
+// Copyright 2016 International Computer Science Institute
+// See the file LICENSE for licensing terms.
+//
+// Vectorized inner loops with runtime CPU dispatch. See sndsimd.cc
+//
+
+#ifndef SNDSIMD_H
+#define SNDSIMD_H
+
+// Instruction set levels, in increasing order.
+
+enum {
+  SIMD_SCALAR = 0,
+  SIMD_SSE,
+  SIMD_AVX2,
+  SIMD_AVX512
+};
+
+int  simd_level();		//  Level in use (best supported by default)
+void simd_set_level(int);	//  Restrict kernels to at most this level
+const char* simd_name(int);	//  Printable name of a level
+
+//
+// Sum scaled inputs into out:
+//
+//   out[j] = 0 + in[0][j]*scales[0] + in[1][j]*scales[1] + ...
+//
+// for 0 <= j < n, summed left to right. Input i only contributes
+// where j < lens[i]. The result is bit-identical at every level.
+//
+
+void mix_accumulate(float* out, long n, int nin, const float* const* in,
+		    const long* lens, const float* scales);
+
+//
+// Sum of a[j]*b[j] for 0 <= j < n. Unlike mix_accumulate(), the order
+// of summation (and so the rounding) depends on the level.
+//
+
+float dot_product(const float* a, const float* b, long n);
+
+//
+// Peak limiting. peak_gains() sets gains[j] to the largest gain that
+// keeps every channel of interleaved frame j within +-ceiling, at
+// most 1. apply_gains() multiplies frame j by gains[j] and clamps the
+// result to +-ceiling, which only catches rounding. Both are
+// bit-identical at every level.
+//
+
+void peak_gains(const float* in, long frames, int channels, float ceiling,
+		float* gains);
+void apply_gains(float* buf, long frames, int channels, const float* gains,
+		 float ceiling);
+
+//
+// Convert between interleaved frames and planar channels. Channel c
+// of the planar data starts at planes + c*stride.
+//
+
+void deinterleave(const float* in, long frames, int channels,
+		  float* planes, long stride);
+void interleave(const float* planes, long stride, long frames, int channels,
+		float* out);
+
+//
+// Moments of x[0..n-1] about shift, for running statistics: sets *sum
+// to the sum of x[j]-shift and *sumsq to the sum of (x[j]-shift)^2,
+// both accumulated in double, and *lo and *hi to the smallest and
+// largest values (+-HUGE_VALF if n is 0). NaNs are skipped by the
+// min and max. As with dot_product(), the rounding of the sums
+// depends on the level.
+//
+
+void block_moments(const float* x, long n, double shift, double* sum,
+		   double* sumsq, float* lo, float* hi);
+
+//
+// Sum of (a[j]-ca)*(b[j]-cb) for 0 <= j < n, accumulated in double,
+// for covariances. The rounding depends on the level.
+//
+
+double cross_moment(const float* a, const float* b, long n, double ca, double cb);
+
+//
+// Exact integer moments of n 16 bit PCM samples at p, little endian
+// unless bigendian is set: the sum, the sum of squares, and the
+// smallest and largest values (32767 and -32768 if n is 0). p need
+// not be aligned. n must be below 2^32, so that the sum of squares
+// fits. The results are the same at every level.
+//
+
+void pcm16_moments(const unsigned char* p, long n, int bigendian,
+		   long long* sum, unsigned long long* sumsq, int* lo, int* hi);
+
+//
+// out[j] = a[j] * b[j] for 0 <= j < n, e.g. to apply a window. out
+// may be a or b. Bit-identical at every level.
+//
+
+void multiply_vectors(float* out, const float* a, const float* b, long n);
+
+//
+// One radix-2 stage of an in-place complex FFT of n points held as
+// separate real and imaginary arrays. For each group of 2*half points
+// starting at g, and 0 <= j < half, with x = re + i*im and
+// w = wr + i*wi,
+//
+//   t = x[g+half+j] * w[j]
+//   x[g+j], x[g+half+j] = x[g+j] + t, x[g+j] - t
+//
+// n and half must be powers of two. Bit-identical at every level.
+//
+
+void fft_stage(float* re, float* im, long n, long half,
+	       const float* wr, const float* wi);
+
+//
+// Compare masks for scanning, one bit per sample: bit j%64 of word
+// j/64 of clip is set where |x[j]| >= level, of zero where x[j] == 0,
+// and of same where x[j] == x[j-1]. x[-1] must be readable (it's the
+// sample before the block). The last word is padded with clear bits
+// if n isn't a multiple of 64. NaNs match nothing. The same at every
+// level.
+//
+
+void sample_masks(const float* x, long n, float level, unsigned long long* clip,
+		  unsigned long long* zero, unsigned long long* same);
+
+#endif // SNDSIMD_H
@@ -12,111 +12,565 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <values.h>
 #include <math.h>
-#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
-#include <assert.h>
 
 #include <sndfile.h>
 
 #include "sndstats.h"
+#include "sndsimd.h"
 
 extern char *ProgName;
 
 //
 // Read the entire file (except for optional margins at the start and
 // end). Returns a jstat instance. If the passed stat is 0, allocate
-// and return a jstat instance that the user must delete.
+// and return a jstat instance that the user must delete. Returns NULL
+// if it can't seek to the start, so that the caller can report it
+// (nothing is allocated then).
 //
 
 jstat* sndstat(SNDFILE* in, SF_INFO* info, const char* fname, 
-	       float skip_time, float end_time, jstat* stat) {
-  const long blocksize = 10000;
-  long nread;
-  float buf[blocksize];
-  int i;
+	       float skip_time, float end_time, jstat* stat, jhist* hist, jcov* cov,
+	       jspec* spec) {
   long skip_frames;
   long end_frame;
-  long cur_frame = 0;
+
+  skip_frames = (long) (info->samplerate * skip_time);
+  end_frame =   (long) (info->samplerate * end_time);
+
+  return sndstat_range(in, info, fname, skip_frames,
+		       (end_frame > 0) ? end_frame : -1, stat, hist, cov, spec);
+} // sndstat()
+
+
+//
+// Read frames start through end-1 (or to the end of the file if end
+// is negative). Returns a jstat instance as for sndstat(). The range
+// starts a new run of segments in spec.
+//
+
+jstat* sndstat_range(SNDFILE* in, SF_INFO* info, const char* /* fname */,
+		     long start, long end, jstat* stat, jhist* hist, jcov* cov,
+		     jspec* spec) {
+  const long blocksize = 10000;
+  float buf[blocksize];
+  long frames = blocksize / info->channels;
+  long want, nread;
+  long cur_frame;
+  jstat* mine = NULL;
 
   if (stat == 0) {
-    stat = new jstat();
+    stat = mine = new jstat();
   }
 
-  skip_frames = (long) (info->samplerate * skip_time);
-  end_frame =   (long) (info->samplerate * end_time);
+  // Seek even to frame 0, since in may already have been read from
+  // (sndindex_range() reads several ranges from one handle). A stream
+  // that can't seek has to be fresh if start is 0.
 
-  if (skip_frames > 0) {
-    if (sf_seek(in, skip_frames, SEEK_SET) == -1) {
-      fprintf(stderr, "%s: seek failed for file %s.\n", ProgName, fname);
-      exit(1);
+  if (start < 0) {
+    start = 0;
+  }
+  if (start > 0 || info->seekable) {
+    if (sf_seek(in, start, SEEK_SET) == -1) {
+      delete mine;
+      return NULL;
     }
-    cur_frame = skip_frames;
   }
-  
-  do {
-    nread = sf_read_float(in, buf, blocksize);
-    for (i = 0; i < nread; i++) {
-      stat->datum(buf[i]);
+  cur_frame = start;
+  if (spec) spec->restart();
+
+  for (;;) {
+    want = frames;
+    if (end >= 0 && end - cur_frame < want) {
+      want = end - cur_frame;
     }
+    if (want <= 0) {
+      break;
+    }
+    nread = sf_readf_float(in, buf, want);
+    stat->data(buf, nread * info->channels);
+    if (hist) hist->data(buf, nread * info->channels);
+    if (cov) cov->data(buf, nread);
+    if (spec) spec->data(buf, nread);
     cur_frame += nread;
-  } while (nread == blocksize && (end_frame <= 0 || cur_frame < end_frame));
+    if (nread < want) {
+      break;
+    }
+  }
 
   return stat;
-} // sndstat()
+} // sndstat_range()
+
+
+//
+// sndstat_segments() visits the segments in order of their starts,
+// keeping a list of the ones that cover the current block. A block
+// never runs past the start of the next segment, so each segment
+// joins the list exactly at its first frame.
+//
+
+struct segment_span {
+  long start;
+  long end;
+  long index;
+};
+
+static int segment_compare(const void* a, const void* b) {
+  const segment_span* x = (const segment_span*) a;
+  const segment_span* y = (const segment_span*) b;
+
+  if (x->start != y->start) {
+    return (x->start < y->start) ? -1 : 1;
+  }
+  return (x->index < y->index) ? -1 : (x->index > y->index);
+}  // segment_compare()
+
+int sndstat_segments(SNDFILE* in, SF_INFO* info, const char* /* fname */, long n,
+		     const long* starts, const long* ends, jstat* stats) {
+  const long blocksize = 10000;
+  float buf[blocksize];
+  long frames = blocksize / info->channels;
+  segment_span* spans;
+  segment_span** active;
+  long i, k, next, nactive, cur, want, nread, stop;
+
+  spans = new segment_span[n];
+  active = new segment_span*[n];
+  for (i = 0; i < n; i++) {
+    spans[i].start = (starts[i] > 0) ? starts[i] : 0;
+    spans[i].end = (ends[i] < 0 || ends[i] > info->frames) ? info->frames : ends[i];
+    spans[i].index = i;
+  }
+  qsort(spans, n, sizeof(segment_span), segment_compare);
+
+  cur = 0;
+  next = 0;
+  nactive = 0;
+  for (;;) {
+    while (next < n && spans[next].start <= cur) {
+      if (spans[next].end > cur) {
+	active[nactive++] = &spans[next];
+      }
+      next++;
+    }
+    if (nactive == 0) {
+      if (next == n || spans[next].start >= info->frames) {
+	break;
+      }
+
+      // Nothing to read until the next segment starts.
+
+      if (info->seekable) {
+	if (sf_seek(in, spans[next].start, SEEK_SET) == -1) {
+	  delete [] spans;
+	  delete [] active;
+	  return 0;
+	}
+	cur = spans[next].start;
+	continue;
+      }
+    }
+
+    want = frames;
+    if (next < n && spans[next].start - cur < want) {
+      want = spans[next].start - cur;
+    }
+    nread = sf_readf_float(in, buf, want);
+    if (nread <= 0) {
+      break;
+    }
+    for (k = 0; k < nactive; k++) {
+      stop = active[k]->end - cur;
+      if (stop > nread) stop = nread;
+      stats[active[k]->index].data(buf, stop * info->channels);
+    }
+    cur += nread;
+    for (k = 0; k < nactive; ) {
+      if (active[k]->end <= cur) {
+	active[k] = active[--nactive];
+      } else {
+	k++;
+      }
+    }
+    if (nread < want) {
+      break;
+    }
+  }
 
+  delete [] spans;
+  delete [] active;
+  return 1;
+}  // sndstat_segments()
 
 //
-// Read a random sampling from the file.
-// Returns a jstat instance. If the passed stat is 0, allocate
-// and return a jstat instance that the user must delete.
+// Start frames of count excerpts of size frames each from a file of
+// frames frames. The file is split into count equal strata, and each
+// excerpt starts at a point within its stratum drawn from seed
+// (splitmix64), so the starts come out in increasing order and the
+// excerpts don't overlap unless count*size exceeds frames.
+//
+
+void sndstat_strata(long frames, long size, long count, unsigned long long seed,
+		    long* starts) {
+  unsigned long long x = seed, z;
+  long k, lo, hi;
+
+  for (k = 0; k < count; k++) {
+    lo = (long) ((double) frames * k / count);
+    hi = (long) ((double) frames * (k + 1) / count) - size;	// Last usable start
+    x += 0x9e3779b97f4a7c15ULL;
+    z = x;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    starts[k] = (hi > lo) ? lo + (long) (z % (unsigned long long) (hi - lo + 1)) : lo;
+  }
+}  // sndstat_strata()
+
 //
-// Initialized the random seed from the current time.
+// Read excerpts of random_size seconds adding up to random_sample
+// seconds, placed by sndstat_strata(), so the same seed always reads
+// the same audio and every seek is forward. If that's at least the
+// whole file, the whole file is read instead. Returns a jstat instance
+// (or NULL) as for sndstat().
 //
 
 jstat* sndstat_random(SNDFILE* in, SF_INFO* info, const char* fname, float random_sample,
-		      float random_size, jstat* stat) {
-  long blocksize;
-  long nread;
-  float* buf;
-  int i;
-  long to_read;
-  long random_frame;
-  struct timeval tp;
+		      float random_size, jstat* stat, jhist* hist,
+		      unsigned long long seed, jcov* cov, jspec* spec) {
+  long size, count, k;
+  long* starts;
+  jstat* mine = NULL;
 
   if (stat == 0) {
-    stat = new jstat();
+    stat = mine = new jstat();
   }
 
-  gettimeofday(&tp, NULL);
-  srandom(tp.tv_usec);
-  
-  // Total number of frames to be read
-  to_read = (long) (info->samplerate * random_sample); 
-
-  // Number of frames in one sample
-  blocksize = (long) (info->samplerate * random_size);
-  buf = new float[blocksize];
-  assert(buf);
+  // Number of frames in one excerpt, and the number of excerpts
+  size = (long) (info->samplerate * random_size);
+  if (size < 1) size = 1;
+  count = (long) ceil(info->samplerate * random_sample / size);
 
-  while (to_read > 0) {
-    random_frame = ((long long) random()) * info->frames / INT_MAX;
-    if (sf_seek(in, random_frame, SEEK_SET) == -1) {
-      fprintf(stderr, "%s: seek failed for file %s.\n", ProgName, fname);
-      exit(1);
+  if (count * size >= info->frames) {
+    if (sndstat_range(in, info, fname, 0, -1, stat, hist, cov, spec) == NULL) {
+      delete mine;
+      return NULL;
     }
-    nread = sf_read_float(in, buf, blocksize);
-    for (i = 0; i < nread; i++) {
-      stat->datum(buf[i]);
+    return stat;
+  }
+
+  starts = new long[count];
+  sndstat_strata(info->frames, size, count, seed, starts);
+  for (k = 0; k < count; k++) {
+    if (sndstat_range(in, info, fname, starts[k], starts[k] + size, stat, hist, cov,
+		      spec) == NULL) {
+      delete [] starts;
+      delete mine;
+      return NULL;
     }
-    to_read -= nread;
   }
-  delete [] buf;
+  delete [] starts;
   
   return stat;
 }  // sndstat_random()
 
+//////////////////////////////////////////////////////////////////////
+//
+// Integer PCM fast path
+//
+// libsndfile converts every sample to float, and jstat then works in
+// double. For plain 16 and 24 bit PCM, it's quicker to map the file and
+// sum the integers themselves, exactly, and only scale to libsndfile's
+// float range (-1.0 to 1.0) at the end. The file's header is parsed
+// here, and used only if it agrees with what libsndfile found.
+//
+
+struct pcm_layout {
+  long offset;			//  Byte offset of the first sample
+  long frames;
+  int  channels;
+  int  bytes;			//  Bytes per sample
+  int  bigendian;
+};
+
+static unsigned get16le(const unsigned char* p) {
+  return p[0] | (p[1] << 8);
+}  // get16le()
+
+static unsigned long get32le(const unsigned char* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long) p[3] << 24);
+}  // get32le()
+
+//
+// RIFF WAVE: PCM (format 1, or WAVE_FORMAT_EXTENSIBLE with a PCM
+// subformat) and the first data chunk.
+//
+
+static int wav_layout(const unsigned char* map, long size, pcm_layout* pcm) {
+  long pos, len, fmtlen = 0, datalen = -1;
+  unsigned tag, align = 0;
+  const unsigned char* fmt = 0;
+
+  if (size < 12 || memcmp(map, "RIFF", 4) != 0 || memcmp(map + 8, "WAVE", 4) != 0) {
+    return 0;
+  }
+  for (pos = 12; pos + 8 <= size; pos += 8 + len + (len & 1)) {
+    len = get32le(map + pos + 4);
+    if (memcmp(map + pos, "fmt ", 4) == 0 && len >= 16 && pos + 8 + len <= size) {
+      fmt = map + pos + 8;
+      fmtlen = len;
+    } else if (memcmp(map + pos, "data", 4) == 0) {
+      pcm->offset = pos + 8;
+      datalen = len;
+      break;
+    }
+  }
+  if (fmt == 0 || datalen < 0) {
+    return 0;
+  }
+  tag = get16le(fmt);
+  if (tag == 0xfffe) {
+    if (fmtlen < 40) {
+      return 0;			// Too short to hold the subformat
+    }
+    tag = get16le(fmt + 24);	// First word of the subformat GUID
+  }
+  if (tag != 1) {
+    return 0;
+  }
+  pcm->channels = get16le(fmt + 2);
+  align = get16le(fmt + 12);
+  pcm->bytes = (get16le(fmt + 14) + 7) / 8;
+  pcm->bigendian = 0;
+  if (pcm->channels < 1 || align != (unsigned) pcm->channels * pcm->bytes) {
+    return 0;
+  }
+  if (pcm->offset + datalen > size) {
+    datalen = size - pcm->offset;	// Truncated file
+  }
+  pcm->frames = datalen / align;
+  return 1;
+}  // wav_layout()
+
+//
+// NIST SPHERE: a text header of "name -type value" lines, of the size
+// given on its second line.
+//
+
+static int sph_layout(const unsigned char* map, long size, pcm_layout* pcm) {
+  char head[4096], *line, *save;
+  char name[64], type[8], value[64];
+  long hsize, count = -1, len;
+  int coding_ok = 1, order = 0;
+
+  if (size < 16 || memcmp(map, "NIST_1A\n", 8) != 0) {
+    return 0;
+  }
+  len = (size < (long) sizeof(head) - 1) ? size : (long) sizeof(head) - 1;
+  memcpy(head, map, len);
+  head[len] = '\0';
+  if (sscanf(head + 8, "%ld", &hsize) != 1 || hsize < 16 || hsize > len) {
+    return 0;
+  }
+  head[hsize] = '\0';
+
+  pcm->channels = 1;
+  pcm->bytes = 0;
+  for (line = strtok_r(head, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+    if (strncmp(line, "end_head", 8) == 0) {
+      break;
+    }
+    if (sscanf(line, "%63s %7s %63s", name, type, value) != 3) {
+      continue;
+    }
+    if (strcmp(name, "sample_coding") == 0) {
+      coding_ok = (strcmp(value, "pcm") == 0);
+    } else if (strcmp(name, "sample_n_bytes") == 0) {
+      pcm->bytes = atoi(value);
+    } else if (strcmp(name, "channel_count") == 0) {
+      pcm->channels = atoi(value);
+    } else if (strcmp(name, "sample_count") == 0) {
+      count = atol(value);
+    } else if (strcmp(name, "sample_byte_format") == 0) {
+      order = (strcmp(value, "01") == 0) ? 1 : (strcmp(value, "10") == 0) ? 2 : 0;
+    }
+  }
+  if (!coding_ok || order == 0 || count < 0 || pcm->channels < 1) {
+    return 0;
+  }
+  pcm->offset = hsize;
+  pcm->bigendian = (order == 2);
+  pcm->frames = count;
+  if (pcm->offset + count * pcm->channels * pcm->bytes > size) {
+    return 0;
+  }
+  return 1;
+}  // sph_layout()
+
+//
+// 24 bit samples, in blocks short enough that the sums fit in 64 bits.
+//
+
+static void pcm24_moments(const unsigned char* p, long n, int bigendian,
+			  long long* sum, unsigned long long* sumsq, int* lo, int* hi) {
+  long long s = 0, x;
+  unsigned long long q = 0;
+  int l = 0x7fffff, h = -0x800000;
+  long j;
+
+  for (j = 0; j < n; j++, p += 3) {
+    if (bigendian) {
+      x = (int) (((unsigned) p[0] << 24) | (p[1] << 16) | (p[2] << 8)) >> 8;
+    } else {
+      x = (int) (((unsigned) p[2] << 24) | (p[1] << 16) | (p[0] << 8)) >> 8;
+    }
+    s += x;
+    q += x * x;
+    if (x < l) l = x;
+    if (x > h) h = x;
+  }
+  *sum = s;
+  *sumsq = q;
+  *lo = l;
+  *hi = h;
+}  // pcm24_moments()
+
+//
+// Add n samples to hist, through a small buffer.
+//
+
+static void pcm_hist(const unsigned char* p, long n, int bytes, int bigendian,
+		     jhist* hist) {
+  const long bufsize = 4096;
+  short s16[bufsize];
+  float f24[bufsize];
+  long j, m;
+  int x;
+
+  for (; n > 0; n -= m) {
+    m = (n < bufsize) ? n : bufsize;
+    for (j = 0; j < m; j++, p += bytes) {
+      if (bytes == 2) {
+	s16[j] = bigendian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+      } else {
+	if (bigendian) {
+	  x = (int) (((unsigned) p[0] << 24) | (p[1] << 16) | (p[2] << 8)) >> 8;
+	} else {
+	  x = (int) (((unsigned) p[2] << 24) | (p[1] << 16) | (p[0] << 8)) >> 8;
+	}
+	f24[j] = x * (1.0f / 0x800000);
+      }
+    }
+    if (bytes == 2) {
+      hist->data16(s16, m);
+    } else {
+      hist->data(f24, m);
+    }
+  }
+}  // pcm_hist()
+
+int sndstat_pcm(const char* fname, SF_INFO* info, long start, long end,
+		jstat* stat, jhist* hist) {
+  const long blocksize = 1L << 16;	// Samples (2^16 * 2^46 < 2^63)
+  int fd, lo, hi, minval = 0, maxval = 0;
+  struct stat sb;
+  unsigned char* map;
+  const unsigned char* p;
+  pcm_layout pcm;
+  long n, m, left;
+  long long bsum;
+  unsigned long long bsumsq;
+  __int128 sum = 0;
+  unsigned __int128 sumsq = 0;
+  long double mean, scale;
+  jstat part;
+  int ok;
+
+  switch (info->format & SF_FORMAT_TYPEMASK) {
+  case SF_FORMAT_WAV:
+  case SF_FORMAT_WAVEX:
+  case SF_FORMAT_NIST:
+    break;
+  default:
+    return 0;
+  }
+  switch (info->format & SF_FORMAT_SUBMASK) {
+  case SF_FORMAT_PCM_16:
+  case SF_FORMAT_PCM_24:
+    break;
+  default:
+    return 0;
+  }
+
+  // A start past the end is left to sndstat_range(), so that it's
+  // reported the same way whichever path reads the file.
+
+  if (start > info->frames) {
+    return 0;
+  }
+
+  if ((fd = open(fname, O_RDONLY)) < 0) {
+    return 0;
+  }
+  if (fstat(fd, &sb) < 0 || sb.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  map = (unsigned char*) mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return 0;
+  }
+
+  ok = (wav_layout(map, sb.st_size, &pcm) || sph_layout(map, sb.st_size, &pcm))
+    && pcm.channels == info->channels && pcm.frames == info->frames
+    && pcm.bytes == (((info->format & SF_FORMAT_SUBMASK) == SF_FORMAT_PCM_16) ? 2 : 3);
+
+  if (ok) {
+    if (end < 0 || end > pcm.frames) end = pcm.frames;
+    if (start < 0) start = 0;
+    n = (end > start) ? (end - start) * pcm.channels : 0;
+    p = map + pcm.offset + start * pcm.channels * pcm.bytes;
+    madvise(map, sb.st_size, MADV_SEQUENTIAL);
+
+    for (left = n; left > 0; left -= m, p += m * pcm.bytes) {
+      m = (left < blocksize) ? left : blocksize;
+      if (pcm.bytes == 2) {
+	pcm16_moments(p, m, pcm.bigendian, &bsum, &bsumsq, &lo, &hi);
+      } else {
+	pcm24_moments(p, m, pcm.bigendian, &bsum, &bsumsq, &lo, &hi);
+      }
+      if (hist) {
+	pcm_hist(p, m, pcm.bytes, pcm.bigendian, hist);
+      }
+      sum += bsum;
+      sumsq += bsumsq;
+      if (left == n || lo < minval) minval = lo;
+      if (left == n || hi > maxval) maxval = hi;
+    }
+
+    // Only the deviations from the mean need scaling. Long double keeps
+    // 64 bits of the integer sums, which is as exact as it matters.
+
+    if (n > 0) {
+      scale = (pcm.bytes == 2) ? 1.0L / 0x8000 : 1.0L / 0x800000;
+      mean = (long double) sum / n;
+      part.set(n, mean * scale, ((long double) sumsq - mean * sum) * scale * scale,
+	       minval * scale, maxval * scale);
+      stat->merge(part);
+    }
+  }
+  munmap(map, sb.st_size);
+  return ok;
+}  // sndstat_pcm()
+
 //////////////////////////////////////////////////////////////////////
 //
 // jstat methods
@@ -127,27 +581,104 @@ jstat::jstat() {
 }  //  jstat()
 
 void jstat::clear() {
-  sum_ = 0.0;
-  sum2_ = 0.0;
+  mean_ = 0.0;
+  m2_ = 0.0;
   n_ = 0;
   min_ = MAXDOUBLE;
-  max_ = MINDOUBLE;
+  max_ = -MAXDOUBLE;
 }  // clear
 
 void jstat::datum(double val) {
-  sum_ += val;
-  sum2_ += val*val;
+  double delta = val - mean_;
+
   n_++;
+  mean_ += delta / n_;
+  m2_ += delta * (val - mean_);
   if (val < min_) min_ = val;
   if (val > max_) max_ = val;
 }  //  datum
 
+//
+// The block's sums are taken about the current mean (or its first
+// value), which keeps them small, and then merged as in merge(). The
+// result matches calling datum() on each value up to rounding.
+//
+
+void jstat::data(const float* x, size_t n) {
+  double shift, sum, sumsq, mean, m2;
+  float lo, hi;
+  long long total;
+
+  if (n == 0) {
+    return;
+  }
+  shift = (n_ > 0) ? mean_ : x[0];
+  block_moments(x, n, shift, &sum, &sumsq, &lo, &hi);
+  mean = sum / n;		// Relative to shift
+  m2 = sumsq - sum * mean;
+  if (m2 < 0.0) m2 = 0.0;
+
+  if (n_ == 0) {
+    mean_ = shift + mean;
+    m2_ = m2;
+  } else {
+    // shift is mean_, so mean is the difference between the means.
+    total = n_ + n;
+    m2_ += m2 + mean * mean * ((double) n_ * n / total);
+    mean_ += mean * ((double) n / total);
+  }
+  n_ += n;
+  if (lo < min_) min_ = lo;
+  if (hi > max_) max_ = hi;
+}  // data()
+
+void jstat::set(long long n, double mean, double m2, double min, double max) {
+  n_ = n;
+  mean_ = mean;
+  m2_ = (m2 > 0.0) ? m2 : 0.0;
+  min_ = min;
+  max_ = max;
+}  // set()
+
+void jstat::get(long long* n, double* mean, double* m2, double* min, double* max) {
+  *n = n_;
+  *mean = mean_;
+  *m2 = m2_;
+  *min = min_;
+  *max = max_;
+}  // get()
+
+//
+// Chan et al.'s pairwise update. The result doesn't depend on how the
+// data was split, up to rounding, so merging is safe in any order.
+//
+
+void jstat::merge(const jstat& other) {
+  long long n;
+  double delta;
+
+  if (other.n_ == 0) {
+    return;
+  }
+  if (n_ == 0) {
+    *this = other;
+    return;
+  }
+  n = n_ + other.n_;
+  delta = other.mean_ - mean_;
+  mean_ += delta * ((double) other.n_ / n);
+  m2_ += other.m2_ + delta * delta * ((double) n_ * other.n_ / n);
+  n_ = n;
+  if (other.min_ < min_) min_ = other.min_;
+  if (other.max_ > max_) max_ = other.max_;
+}  // merge()
+
 double jstat::mean() {
   if (n_ <= 0) {
     fprintf(stderr, "Not enough data to determine mean\n");
     exit(1);
   }
-  return (sum_ / n_);
+  return mean_;
 }  // mean()
 
 double jstat::std() {
@@ -155,7 +686,7 @@ double jstat::std() {
     fprintf(stderr, "Not enough data to determine standard deviation\n");
     exit(1);
   }
-  return sqrt((sum2_ - (sum_ * sum_ / n_) ) / (n_ - 1));
+  return sqrt(m2_ / (n_ - 1));
 }  //  std()
 
 double jstat::min() {
@@ -174,6 +705,682 @@ double jstat::max() {
   return max_;
 }  // max()
 
-int jstat::n() {
+long long jstat::n() {
   return n_;
 }  // n()
+
+//
+// %.17g round-trips a double exactly, so a saved and reloaded jstat
+// gives the same results as the original.
+//
+
+void jstat::save(FILE* fp) {
+  fprintf(fp, "%lld %.17g %.17g %.17g %.17g", n_, mean_, m2_, min_, max_);
+}  // save()
+
+int jstat::load(const char* str) {
+  jstat tmp;
+  if (sscanf(str, "%lld %lf %lf %lf %lf", &tmp.n_, &tmp.mean_, &tmp.m2_,
+	     &tmp.min_, &tmp.max_) != 5 || tmp.n_ < 0 || tmp.m2_ < 0.0) {
+    return 0;
+  }
+  *this = tmp;
+  return 1;
+}  // load()
+
+//////////////////////////////////////////////////////////////////////
+//
+// jhist methods
+//
+// The sketch has a bucket for each k from JHIST_KMIN to JHIST_KMAX,
+// holding magnitudes in (gamma^(k-1), gamma^k], where gamma is
+// (1+alpha)/(1-alpha). buckets_ has the negative values first, from
+// the most negative, then zero, then the positive values, so that
+// it's in increasing order of value.
+//
+
+#define JHIST_GAMMA ((1.0 + JHIST_ALPHA) / (1.0 - JHIST_ALPHA))
+#define JHIST_LEVELS (65536)
+
+static const double jhist_invlog = 1.0 / log(JHIST_GAMMA);
+static const int jhist_kmin = (int) ceil(log(JHIST_MIN) * jhist_invlog);
+static const int jhist_kmax = (int) ceil(log(JHIST_MAX) * jhist_invlog);
+static const int jhist_nk = jhist_kmax - jhist_kmin + 1;	//  Buckets for each sign
+
+jhist::jhist() {
+  levels_ = 0;
+  buckets_ = 0;
+  n_ = 0;
+}  // jhist()
+
+jhist::~jhist() {
+  delete [] levels_;
+  delete [] buckets_;
+}  // ~jhist()
+
+void jhist::clear() {
+  delete [] levels_;
+  delete [] buckets_;
+  levels_ = 0;
+  buckets_ = 0;
+  n_ = 0;
+}  // clear()
+
+int jhist::bucket(double x) {
+  double a = fabs(x);
+  int k;
+
+  if (a < JHIST_MIN) {
+    return jhist_nk;
+  }
+  k = (a >= JHIST_MAX) ? jhist_kmax : (int) ceil(log(a) * jhist_invlog);
+  if (k < jhist_kmin) k = jhist_kmin;
+  if (k > jhist_kmax) k = jhist_kmax;
+  return (x < 0.0) ? jhist_kmax - k : jhist_nk + 1 + k - jhist_kmin;
+}  // bucket()
+
+//
+// The value within relative error alpha of everything in bucket b.
+//
+
+double jhist::value(int b) {
+  double v;
+
+  if (b == jhist_nk) {
+    return 0.0;
+  }
+  if (b < jhist_nk) {
+    v = 2.0 * pow(JHIST_GAMMA, jhist_kmax - b) / (JHIST_GAMMA + 1.0);
+    return -v;
+  }
+  return 2.0 * pow(JHIST_GAMMA, b - jhist_nk - 1 + jhist_kmin) / (JHIST_GAMMA + 1.0);
+}  // value()
+
+void jhist::to_sketch() {
+  int k;
+
+  buckets_ = new long long[2 * jhist_nk + 1];
+  memset(buckets_, 0, (2 * jhist_nk + 1) * sizeof(long long));
+  if (levels_) {
+    for (k = 0; k < JHIST_LEVELS; k++) {
+      if (levels_[k]) {
+	buckets_[bucket((k - 32768) / 32768.0)] += levels_[k];
+      }
+    }
+    delete [] levels_;
+    levels_ = 0;
+  }
+}  // to_sketch()
+
+void jhist::data(const float* x, size_t n) {
+  size_t i = 0;
+  float v;
+  int k;
+
+  if (!buckets_) {
+    if (!levels_) {
+      levels_ = new long long[JHIST_LEVELS];
+      memset(levels_, 0, JHIST_LEVELS * sizeof(long long));
+    }
+    for (; i < n; i++) {
+      v = x[i] * 32768.0f;
+      if (!(v >= -32768.0f && v <= 32767.0f) || (k = (int) v) != v) {
+	to_sketch();
+	break;
+      }
+      levels_[k + 32768]++;
+      n_++;
+    }
+  }
+  for (; i < n; i++) {
+    if (!isnan(x[i])) {
+      buckets_[bucket(x[i])]++;
+      n_++;
+    }
+  }
+}  // data()
+
+void jhist::data16(const short* x, size_t n) {
+  size_t i;
+
+  if (buckets_) {
+    for (i = 0; i < n; i++) {
+      buckets_[bucket(x[i] / 32768.0)]++;
+    }
+  } else {
+    if (!levels_) {
+      levels_ = new long long[JHIST_LEVELS];
+      memset(levels_, 0, JHIST_LEVELS * sizeof(long long));
+    }
+    for (i = 0; i < n; i++) {
+      levels_[x[i] + 32768]++;
+    }
+  }
+  n_ += n;
+}  // data16()
+
+void jhist::merge(const jhist& other) {
+  int k;
+
+  if (other.n_ == 0) {
+    return;
+  }
+  if (!buckets_ && !other.buckets_) {
+    if (!levels_) {
+      levels_ = new long long[JHIST_LEVELS];
+      memset(levels_, 0, JHIST_LEVELS * sizeof(long long));
+    }
+    for (k = 0; k < JHIST_LEVELS; k++) {
+      levels_[k] += other.levels_[k];
+    }
+  } else {
+    if (!buckets_) {
+      to_sketch();
+    }
+    if (other.buckets_) {
+      for (k = 0; k < 2 * jhist_nk + 1; k++) {
+	buckets_[k] += other.buckets_[k];
+      }
+    } else {
+      for (k = 0; k < JHIST_LEVELS; k++) {
+	if (other.levels_[k]) {
+	  buckets_[bucket((k - 32768) / 32768.0)] += other.levels_[k];
+	}
+      }
+    }
+  }
+  n_ += other.n_;
+}  // merge()
+
+//
+// The nearest rank: the smallest value with at least a fraction q of
+// the data at or below it.
+//
+
+double jhist::quantile(double q) {
+  long long rank, seen = 0;
+  int k;
+
+  if (n_ <= 0) {
+    fprintf(stderr, "Not enough data to determine quantile\n");
+    exit(1);
+  }
+  rank = (long long) ceil(q * n_);
+  if (rank < 1) rank = 1;
+  if (rank > n_) rank = n_;
+  if (!buckets_) {
+    for (k = 0; k < JHIST_LEVELS - 1; k++) {
+      seen += levels_[k];
+      if (seen >= rank) break;
+    }
+    return (k - 32768) / 32768.0;
+  }
+  for (k = 0; k < 2 * jhist_nk; k++) {
+    seen += buckets_[k];
+    if (seen >= rank) break;
+  }
+  return value(k);
+}  // quantile()
+
+long long jhist::above(double level) {
+  long long count = 0;
+  int k;
+
+  if (!buckets_) {
+    for (k = 0; k < JHIST_LEVELS && levels_; k++) {
+      if (fabs((k - 32768) / 32768.0) >= level) count += levels_[k];
+    }
+  } else {
+    for (k = 0; k < 2 * jhist_nk + 1; k++) {
+      if (fabs(value(k)) >= level) count += buckets_[k];
+    }
+  }
+  return count;
+}  // above()
+
+long long jhist::n() {
+  return n_;
+}  // n()
+
+int jhist::exact() {
+  return buckets_ == 0;
+}  // exact()
+
+//////////////////////////////////////////////////////////////////////
+//
+// jcov methods
+//
+// Frames are deinterleaved JCOV_BLOCK at a time, and each block's
+// moments are taken about the current means (as in jstat::data()) and
+// then folded in with the pairwise update of merge():
+//
+//   com[i][j] += M[i][j] + d[i]*d[j]*n*m/(n+m)
+//
+// where M is the block's own co-moment matrix and d the difference
+// between its means and the running ones.
+//
+
+#define JCOV_BLOCK (4096)
+
+jcov::jcov(int channels, int cross) {
+  channels_ = channels;
+  cross_ = cross;
+  mean_ = new double[channels_];
+  com_ = new double[cross_ ? channels_ * channels_ : channels_];
+  min_ = new double[channels_];
+  max_ = new double[channels_];
+  planes_ = new float[channels_ * JCOV_BLOCK];
+  clear();
+}  // jcov()
+
+jcov::~jcov() {
+  delete [] mean_;
+  delete [] com_;
+  delete [] min_;
+  delete [] max_;
+  delete [] planes_;
+}  // ~jcov()
+
+void jcov::clear() {
+  int i;
+
+  for (i = 0; i < channels_; i++) {
+    mean_[i] = 0.0;
+    min_[i] = MAXDOUBLE;
+    max_[i] = -MAXDOUBLE;
+  }
+  for (i = 0; i < (cross_ ? channels_ * channels_ : channels_); i++) {
+    com_[i] = 0.0;
+  }
+  n_ = 0;
+}  // clear()
+
+//
+// Fold in m frames with the given means, co-moments (in the same
+// layout as com_) and extremes.
+//
+
+void jcov::update(long long m, const double* mean, const double* com,
+		  const float* lo, const float* hi) {
+  int i, j, c = channels_;
+  double f, *d;
+
+  if (m == 0) {
+    return;
+  }
+  d = new double[c];
+  f = (double) n_ * m / (n_ + m);
+  for (i = 0; i < c; i++) {
+    d[i] = mean[i] - mean_[i];
+  }
+  if (cross_) {
+    for (i = 0; i < c; i++) {
+      for (j = 0; j < c; j++) {
+	com_[i * c + j] += com[i * c + j] + d[i] * d[j] * f;
+      }
+    }
+  } else {
+    for (i = 0; i < c; i++) {
+      com_[i] += com[i] + d[i] * d[i] * f;
+    }
+  }
+  for (i = 0; i < c; i++) {
+    mean_[i] += d[i] * ((double) m / (n_ + m));
+    if (lo[i] < min_[i]) min_[i] = lo[i];
+    if (hi[i] > max_[i]) max_[i] = hi[i];
+  }
+  n_ += m;
+  delete [] d;
+}  // update()
+
+void jcov::data(const float* x, size_t n) {
+  int i, j, c = channels_;
+  long m;
+  double *shift, *sum, *mean, *com;
+  float *lo, *hi;
+  const float* a;
+
+  shift = new double[c];
+  sum = new double[c];
+  mean = new double[c];
+  com = new double[cross_ ? c * c : c];
+  lo = new float[c];
+  hi = new float[c];
+
+  for (; n > 0; n -= m, x += m * c) {
+    m = (n < JCOV_BLOCK) ? n : JCOV_BLOCK;
+    deinterleave(x, m, c, planes_, JCOV_BLOCK);
+
+    for (i = 0; i < c; i++) {
+      a = planes_ + i * JCOV_BLOCK;
+      shift[i] = (n_ > 0) ? mean_[i] : a[0];
+      block_moments(a, m, shift[i], &sum[i], &com[cross_ ? i * c + i : i],
+		    &lo[i], &hi[i]);
+    }
+    if (cross_) {
+      for (i = 0; i < c; i++) {
+	for (j = i + 1; j < c; j++) {
+	  com[i * c + j] = com[j * c + i] =
+	    cross_moment(planes_ + i * JCOV_BLOCK, planes_ + j * JCOV_BLOCK, m,
+			 shift[i], shift[j]);
+	}
+      }
+    }
+
+    // Sums about the shifts to moments about the block's own means.
+
+    for (i = 0; i < c; i++) {
+      mean[i] = shift[i] + sum[i] / m;
+    }
+    if (cross_) {
+      for (i = 0; i < c; i++) {
+	for (j = 0; j < c; j++) {
+	  com[i * c + j] -= sum[i] * sum[j] / m;
+	}
+      }
+    } else {
+      for (i = 0; i < c; i++) {
+	com[i] -= sum[i] * sum[i] / m;
+      }
+    }
+    if (n_ == 0) {
+      for (i = 0; i < c; i++) {
+	mean_[i] = mean[i];
+      }
+    }
+    update(m, mean, com, lo, hi);
+  }
+
+  delete [] shift;
+  delete [] sum;
+  delete [] mean;
+  delete [] com;
+  delete [] lo;
+  delete [] hi;
+}  // data()
+
+int jcov::merge(const jcov& other) {
+  float *lo, *hi;
+  int i;
+
+  if (other.channels_ != channels_ || other.cross_ != cross_) {
+    return 0;
+  }
+  if (other.n_ == 0) {
+    return 1;
+  }
+  lo = new float[channels_];
+  hi = new float[channels_];
+  for (i = 0; i < channels_; i++) {
+    lo[i] = other.min_[i];
+    hi[i] = other.max_[i];
+    if (n_ == 0) mean_[i] = other.mean_[i];
+  }
+  update(other.n_, other.mean_, other.com_, lo, hi);
+  delete [] lo;
+  delete [] hi;
+  return 1;
+}  // merge()
+
+jstat jcov::channel(int i) {
+  jstat s;
+
+  s.set(n_, mean_[i], com_[cross_ ? i * channels_ + i : i], min_[i], max_[i]);
+  return s;
+}  // channel()
+
+double jcov::cov(int i, int j) {
+  if (n_ <= 1) {
+    fprintf(stderr, "Not enough data to determine covariance\n");
+    exit(1);
+  }
+  if (!cross_ && i != j) {
+    fprintf(stderr, "Covariance between channels wasn't kept\n");
+    exit(1);
+  }
+  return com_[cross_ ? i * channels_ + j : i] / (n_ - 1);
+}  // cov()
+
+double jcov::corr(int i, int j) {
+  double d = cov(i, i) * cov(j, j);
+
+  return (d > 0.0) ? cov(i, j) / sqrt(d) : 0.0;
+}  // corr()
+
+long long jcov::n() {
+  return n_;
+}  // n()
+
+//////////////////////////////////////////////////////////////////////
+//
+// jspec methods
+//
+// The size point real FFT of a segment x is done as a size/2 point
+// complex FFT of z[n] = x[2n] + i*x[2n+1], which is then split into
+// the transforms of the even and odd points:
+//
+//   X[k] = E[k] + exp(-2 pi i k/size) * O[k]
+//   E[k] = (Z[k] + conj(Z[size/2-k])) / 2
+//   O[k] = (Z[k] - conj(Z[size/2-k])) / 2i
+//
+// The windowing and the butterflies are vector kernels (see
+// sndsimd.cc). Each jspec has its own tables and scratch, so several
+// can run on separate threads.
+//
+// psd() is scaled so that summing it over all bins, times the bin
+// width, gives the mean square of the data (Parseval's theorem, with
+// the window's power taken out). A tone or DC spreads over the Hann
+// window's main lobe of +-2 bins, which tone() adds up.
+//
+
+jspec::jspec(int size, int samplerate, int channels) {
+  int half = size / 2;
+  int h, j, k, bits;
+  double a;
+
+  size_ = size;
+  samplerate_ = samplerate;
+  channels_ = channels;
+
+  window_ = new float[size_];
+  wsum2_ = 0.0;
+  for (j = 0; j < size_; j++) {
+    window_[j] = (float) (0.5 - 0.5 * cos(2.0 * M_PI * j / size_));
+    wsum2_ += (double) window_[j] * window_[j];
+  }
+
+  twr_ = new float[half];
+  twi_ = new float[half];
+  for (h = 1; h < half; h *= 2) {
+    for (j = 0; j < h; j++) {
+      a = -M_PI * j / h;
+      twr_[h - 1 + j] = (float) cos(a);
+      twi_[h - 1 + j] = (float) sin(a);
+    }
+  }
+
+  rcos_ = new double[half];
+  rsin_ = new double[half];
+  for (k = 0; k < half; k++) {
+    rcos_[k] = cos(2.0 * M_PI * k / size_);
+    rsin_[k] = sin(2.0 * M_PI * k / size_);
+  }
+
+  rev_ = new int[half];
+  for (bits = 0; (1 << bits) < half; bits++)
+    ;
+  for (j = 0; j < half; j++) {
+    rev_[j] = 0;
+    for (k = 0; k < bits; k++) {
+      if (j & (1 << k)) rev_[j] |= 1 << (bits - 1 - k);
+    }
+  }
+
+  buf_ = new float[channels_ * size_];
+  tmp_ = new float[size_];
+  re_ = new float[half];
+  im_ = new float[half];
+  acc_ = new double[half + 1];
+  clear();
+}  // jspec()
+
+jspec::~jspec() {
+  delete [] window_;
+  delete [] twr_;
+  delete [] twi_;
+  delete [] rcos_;
+  delete [] rsin_;
+  delete [] rev_;
+  delete [] buf_;
+  delete [] tmp_;
+  delete [] re_;
+  delete [] im_;
+  delete [] acc_;
+}  // ~jspec()
+
+void jspec::clear() {
+  memset(acc_, 0, (size_ / 2 + 1) * sizeof(double));
+  segs_ = 0;
+  fill_ = 0;
+}  // clear()
+
+void jspec::restart() {
+  fill_ = 0;
+}  // restart()
+
+//
+// Frames go into buf_ until it holds a whole segment, which is then
+// transformed, and its second half kept as the first half of the next.
+//
+
+void jspec::data(const float* x, size_t n) {
+  long m;
+  int c;
+
+  while (n > 0) {
+    m = size_ - fill_;
+    if ((size_t) m > n) m = n;
+    deinterleave(x, m, channels_, buf_ + fill_, size_);
+    fill_ += m;
+    x += m * channels_;
+    n -= m;
+    if (fill_ < size_) {
+      break;
+    }
+    for (c = 0; c < channels_; c++) {
+      segment(buf_ + c * size_);
+      memmove(buf_ + c * size_, buf_ + c * size_ + size_ / 2, size_ / 2 * sizeof(float));
+    }
+    fill_ = size_ / 2;
+  }
+}  // data()
+
+void jspec::segment(const float* x) {
+  int half = size_ / 2;
+  long h;
+  int j, k;
+  double ar, ai, br, bi, er, ei, or_, oi, xr, xi;
+
+  multiply_vectors(tmp_, x, window_, size_);
+  for (j = 0; j < half; j++) {
+    re_[rev_[j]] = tmp_[2 * j];
+    im_[rev_[j]] = tmp_[2 * j + 1];
+  }
+  for (h = 1; h < half; h *= 2) {
+    fft_stage(re_, im_, half, h, twr_ + h - 1, twi_ + h - 1);
+  }
+
+  // DC and Nyquist are real, and have no mirror image to fold in.
+
+  xr = (double) re_[0] + im_[0];
+  acc_[0] += xr * xr;
+  xr = (double) re_[0] - im_[0];
+  acc_[half] += xr * xr;
+
+  for (k = 1; k < half; k++) {
+    ar = re_[k];
+    ai = im_[k];
+    br = re_[half - k];
+    bi = -im_[half - k];
+    er = 0.5 * (ar + br);
+    ei = 0.5 * (ai + bi);
+    or_ = 0.5 * (ai - bi);
+    oi = -0.5 * (ar - br);
+    xr = er + rcos_[k] * or_ + rsin_[k] * oi;
+    xi = ei + rcos_[k] * oi - rsin_[k] * or_;
+    acc_[k] += 2.0 * (xr * xr + xi * xi);
+  }
+  segs_++;
+}  // segment()
+
+int jspec::merge(const jspec& other) {
+  int k;
+
+  if (other.size_ != size_ || other.samplerate_ != samplerate_) {
+    return 0;
+  }
+  for (k = 0; k <= size_ / 2; k++) {
+    acc_[k] += other.acc_[k];
+  }
+  segs_ += other.segs_;
+  return 1;
+}  // merge()
+
+double jspec::psd(int k) {
+  if (segs_ <= 0) {
+    fprintf(stderr, "Not enough data to determine spectrum\n");
+    exit(1);
+  }
+  return acc_[k] / (segs_ * wsum2_ * samplerate_);
+}  // psd()
+
+double jspec::power(double lo, double hi) {
+  double df = (double) samplerate_ / size_;
+  double sum = 0.0;
+  int k;
+
+  for (k = 0; k <= size_ / 2; k++) {
+    if (k * df >= lo && k * df < hi) {
+      sum += psd(k);
+    }
+  }
+  return sum * df;
+}  // power()
+
+double jspec::flatness(double lo, double hi) {
+  double df = (double) samplerate_ / size_;
+  double sum = 0.0, logsum = 0.0, p;
+  int k, n = 0;
+
+  for (k = 0; k <= size_ / 2; k++) {
+    if (k * df >= lo && k * df < hi) {
+      p = psd(k);
+      if (p <= 0.0) {
+	return 0.0;
+      }
+      sum += p;
+      logsum += log(p);
+      n++;
+    }
+  }
+  if (n == 0) {
+    return 0.0;
+  }
+  return exp(logsum / n) / (sum / n);
+}  // flatness()
+
+double jspec::tone(double f, int harmonics) {
+  double df = (double) samplerate_ / size_;
+  double sum = 0.0, h;
+  int k;
+
+  for (k = 0; k <= size_ / 2; k++) {
+    h = (f > 0.0) ? floor(k * df / f + 0.5) : 0.0;
+    if (h < 1.0 && f > 0.0) h = 1.0;
+    if (h > harmonics) h = harmonics;
+    if (fabs(k * df - h * f) < 2.0 * df) {
+      sum += psd(k);
+    }
+  }
+  return sum * df;
+}  // tone()
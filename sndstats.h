@@ -9,12 +9,44 @@
 // 02/10/05  Adam Janin
 //    Initial version. See sndstats.cc
 //
+// jstat keeps a running mean and sum of squared deviations (Welford's
+// method) rather than raw sums, so the variance stays accurate for
+// long signals with a DC offset. Two jstats over disjoint data can be
+// merged, e.g. partial results from different threads or files.
+//
+// jhist keeps the distribution of the data, for percentiles. While
+// every value is a multiple of 1/32768 in [-1, 1), as is anything read
+// from an 8 or 16 bit file, it counts the 65536 levels exactly. From
+// the first value that isn't, it keeps a sketch with logarithmically
+// spaced buckets instead (after DDSketch): every quantile it reports
+// is within JHIST_ALPHA (0.5%) relative error of the true one.
+// Magnitudes below JHIST_MIN (2^-24, under the resolution of 24 bit
+// audio) count as zero, and above JHIST_MAX as JHIST_MAX. Memory is
+// fixed either way (512K for the levels, 44K for the sketch), and two
+// jhists can be merged in any order with the same result.
+//
+// jcov keeps per channel statistics of interleaved frames, and
+// optionally the co-moments between channels, for covariances and
+// correlations. It's updated and merged the same way as jstat.
+//
+// jspec keeps a Welch estimate of the power spectrum. The data of each
+// channel is cut into segments of size points (a power of two) that
+// overlap by half, and each is Hann windowed and transformed with a
+// real FFT. The power in each bin is averaged over every segment of
+// every channel. Two jspecs with the same size and sample rate can be
+// merged, whatever their channels.
+//
 
 #ifndef SNDSTATS_H
 #define SNDSTATS_H
 
+#include <stdio.h>
 #include <sndfile.h>
 
+#define JHIST_ALPHA (0.005)
+#define JHIST_MIN (1.0 / (1 << 24))
+#define JHIST_MAX (65536.0)
+
 class jstat {
 public:
   
@@ -23,27 +55,187 @@ public:
   void clear();		//  Reset everything
 
   void datum(double);	//  Add individual datum
+  void data(const float*, size_t); //  Add a block of data (much faster)
+  void merge(const jstat&); //  Add all the data of another jstat
+  void set(long long n, double mean, double m2, double min, double max);
+			//  Replace everything with these totals
+  void get(long long* n, double* mean, double* m2, double* min, double* max);
+			//  The totals, as passed to set()
   
   double mean();	//  Mean of data (or error if n=0)
   double std();		//  Standard deviation (or error if n < 2)
   double min();		//  Min of data (or error if n=0)
   double max();		//  Max of data (or error if n=0)
-  int	 n();		//  Number of data points
+  long long n();	//  Number of data points
+
+  void save(FILE*);	//  Write the state as one line of text
+  int  load(const char*); //  Restore from save() output (0 if malformed)
 
 private:
 
-  double sum_;		//  Sum of data points
-  double sum2_;		//  Sum of square of data points
+  double mean_;		//  Mean of data points so far
+  double m2_;		//  Sum of squared differences from the mean
   double min_;
   double max_;
-  int    n_;  
+  long long n_;
 };  //  class jstat  
 
+class jhist {
+public:
+
+  jhist();
+  ~jhist();
+
+  void clear();		//  Reset everything
+
+  void data(const float*, size_t); //  Add a block of data (NaNs are skipped)
+  void data16(const short*, size_t); //  Add 16 bit samples, as data()/32768
+  void merge(const jhist&); //  Add all the data of another jhist
+
+  double quantile(double q); //  Value with a fraction q of the data below it
+			//  (or error if n=0)
+  long long above(double level); //  Number of values with magnitude >= level
+  long long n();	//  Number of data points
+  int exact();		//  1 if quantile() is exact
+
+private:
+
+  jhist(const jhist&);	//  Not copyable
+  jhist& operator=(const jhist&);
+
+  void to_sketch();
+  int  bucket(double);
+  double value(int);
+
+  long long* levels_;	//  Count of each 16 bit level, or 0 if none yet
+  long long* buckets_;	//  Sketch, or 0 if still exact
+  long long n_;
+};  //  class jhist
+
+class jcov {
+public:
+
+  jcov(int channels, int cross = 1); // Without cross, only per channel stats
+  ~jcov();
+
+  void clear();		//  Reset everything
+
+  void data(const float*, size_t); //  Add interleaved frames
+  int  merge(const jcov&); //  Add all of another jcov (0 if it doesn't match)
+
+  int  channels() { return channels_; }
+  jstat channel(int);	//  Statistics of one channel
+  double cov(int, int);	//  Covariance of two channels (or error if n < 2)
+  double corr(int, int); //  Correlation of two channels (0 if either is flat)
+  long long n();	//  Number of frames
+
+private:
+
+  jcov(const jcov&);	//  Not copyable
+  jcov& operator=(const jcov&);
+
+  void update(long long n, const double* mean, const double* com,
+	      const float* lo, const float* hi);
+
+  int     channels_;
+  int     cross_;
+  double* mean_;	//  Mean of each channel
+  double* com_;		//  Sums of products of deviations, channels^2
+			//  (only the diagonal without cross)
+  double* min_;
+  double* max_;
+  float*  planes_;	//  Scratch for deinterleaving
+  long long n_;
+};  //  class jcov
+
+
+class jspec {
+public:
+
+  jspec(int size, int samplerate, int channels);
+  ~jspec();
+
+  void clear();		//  Reset everything
+  void restart();	//  The next data() doesn't follow on from the last
+			//  (drops the partial segment)
+
+  void data(const float*, size_t); //  Add interleaved frames
+  int  merge(const jspec&); //  Add all of another jspec (0 if it doesn't match)
+
+  int  size() { return size_; }
+  int  samplerate() { return samplerate_; }
+  long long segments() { return segs_; } //  Segments averaged (all channels)
+
+  double psd(int k);	//  Power density of bin k (0 to size/2), per Hz
+			//  (or error if no segments)
+  double power(double lo, double hi); //  Mean square in bins from lo to
+			//  below hi Hz
+  double flatness(double lo, double hi); //  Geometric over arithmetic mean
+			//  of psd() in the same bins (0 if no power)
+  double tone(double f, int harmonics); //  Mean square in bins within 2 of
+			//  f, 2f, ... harmonics*f Hz (f = 0 gives DC)
+
+private:
+
+  jspec(const jspec&);	//  Not copyable
+  jspec& operator=(const jspec&);
+
+  void segment(const float*);
+
+  int     size_;
+  int     samplerate_;
+  int     channels_;
+  double  wsum2_;	//  Sum of squares of the window
+  float*  window_;
+  float*  twr_;		//  FFT twiddles, stage with half h at h-1
+  float*  twi_;
+  double* rcos_;	//  Twiddles for the real split, size/2 each
+  double* rsin_;
+  int*    rev_;		//  Bit reversal for size/2 points
+  float*  buf_;		//  Current segment of each channel, planar
+  long    fill_;	//  Frames in buf_
+  float*  tmp_;		//  Scratch: windowed segment
+  float*  re_;		//  Scratch: size/2 point complex FFT
+  float*  im_;
+  double* acc_;		//  Sum of one sided power of each bin
+  long long segs_;
+};  //  class jspec
+
+
+// Each of these also adds the data to hist, cov and spec, if given.
+// Not sndstat_pcm(), which does neither cov nor spec. A failed seek
+// makes them return NULL (0 for sndstat_segments()), so that the
+// caller decides what to do about it.
 
 jstat* sndstat(SNDFILE* in, SF_INFO* info, const char* fname, 
-	       float skip_time = 0.0, float end_time = -1.0, jstat* stat = 0);
+	       float skip_time = 0.0, float end_time = -1.0, jstat* stat = 0,
+	       jhist* hist = 0, jcov* cov = 0, jspec* spec = 0);
+
+jstat* sndstat_range(SNDFILE* in, SF_INFO* info, const char* fname,
+		     long start, long end = -1, jstat* stat = 0, jhist* hist = 0,
+		     jcov* cov = 0, jspec* spec = 0);
+
+// Segments starts[i] through ends[i]-1 (to the end of the file if
+// ends[i] is negative) go to stats[i], for 0 <= i < n. The segments
+// may come in any order and overlap: the file is read once, in order,
+// and gaps between segments are skipped.
+int sndstat_segments(SNDFILE* in, SF_INFO* info, const char* fname, long n,
+		     const long* starts, const long* ends, jstat* stats);
+
+// Integer fast path for 16 and 24 bit PCM in WAV and NIST files: maps
+// the file and reads frames start through end-1 directly. Returns 0,
+// having done nothing, if the file isn't laid out that way, or start
+// is past the end.
+int sndstat_pcm(const char* fname, SF_INFO* info, long start, long end,
+		jstat* stat, jhist* hist = 0);
 
 jstat* sndstat_random(SNDFILE* in, SF_INFO* info, const char* fname, float random_sample,
-		      float random_size = 1.0, jstat* stat = 0);
+		      float random_size = 1.0, jstat* stat = 0, jhist* hist = 0,
+		      unsigned long long seed = 0, jcov* cov = 0, jspec* spec = 0);
+
+// Where sndstat_random() reads: the start frames of count excerpts of
+// size frames, one in each of count equal strata, in increasing order.
+void sndstat_strata(long frames, long size, long count, unsigned long long seed,
+		    long* starts);
 
 #endif // SNDSTATS_H
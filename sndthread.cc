@@ -0,0 +1,164 @@
+//////////////////////////////////////////////////////////////////////
+//
+// File: sndthread.cc
+//
+// Copyright 2016 International Computer Science Institute
+// See the file LICENSE for licensing terms.
+//
+// Threading helpers shared by the ia* tools.
+//
+// The queues hand over whole blocks of audio (thousands of samples),
+// so a plain mutex and condition variables cost nothing measurable
+// compared to decoding or mixing a block.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "sndthread.h"
+
+//////////////////////////////////////////////////////////////////////
+//
+// sndqueue methods
+//
+
+sndqueue::sndqueue(int nslots, long slotsize) {
+  nslots_ = nslots;
+  slotsize_ = slotsize;
+  head_ = 0;
+  tail_ = 0;
+  nfull_ = 0;
+  data_ = new float[nslots * slotsize];
+  counts_ = new long[nslots];
+  pthread_mutex_init(&lock_, NULL);
+  pthread_cond_init(&notfull_, NULL);
+  pthread_cond_init(&notempty_, NULL);
+}  // sndqueue()
+
+sndqueue::~sndqueue() {
+  pthread_cond_destroy(&notempty_);
+  pthread_cond_destroy(&notfull_);
+  pthread_mutex_destroy(&lock_);
+  delete [] counts_;
+  delete [] data_;
+}  // ~sndqueue()
+
+//
+// Only the producer moves tail_, so the slot returned here stays
+// untouched by the consumer until it is pushed.
+//
+
+float* sndqueue::claim() {
+  pthread_mutex_lock(&lock_);
+  while (nfull_ == nslots_) {
+    pthread_cond_wait(&notfull_, &lock_);
+  }
+  pthread_mutex_unlock(&lock_);
+  return data_ + tail_ * slotsize_;
+}  // claim()
+
+void sndqueue::push(long n) {
+  pthread_mutex_lock(&lock_);
+  counts_[tail_] = n;
+  tail_ = (tail_ + 1) % nslots_;
+  nfull_++;
+  pthread_cond_signal(&notempty_);
+  pthread_mutex_unlock(&lock_);
+}  // push()
+
+float* sndqueue::front(long* n) {
+  pthread_mutex_lock(&lock_);
+  while (nfull_ == 0) {
+    pthread_cond_wait(&notempty_, &lock_);
+  }
+  *n = counts_[head_];
+  pthread_mutex_unlock(&lock_);
+  return data_ + head_ * slotsize_;
+}  // front()
+
+void sndqueue::pop() {
+  pthread_mutex_lock(&lock_);
+  head_ = (head_ + 1) % nslots_;
+  nfull_--;
+  pthread_cond_signal(&notfull_);
+  pthread_mutex_unlock(&lock_);
+}  // pop()
+
+//////////////////////////////////////////////////////////////////////
+//
+// run_jobs()
+//
+
+struct job_state {
+  void (*fn)(void*, int);
+  void* arg;
+  int njobs;
+  int next;			//  Next job to hand out
+  pthread_mutex_t lock;
+};
+
+static void* job_thread(void* p) {
+  job_state* st = (job_state*) p;
+  int job;
+
+  for (;;) {
+    pthread_mutex_lock(&st->lock);
+    job = st->next++;
+    pthread_mutex_unlock(&st->lock);
+    if (job >= st->njobs) {
+      break;
+    }
+    st->fn(st->arg, job);
+  }
+  return 0;
+}  // job_thread()
+
+void run_jobs(int njobs, int nthreads, void (*fn)(void* arg, int job), void* arg) {
+  job_state st;
+  pthread_t* threads;
+  int i, nstarted;
+
+  if (nthreads <= 0) {
+    nthreads = num_cpus();
+  }
+  if (nthreads > njobs) {
+    nthreads = njobs;
+  }
+  if (nthreads <= 1) {
+    for (i = 0; i < njobs; i++) {
+      fn(arg, i);
+    }
+    return;
+  }
+
+  st.fn = fn;
+  st.arg = arg;
+  st.njobs = njobs;
+  st.next = 0;
+  pthread_mutex_init(&st.lock, NULL);
+
+  // If a thread can't be started, the ones that did still drain the
+  // whole job list, and the calling thread helps out if none did.
+
+  threads = new pthread_t[nthreads];
+  nstarted = 0;
+  for (i = 0; i < nthreads; i++) {
+    if (pthread_create(&threads[nstarted], NULL, job_thread, &st) == 0) {
+      nstarted++;
+    }
+  }
+  if (nstarted == 0) {
+    job_thread(&st);
+  }
+  for (i = 0; i < nstarted; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  delete [] threads;
+  pthread_mutex_destroy(&st.lock);
+}  // run_jobs()
+
+int num_cpus() {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n > 0) ? (int) n : 1;
+}  // num_cpus()
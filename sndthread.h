@@ -0,0 +1,61 @@
+//////////////////////////////////////////////////////////////////////
+//
+// File: sndthread.h
+//
+// Copyright 2016 International Computer Science Institute
+// See the file LICENSE for licensing terms.
+//
+// Threading helpers shared by the ia* tools. See sndthread.cc
+//
+
+#ifndef SNDTHREAD_H
+#define SNDTHREAD_H
+
+#include <pthread.h>
+
+//
+// A bounded single-producer/single-consumer queue of audio blocks.
+// The slots are owned by the queue, so blocks are filled and consumed
+// in place without copying. A count <= 0 marks the end of the stream.
+//
+
+class sndqueue {
+public:
+
+  sndqueue(int nslots, long slotsize);
+  ~sndqueue();
+
+  float* claim();		//  Producer: wait for an empty slot
+  void   push(long n);		//  Producer: publish claimed slot holding n values
+
+  float* front(long* n);	//  Consumer: wait for the oldest filled slot
+  void   pop();			//  Consumer: release the slot from front()
+
+  long   slotsize() { return slotsize_; }
+
+private:
+
+  pthread_mutex_t lock_;
+  pthread_cond_t  notfull_;
+  pthread_cond_t  notempty_;
+
+  float* data_;			//  nslots_ * slotsize_ samples
+  long*  counts_;		//  Number of valid samples in each slot
+  int    nslots_;
+  long   slotsize_;
+  int    head_;			//  Next slot the consumer will read
+  int    tail_;			//  Next slot the producer will fill
+  int    nfull_;		//  Number of published slots
+};  //  class sndqueue
+
+//
+// Call fn(arg, job) for job = 0 .. njobs-1 using up to nthreads
+// threads (one per CPU if nthreads <= 0). Jobs are started in order,
+// and run_jobs() returns when all of them have finished.
+//
+
+void run_jobs(int njobs, int nthreads, void (*fn)(void* arg, int job), void* arg);
+
+int num_cpus();			//  Number of online processors
+
+#endif // SNDTHREAD_H